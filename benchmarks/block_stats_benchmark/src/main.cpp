@@ -0,0 +1,239 @@
+// memory allocated for a mixed workload of mostly images and a few buffers,
+// once with blocks split by binding type like before blocks were shared and
+// once with mixed blocks. binds the workload, then replaces random resources
+// and reports allocated_size and high_water_mark of the memory allocator.
+// needs a Vulkan device but no window.
+
+#include <stdio.h>
+
+#include "shl/number_types.hpp"
+
+#include "mg/vk_error.hpp"
+#include "mg/impl/context.hpp"
+#include "mg/impl/memory_manager.hpp"
+
+constexpr const u32 IMAGE_COUNT = 200;
+constexpr const u32 BUFFER_COUNT = 10;
+constexpr const u32 RESOURCE_COUNT = IMAGE_COUNT + BUFFER_COUNT;
+constexpr const u64 OPERATION_COUNT = 4000;
+
+// textures from 128x128 up to 1024x1024, 4 MiB RGBA8 at most so none of them
+// is large enough for dedicated memory.
+constexpr const u32 MIN_IMAGE_SIZE_LOG2 = 7;
+constexpr const u32 MAX_IMAGE_SIZE_LOG2 = 10;
+constexpr const VkDeviceSize MIN_BUFFER_SIZE = 65536ull;
+constexpr const VkDeviceSize MAX_BUFFER_SIZE = 1048576ull;
+
+struct device
+{
+    VkInstance instance;
+    VkPhysicalDevice physical_device;
+    VkDevice device;
+};
+
+// resource i is images[i] if i < IMAGE_COUNT, buffers[i - IMAGE_COUNT] otherwise
+struct workload
+{
+    mg::vk_image *images[IMAGE_COUNT];
+    mg::vk_buffer *buffers[BUFFER_COUNT];
+};
+
+u64 random_state = 0x9e3779b97f4a7c15ull;
+
+u64 next_random()
+{
+    // xorshift64
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 7;
+    random_state ^= random_state << 17;
+    return random_state;
+}
+
+void create_device(device *dev)
+{
+    VkApplicationInfo appInfo{};
+    appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+    appInfo.pApplicationName = "block_stats_benchmark";
+    appInfo.apiVersion = VK_API_VERSION_1_2;
+
+    VkInstanceCreateInfo instanceInfo{};
+    instanceInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+    instanceInfo.pApplicationInfo = &appInfo;
+
+    VkResult res = vkCreateInstance(&instanceInfo, nullptr, &dev->instance);
+
+    if (res != VK_SUCCESS)
+        throw_vk_error(res, "could not create vulkan instance");
+
+    u32 count = 1;
+    res = vkEnumeratePhysicalDevices(dev->instance, &count, &dev->physical_device);
+
+    if (count == 0 || (res != VK_SUCCESS && res != VK_INCOMPLETE))
+        throw_vk_error(res, "no physical device");
+
+    float priority = 1.0f;
+    VkDeviceQueueCreateInfo queueInfo{};
+    queueInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+    queueInfo.queueFamilyIndex = 0;
+    queueInfo.queueCount = 1;
+    queueInfo.pQueuePriorities = &priority;
+
+    VkDeviceCreateInfo deviceInfo{};
+    deviceInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+    deviceInfo.queueCreateInfoCount = 1;
+    deviceInfo.pQueueCreateInfos = &queueInfo;
+
+    res = vkCreateDevice(dev->physical_device, &deviceInfo, nullptr, &dev->device);
+
+    if (res != VK_SUCCESS)
+        throw_vk_error(res, "could not create device");
+}
+
+void destroy_device(device *dev)
+{
+    vkDestroyDevice(dev->device, nullptr);
+    vkDestroyInstance(dev->instance, nullptr);
+}
+
+mg::vk_image *create_random_image(mg::memory_manager *mgr)
+{
+    const u32 steps = MAX_IMAGE_SIZE_LOG2 - MIN_IMAGE_SIZE_LOG2 + 1;
+    u32 width = 1u << (MIN_IMAGE_SIZE_LOG2 + ::next_random() % steps);
+    u32 height = 1u << (MIN_IMAGE_SIZE_LOG2 + ::next_random() % steps);
+
+    mg::vk_image *img = mg::create_image(mgr, VkExtent3D{width, height, 1}, 0, VK_IMAGE_TYPE_2D,
+                                         VK_FORMAT_R8G8B8A8_UNORM, 1, 1, VK_SAMPLE_COUNT_1_BIT, VK_IMAGE_TILING_OPTIMAL,
+                                         VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT);
+    mg::auto_bind_device_local_image(mgr, img);
+
+    return img;
+}
+
+mg::vk_buffer *create_random_buffer(mg::memory_manager *mgr)
+{
+    const u64 steps = (MAX_BUFFER_SIZE - MIN_BUFFER_SIZE) / MIN_BUFFER_SIZE + 1;
+    VkDeviceSize size = MIN_BUFFER_SIZE + (::next_random() % steps) * MIN_BUFFER_SIZE;
+
+    mg::vk_buffer *buf = mg::create_vertex_buffer(mgr, size, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+    mg::auto_bind_device_local_buffer(mgr, buf);
+
+    return buf;
+}
+
+void replace_resource(mg::memory_manager *mgr, workload *w, u32 resource)
+{
+    if (resource < IMAGE_COUNT)
+    {
+        if (w->images[resource] != nullptr)
+            mg::destroy_image(mgr, w->images[resource]);
+
+        w->images[resource] = ::create_random_image(mgr);
+    }
+    else
+    {
+        u32 i = resource - IMAGE_COUNT;
+
+        if (w->buffers[i] != nullptr)
+            mg::destroy_buffer(mgr, w->buffers[i]);
+
+        w->buffers[i] = ::create_random_buffer(mgr);
+    }
+}
+
+void print_stats(mg::memory_manager *mgr, const char *blocks, const char *phase)
+{
+    mg::memory_allocator *alloc = &mgr->allocator;
+
+    for (u32 i = 0; i < alloc->memory_properties.memoryTypeCount; ++i)
+    {
+        if (alloc->high_water_mark[i] == 0)
+            continue;
+
+        u32 block_count = 0;
+
+        for_array(mem, &alloc->allocated_memory)
+            if ((*mem)->type_index == i)
+                block_count += 1;
+
+        printf("%8s %8s %6u %8u %13.1f MiB %13.1f MiB\n", blocks, phase, i, block_count,
+               (double)alloc->allocated_size[i] / 1048576.0,
+               (double)alloc->high_water_mark[i] / 1048576.0);
+    }
+}
+
+void run(mg::context *ctx, bool mixed_blocks)
+{
+    const char *blocks = mixed_blocks ? "mixed" : "split";
+
+    // both runs create the same resources in the same order
+    random_state = 0x9e3779b97f4a7c15ull;
+
+    mg::memory_manager mgr;
+    mg::init(&mgr, ctx);
+    mgr.mixed_blocks = mixed_blocks;
+
+    workload w{};
+
+    // images and buffers are created interleaved like a level being loaded,
+    // one buffer after every twenty images.
+    u32 image = 0;
+    u32 buffer = 0;
+
+    for (u32 i = 0; i < RESOURCE_COUNT; ++i)
+    {
+        if ((i % 21 == 20 && buffer < BUFFER_COUNT) || image == IMAGE_COUNT)
+            ::replace_resource(&mgr, &w, IMAGE_COUNT + buffer++);
+        else
+            ::replace_resource(&mgr, &w, image++);
+    }
+
+    ::print_stats(&mgr, blocks, "loaded");
+
+    for (u64 i = 0; i < OPERATION_COUNT; ++i)
+        ::replace_resource(&mgr, &w, (u32)(::next_random() % RESOURCE_COUNT));
+
+    ::print_stats(&mgr, blocks, "churned");
+
+    mg::free(&mgr);
+}
+
+int main(int argc, const char *argv[])
+{
+    device dev;
+
+    // the memory manager only needs the device part of a context
+    static mg::context ctx;
+
+    try
+    {
+        ::create_device(&dev);
+
+        ctx.physical_device = dev.physical_device;
+        ctx.device = dev.device;
+        ctx.extensions.memory_budget = false;
+        vkGetPhysicalDeviceProperties(dev.physical_device, &ctx.physical_device_properties);
+
+        printf("%u images, %u buffers, %llu replacements, bufferImageGranularity %llu\n\n",
+               IMAGE_COUNT, BUFFER_COUNT, (unsigned long long)OPERATION_COUNT,
+               (unsigned long long)ctx.physical_device_properties.limits.bufferImageGranularity);
+
+        printf("%8s %8s %6s %8s %17s %17s\n", "blocks", "phase", "type", "count", "allocated_size", "high_water_mark");
+
+        ::run(&ctx, false);
+        ::run(&ctx, true);
+    }
+    catch (mg::vk_error &err)
+    {
+        printf("%s\n", err.what);
+        return 1;
+    }
+    catch (error &err)
+    {
+        printf("%s\n", err.what);
+        return 1;
+    }
+
+    ::destroy_device(&dev);
+
+    return 0;
+}
@@ -0,0 +1,97 @@
+// copy throughput from 1 MiB to 1 GiB, plain memcpy against the copy pool
+// that write_buffer and the staging ring use for large writes, with and
+// without non-temporal stores. each copy goes to the next region of a 1 GiB
+// buffer so that the destination is not already cached, like freshly mapped
+// memory. no GPU needed.
+
+#include <stdio.h>
+#include <string.h>
+
+#include "shl/memory.hpp"
+#include "shl/time.hpp"
+
+#include "mg/impl/copy_pool.hpp"
+
+constexpr const u64 MIN_COPY_SIZE = 1ull << 20;
+constexpr const u64 MAX_COPY_SIZE = 1ull << 30;
+
+// bytes copied per size and method
+constexpr const u64 BYTES_PER_RUN = 4ull << 30;
+
+enum class copy_method
+{
+    Memcpy,
+    NonTemporal,
+    Parallel,
+    ParallelNonTemporal
+};
+
+void copy(mg::copy_pool *pool, copy_method method, void *dst, const void *src, u64 size)
+{
+    switch (method)
+    {
+    case copy_method::Memcpy:              memcpy(dst, src, size); break;
+    case copy_method::NonTemporal:         mg::copy_non_temporal(dst, src, size); break;
+    case copy_method::Parallel:            mg::parallel_copy(pool, dst, src, size, false); break;
+    case copy_method::ParallelNonTemporal: mg::parallel_copy(pool, dst, src, size, true); break;
+    }
+}
+
+// returns GB/s
+double run(mg::copy_pool *pool, copy_method method, u8 *dst, const u8 *src, u64 size)
+{
+    u64 count = BYTES_PER_RUN / size;
+
+    timespan start;
+    timespan now;
+    get_time(&start);
+
+    for (u64 i = 0; i < count; ++i)
+    {
+        u64 offset = (i * size) % MAX_COPY_SIZE;
+        ::copy(pool, method, dst + offset, src + offset, size);
+    }
+
+    get_time(&now);
+
+    return (double)(count * size) / 1000000000.0 / get_seconds_difference(&start, &now);
+}
+
+int main(int argc, const char *argv[])
+{
+    u8 *src = ::allocate_memory<u8>(MAX_COPY_SIZE);
+    u8 *dst = ::allocate_memory<u8>(MAX_COPY_SIZE);
+
+    // fault the pages in before anything is timed
+    memset(src, 0x5a, MAX_COPY_SIZE);
+    memset(dst, 0, MAX_COPY_SIZE);
+
+    mg::copy_pool pool;
+    mg::init(&pool);
+
+    printf("copy pool: %u workers, parallel from %llu MiB, %llu MiB chunks\n\n",
+           pool.thread_count, (unsigned long long)(pool.min_parallel_size >> 20),
+           (unsigned long long)(mg::PARALLEL_COPY_CHUNK_SIZE >> 20));
+    printf("%10s %14s %14s %14s %14s\n", "size", "memcpy", "non-temporal", "parallel", "parallel nt");
+
+    for (u64 size = MIN_COPY_SIZE; size <= MAX_COPY_SIZE; size *= 4)
+    {
+        double memcpy_gbs = ::run(&pool, copy_method::Memcpy, dst, src, size);
+        double nt_gbs = ::run(&pool, copy_method::NonTemporal, dst, src, size);
+        double parallel_gbs = ::run(&pool, copy_method::Parallel, dst, src, size);
+        double parallel_nt_gbs = ::run(&pool, copy_method::ParallelNonTemporal, dst, src, size);
+
+        printf("%6llu MiB %9.2f GB/s %9.2f GB/s %9.2f GB/s %9.2f GB/s\n", (unsigned long long)(size >> 20),
+               memcpy_gbs, nt_gbs, parallel_gbs, parallel_nt_gbs);
+    }
+
+    // the 1 GiB copies covered all of dst
+    if (memcmp(dst, src, MAX_COPY_SIZE) != 0)
+        printf("copied data does not match\n");
+
+    mg::free(&pool);
+    ::free_memory(dst);
+    ::free_memory(src);
+
+    return 0;
+}
@@ -0,0 +1,244 @@
+// replays create/destroy churn of sub-buffers inside a single buffer,
+// once against the linked list vk_buffer used to keep Linear sub-buffers
+// in and once against the sorted offset and size arrays it uses now.
+// no GPU needed.
+
+#include <stdio.h>
+
+#include "shl/linked_list.hpp"
+#include "shl/time.hpp"
+
+#include "mg/impl/vk_buffer.hpp"
+
+constexpr const VkDeviceSize BUFFER_SIZE = 64ull << 20;
+constexpr const VkDeviceSize ALIGNMENT = 256;
+constexpr const VkDeviceSize MIN_SUB_BUFFER_SIZE = 256;
+constexpr const VkDeviceSize MAX_SUB_BUFFER_SIZE = 8192;
+constexpr const u64 OPERATION_COUNT = 20000;
+
+// one destroy of a random sub-buffer followed by a create of a new one
+struct churn_operation
+{
+    u32 sub_buffer;
+    VkDeviceSize size;
+};
+
+u64 random_state = 0x9e3779b97f4a7c15ull;
+
+u64 next_random()
+{
+    // xorshift64
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 7;
+    random_state ^= random_state << 17;
+    return random_state;
+}
+
+VkDeviceSize random_size()
+{
+    u64 steps = (MAX_SUB_BUFFER_SIZE - MIN_SUB_BUFFER_SIZE) / ALIGNMENT + 1;
+    return MIN_SUB_BUFFER_SIZE + (::next_random() % steps) * ALIGNMENT;
+}
+
+// the linked list, as vk_buffer kept sub-buffers before the arrays
+struct list_buffer
+{
+    VkDeviceSize size;
+    mg::sub_buffer_range largest_contiguous_free_space;
+    linked_list<mg::sub_buffer_range> sub_buffers;
+};
+
+void list_update_largest_free_space(list_buffer *buf)
+{
+    buf->largest_contiguous_free_space.size = 0;
+    VkDeviceSize prev_end = 0;
+
+    for_list(r, &buf->sub_buffers)
+    {
+        VkDeviceSize diff_size = r->offset - prev_end;
+
+        if (diff_size > buf->largest_contiguous_free_space.size)
+        {
+            buf->largest_contiguous_free_space.offset = prev_end;
+            buf->largest_contiguous_free_space.size = diff_size;
+        }
+
+        prev_end = end(r);
+    }
+
+    if (buf->size - prev_end > buf->largest_contiguous_free_space.size)
+    {
+        buf->largest_contiguous_free_space.offset = prev_end;
+        buf->largest_contiguous_free_space.size = buf->size - prev_end;
+    }
+}
+
+// returns the offset of the sub-buffer or UINT64_MAX
+VkDeviceSize list_create(list_buffer *buf, VkDeviceSize size, VkDeviceSize alignment)
+{
+    if (!mg::has_space_for(&buf->largest_contiguous_free_space, size, alignment))
+        return UINT64_MAX;
+
+    mg::sub_buffer_range gap{0, 0};
+
+    for_list(i, r, &buf->sub_buffers)
+    {
+        gap.size = r->offset - gap.offset;
+
+        if (mg::has_space_for(&gap, size, alignment))
+            break;
+
+        gap.offset = end(r);
+    }
+
+    if (i >= buf->sub_buffers.size)
+    {
+        gap.size = buf->size - gap.offset;
+
+        if (!mg::has_space_for(&gap, size, alignment))
+            return UINT64_MAX;
+    }
+
+    mg::sub_buffer_range *sb = &::insert_elements(&buf->sub_buffers, i, 1)->value;
+    sb->offset = mg::align_next(gap.offset, alignment);
+    sb->size = size;
+
+    ::list_update_largest_free_space(buf);
+    return sb->offset;
+}
+
+void list_destroy(list_buffer *buf, VkDeviceSize offset)
+{
+    for_list(i, r, &buf->sub_buffers)
+        if (r->offset >= offset)
+            break;
+
+    if (i >= buf->sub_buffers.size || r->offset != offset)
+        return;
+
+    ::remove_elements(&buf->sub_buffers, i, 1);
+    ::list_update_largest_free_space(buf);
+}
+
+// returns operations per second
+double run_list(u32 sub_buffer_count, const churn_operation *ops, u64 op_count, u64 *failed)
+{
+    list_buffer buf;
+    buf.size = BUFFER_SIZE;
+    buf.largest_contiguous_free_space = {0, BUFFER_SIZE};
+    ::init(&buf.sub_buffers);
+
+    array<VkDeviceSize> offsets;
+    ::init(&offsets, sub_buffer_count);
+
+    for (u32 i = 0; i < sub_buffer_count; ++i)
+        offsets[i] = ::list_create(&buf, ::random_size(), ALIGNMENT);
+
+    timespan start;
+    timespan now;
+    get_time(&start);
+
+    for (u64 i = 0; i < op_count; ++i)
+    {
+        VkDeviceSize *offset = offsets.data + ops[i].sub_buffer;
+
+        if (*offset != UINT64_MAX)
+            ::list_destroy(&buf, *offset);
+
+        *offset = ::list_create(&buf, ops[i].size, ALIGNMENT);
+
+        if (*offset == UINT64_MAX)
+            *failed += 1;
+    }
+
+    get_time(&now);
+
+    ::free(&offsets);
+    ::free(&buf.sub_buffers);
+
+    return (double)op_count / get_seconds_difference(&start, &now);
+}
+
+double run_arrays(u32 sub_buffer_count, const churn_operation *ops, u64 op_count, u64 *failed)
+{
+    mg::vk_buffer buf;
+    mg::init(&buf, nullptr, BUFFER_SIZE);
+
+    array<mg::vk_sub_buffer*> sub_buffers;
+    ::init(&sub_buffers, sub_buffer_count);
+
+    for (u32 i = 0; i < sub_buffer_count; ++i)
+    {
+        VkDeviceSize size = ::random_size();
+        sub_buffers[i] = nullptr;
+
+        if (mg::has_space_for(&buf, size, ALIGNMENT))
+            sub_buffers[i] = mg::create_sub_buffer(&buf, size, ALIGNMENT);
+    }
+
+    timespan start;
+    timespan now;
+    get_time(&start);
+
+    for (u64 i = 0; i < op_count; ++i)
+    {
+        mg::vk_sub_buffer **sb = sub_buffers.data + ops[i].sub_buffer;
+
+        if (*sb != nullptr)
+            mg::destroy_sub_buffer(*sb);
+
+        *sb = nullptr;
+
+        if (mg::has_space_for(&buf, ops[i].size, ALIGNMENT))
+            *sb = mg::create_sub_buffer(&buf, ops[i].size, ALIGNMENT);
+        else
+            *failed += 1;
+    }
+
+    get_time(&now);
+
+    ::free(&sub_buffers);
+    mg::free(&buf);
+
+    return (double)op_count / get_seconds_difference(&start, &now);
+}
+
+int main(int argc, const char *argv[])
+{
+    const u32 sub_buffer_counts[] = {64, 512, 2048, 8192};
+
+    array<churn_operation> ops;
+    ::init(&ops, OPERATION_COUNT);
+
+    printf("%u destroy/create pairs in a %llu MiB buffer, sizes %llu to %llu bytes\n\n",
+           (u32)OPERATION_COUNT, (unsigned long long)(BUFFER_SIZE >> 20),
+           (unsigned long long)MIN_SUB_BUFFER_SIZE, (unsigned long long)MAX_SUB_BUFFER_SIZE);
+    printf("%12s %16s %16s %10s\n", "sub-buffers", "list op/s", "arrays op/s", "speedup");
+
+    for (u32 count : sub_buffer_counts)
+    {
+        for (u64 i = 0; i < ops.size; ++i)
+        {
+            ops[i].sub_buffer = (u32)(::next_random() % count);
+            ops[i].size = ::random_size();
+        }
+
+        u64 list_failed = 0;
+        u64 arrays_failed = 0;
+        u64 state = random_state;
+        double list_ops = ::run_list(count, ops.data, ops.size, &list_failed);
+        random_state = state;
+        double arrays_ops = ::run_arrays(count, ops.data, ops.size, &arrays_failed);
+
+        printf("%12u %16.0f %16.0f %9.1fx", count, list_ops, arrays_ops, arrays_ops / list_ops);
+
+        if (list_failed > 0 || arrays_failed > 0)
+            printf("  (failed creates: list %llu, arrays %llu)", (unsigned long long)list_failed, (unsigned long long)arrays_failed);
+
+        printf("\n");
+    }
+
+    ::free(&ops);
+
+    return 0;
+}
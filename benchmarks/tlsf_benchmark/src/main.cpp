@@ -0,0 +1,234 @@
+// replays bind/unbind churn of resources inside a single memory block,
+// once against the linked list walk vk_memory used to place bindings and
+// once against the TLSF allocator it uses now. no GPU needed.
+
+#include <stdio.h>
+
+#include "shl/linked_list.hpp"
+#include "shl/time.hpp"
+
+#include "mg/number_range.hpp"
+#include "mg/impl/tlsf_allocator.hpp"
+
+constexpr const VkDeviceSize BLOCK_SIZE = 1ull << 30;
+constexpr const VkDeviceSize ALIGNMENT = 256;
+constexpr const VkDeviceSize MIN_RESOURCE_SIZE = 4096;
+constexpr const VkDeviceSize MAX_RESOURCE_SIZE = 126976;
+constexpr const u64 OPERATION_COUNT = 20000;
+
+typedef mg::number_range<VkDeviceSize> range;
+
+// one unbind of a random resource followed by a bind of a new one
+struct churn_operation
+{
+    u32 resource;
+    VkDeviceSize size;
+};
+
+u64 random_state = 0x9e3779b97f4a7c15ull;
+
+u64 next_random()
+{
+    // xorshift64
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 7;
+    random_state ^= random_state << 17;
+    return random_state;
+}
+
+VkDeviceSize random_size()
+{
+    u64 steps = (MAX_RESOURCE_SIZE - MIN_RESOURCE_SIZE) / ALIGNMENT + 1;
+    return MIN_RESOURCE_SIZE + (::next_random() % steps) * ALIGNMENT;
+}
+
+// the list walk, as vk_memory did it before the TLSF allocator
+struct list_binding
+{
+    range r;
+    u32 resource;
+};
+
+struct list_memory
+{
+    VkDeviceSize size;
+    range largest_contiguous_free_space;
+    linked_list<list_binding> bindings;
+};
+
+bool list_bind(list_memory *mem, u32 resource, VkDeviceSize size, VkDeviceSize alignment)
+{
+    VkDeviceSize prev_end = 0;
+
+    for_list(i, binding, &mem->bindings)
+    {
+        if (binding->r.offset - prev_end >= size)
+            break;
+
+        prev_end = mg::align_next(end(&binding->r), alignment);
+    }
+
+    if (i >= mem->bindings.size && mem->size - prev_end < size)
+        return false;
+
+    list_binding *b = &::insert_elements(&mem->bindings, i, 1)->value;
+    b->r.offset = prev_end;
+    b->r.size = size;
+    b->resource = resource;
+    return true;
+}
+
+void list_unbind(list_memory *mem, u32 resource)
+{
+    for_list(i, binding, &mem->bindings)
+        if (binding->resource == resource)
+            break;
+
+    if (i < mem->bindings.size)
+        ::remove_elements(&mem->bindings, i, 1);
+}
+
+void list_update_largest_free_space(list_memory *mem)
+{
+    mem->largest_contiguous_free_space.size = 0;
+    VkDeviceSize prev_end = 0;
+
+    for_list(binding, &mem->bindings)
+    {
+        VkDeviceSize diff_size = binding->r.offset - prev_end;
+
+        if (diff_size > mem->largest_contiguous_free_space.size)
+        {
+            mem->largest_contiguous_free_space.offset = prev_end;
+            mem->largest_contiguous_free_space.size = diff_size;
+        }
+
+        prev_end = end(&binding->r);
+    }
+
+    if (mem->size - prev_end > mem->largest_contiguous_free_space.size)
+    {
+        mem->largest_contiguous_free_space.offset = prev_end;
+        mem->largest_contiguous_free_space.size = mem->size - prev_end;
+    }
+}
+
+// returns operations per second
+double run_list(u32 resource_count, const churn_operation *ops, u64 op_count, u64 *failed)
+{
+    list_memory mem;
+    mem.size = BLOCK_SIZE;
+    ::init(&mem.bindings);
+
+    for (u32 i = 0; i < resource_count; ++i)
+    {
+        ::list_bind(&mem, i, ::random_size(), ALIGNMENT);
+        ::list_update_largest_free_space(&mem);
+    }
+
+    timespan start;
+    timespan now;
+    get_time(&start);
+
+    for (u64 i = 0; i < op_count; ++i)
+    {
+        ::list_unbind(&mem, ops[i].resource);
+        ::list_update_largest_free_space(&mem);
+
+        if (!::list_bind(&mem, ops[i].resource, ops[i].size, ALIGNMENT))
+            *failed += 1;
+
+        ::list_update_largest_free_space(&mem);
+    }
+
+    get_time(&now);
+    ::free(&mem.bindings);
+
+    return (double)op_count / get_seconds_difference(&start, &now);
+}
+
+double run_tlsf(u32 resource_count, const churn_operation *ops, u64 op_count, u64 *failed)
+{
+    mg::tlsf_allocator alloc;
+    mg::init(&alloc, BLOCK_SIZE);
+
+    array<u32> blocks;
+    ::init(&blocks, resource_count);
+
+    VkDeviceSize offset;
+    mg::tlsf_range largest{0, 0};
+
+    for (u32 i = 0; i < resource_count; ++i)
+        blocks[i] = mg::allocate_block(&alloc, ::random_size(), ALIGNMENT, &offset);
+
+    timespan start;
+    timespan now;
+    get_time(&start);
+
+    for (u64 i = 0; i < op_count; ++i)
+    {
+        u32 *block = blocks.data + ops[i].resource;
+
+        if (*block != mg::TLSF_INVALID_BLOCK)
+            mg::free_block(&alloc, *block);
+
+        largest = mg::largest_free_range(&alloc);
+        *block = mg::allocate_block(&alloc, ops[i].size, ALIGNMENT, &offset);
+
+        if (*block == mg::TLSF_INVALID_BLOCK)
+            *failed += 1;
+
+        largest = mg::largest_free_range(&alloc);
+    }
+
+    get_time(&now);
+
+    // keep the lookups from being optimized away
+    if (largest.size > BLOCK_SIZE)
+        printf("?\n");
+
+    ::free(&blocks);
+    mg::free(&alloc);
+
+    return (double)op_count / get_seconds_difference(&start, &now);
+}
+
+int main(int argc, const char *argv[])
+{
+    const u32 resource_counts[] = {64, 512, 2048, 8192};
+
+    array<churn_operation> ops;
+    ::init(&ops, OPERATION_COUNT);
+
+    printf("%u bind/unbind pairs in a %llu MiB block, sizes %llu to %llu bytes\n\n",
+           (u32)OPERATION_COUNT, (unsigned long long)(BLOCK_SIZE >> 20),
+           (unsigned long long)MIN_RESOURCE_SIZE, (unsigned long long)MAX_RESOURCE_SIZE);
+    printf("%10s %16s %16s %10s\n", "resources", "list walk op/s", "tlsf op/s", "speedup");
+
+    for (u32 count : resource_counts)
+    {
+        for (u64 i = 0; i < ops.size; ++i)
+        {
+            ops[i].resource = (u32)(::next_random() % count);
+            ops[i].size = ::random_size();
+        }
+
+        u64 list_failed = 0;
+        u64 tlsf_failed = 0;
+        u64 state = random_state;
+        double list_ops = ::run_list(count, ops.data, ops.size, &list_failed);
+        random_state = state;
+        double tlsf_ops = ::run_tlsf(count, ops.data, ops.size, &tlsf_failed);
+
+        printf("%10u %16.0f %16.0f %9.1fx", count, list_ops, tlsf_ops, tlsf_ops / list_ops);
+
+        if (list_failed > 0 || tlsf_failed > 0)
+            printf("  (failed binds: list %llu, tlsf %llu)", (unsigned long long)list_failed, (unsigned long long)tlsf_failed);
+
+        printf("\n");
+    }
+
+    ::free(&ops);
+
+    return 0;
+}
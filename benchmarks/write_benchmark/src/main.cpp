@@ -0,0 +1,203 @@
+// write throughput into host visible memory, once mapping the memory for
+// every write like write_buffer did before vk_memory was kept mapped, and
+// once writing through the persistent mapping of the memory.
+// needs a Vulkan device but no window.
+
+#include <stdio.h>
+#include <string.h>
+
+#include "shl/memory.hpp"
+#include "shl/time.hpp"
+
+#include "mg/vk_error.hpp"
+#include "mg/impl/vk_memory.hpp"
+
+constexpr const VkDeviceSize MEMORY_SIZE = 64ull << 20;
+
+struct write_test
+{
+    VkDeviceSize size;
+    u64 count;
+};
+
+struct device
+{
+    VkInstance instance;
+    VkPhysicalDevice physical_device;
+    VkDevice device;
+};
+
+void create_device(device *dev)
+{
+    VkApplicationInfo appInfo{};
+    appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+    appInfo.pApplicationName = "write_benchmark";
+    appInfo.apiVersion = VK_API_VERSION_1_2;
+
+    VkInstanceCreateInfo instanceInfo{};
+    instanceInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+    instanceInfo.pApplicationInfo = &appInfo;
+
+    VkResult res = vkCreateInstance(&instanceInfo, nullptr, &dev->instance);
+
+    if (res != VK_SUCCESS)
+        throw_vk_error(res, "could not create vulkan instance");
+
+    u32 count = 1;
+    res = vkEnumeratePhysicalDevices(dev->instance, &count, &dev->physical_device);
+
+    if (count == 0 || (res != VK_SUCCESS && res != VK_INCOMPLETE))
+        throw_vk_error(res, "no physical device");
+
+    float priority = 1.0f;
+    VkDeviceQueueCreateInfo queueInfo{};
+    queueInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+    queueInfo.queueFamilyIndex = 0;
+    queueInfo.queueCount = 1;
+    queueInfo.pQueuePriorities = &priority;
+
+    VkDeviceCreateInfo deviceInfo{};
+    deviceInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+    deviceInfo.queueCreateInfoCount = 1;
+    deviceInfo.pQueueCreateInfos = &queueInfo;
+
+    res = vkCreateDevice(dev->physical_device, &deviceInfo, nullptr, &dev->device);
+
+    if (res != VK_SUCCESS)
+        throw_vk_error(res, "could not create device");
+}
+
+void destroy_device(device *dev)
+{
+    vkDestroyDevice(dev->device, nullptr);
+    vkDestroyInstance(dev->instance, nullptr);
+}
+
+void allocate_host_memory(device *dev, mg::vk_memory *out)
+{
+    VkPhysicalDeviceMemoryProperties props;
+    vkGetPhysicalDeviceMemoryProperties(dev->physical_device, &props);
+
+    // what the staging memory of write_buffer is
+    const VkMemoryPropertyFlags flags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    u32 type_index = UINT32_MAX;
+
+    for (u32 i = 0; i < props.memoryTypeCount; ++i)
+        if ((props.memoryTypes[i].propertyFlags & flags) == flags)
+        {
+            type_index = i;
+            break;
+        }
+
+    if (type_index == UINT32_MAX)
+        throw_error("no host coherent memory type");
+
+    VkMemoryAllocateInfo info{};
+    info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    info.allocationSize = MEMORY_SIZE;
+    info.memoryTypeIndex = type_index;
+
+    VkDeviceMemory memory;
+    VkResult res = vkAllocateMemory(dev->device, &info, nullptr, &memory);
+
+    if (res != VK_SUCCESS)
+        throw_vk_error(res, "could not allocate %u bytes of host memory", MEMORY_SIZE);
+
+    mg::init(out, memory, MEMORY_SIZE, props.memoryTypes[type_index].propertyFlags, mg::memory_binding_type::Buffer, type_index);
+}
+
+// returns bytes per second
+double write_mapping_every_time(device *dev, mg::vk_memory *mem, const u8 *data, const write_test *test)
+{
+    timespan start;
+    timespan now;
+    get_time(&start);
+
+    for (u64 i = 0; i < test->count; ++i)
+    {
+        VkDeviceSize offset = (i * test->size) % MEMORY_SIZE;
+        void *pdata;
+        vkMapMemory(dev->device, mem->memory, offset, test->size, 0, &pdata);
+        memcpy(pdata, data + offset, test->size);
+        vkUnmapMemory(dev->device, mem->memory);
+    }
+
+    get_time(&now);
+
+    return (double)(test->size * test->count) / get_seconds_difference(&start, &now);
+}
+
+double write_persistently_mapped(device *dev, mg::vk_memory *mem, const u8 *data, const write_test *test)
+{
+    // memory can't be mapped twice, so it is only mapped for this run.
+    // vk_memory is mapped once when it is allocated, the first write to
+    // every page happens before timing like it would in the first frames.
+    u8 *mapped = (u8*)mg::map_memory(mem, dev->device);
+    memcpy(mapped, data, MEMORY_SIZE);
+
+    timespan start;
+    timespan now;
+    get_time(&start);
+
+    for (u64 i = 0; i < test->count; ++i)
+    {
+        VkDeviceSize offset = (i * test->size) % MEMORY_SIZE;
+        memcpy(mapped + offset, data + offset, test->size);
+    }
+
+    get_time(&now);
+    mg::unmap_memory(mem, dev->device);
+
+    return (double)(test->size * test->count) / get_seconds_difference(&start, &now);
+}
+
+int main(int argc, const char *argv[])
+{
+    const write_test tests[] = {
+        {256, 1000000},
+        {MEMORY_SIZE, 32}
+    };
+
+    device dev;
+    mg::vk_memory mem;
+    u8 *data = nullptr;
+
+    try
+    {
+        ::create_device(&dev);
+        ::allocate_host_memory(&dev, &mem);
+    }
+    catch (mg::vk_error &err)
+    {
+        printf("%s\n", err.what);
+        return 1;
+    }
+    catch (error &err)
+    {
+        printf("%s\n", err.what);
+        return 1;
+    }
+
+    data = ::allocate_memory<u8>(MEMORY_SIZE);
+    memset(data, 0x5a, MEMORY_SIZE);
+
+    printf("%12s %10s %18s %18s %10s\n", "write size", "writes", "map per write", "persistent map", "speedup");
+
+    for (const write_test &test : tests)
+    {
+        double before = ::write_mapping_every_time(&dev, &mem, data, &test);
+        double after = ::write_persistently_mapped(&dev, &mem, data, &test);
+
+        printf("%12llu %10llu %13.1f MB/s %13.1f MB/s %9.1fx\n",
+               (unsigned long long)test.size, (unsigned long long)test.count,
+               before / 1000000.0, after / 1000000.0, after / before);
+    }
+
+    ::free_memory(data);
+
+    vkFreeMemory(dev.device, mem.memory, nullptr);
+    mg::free(&mem);
+    ::destroy_device(&dev);
+
+    return 0;
+}
@@ -90,9 +90,14 @@ void mg::setup_window_context(context *ctx, mg::window *window)
     mg::create_swapchain(ctx);
     mg::set_swapchain_images(ctx);
     mg::create_swapchain_image_views(ctx);
+    mg::create_depth_buffers(ctx);
     mg::create_render_pass(ctx);
     mg::create_framebuffers(ctx);
     mg::create_frame_data(ctx);
+    mg::create_frame_allocators(ctx);
+    mg::create_staging_ring(ctx);
+    mg::create_transfer_queue(ctx);
+    mg::create_copy_pool(ctx);
 }
 
 void mg::set_render_size(context *ctx, u32 width, u32 height)
@@ -145,12 +150,35 @@ void submit_frame_commands(mg::context *ctx, mg::frame_data *frame, u32 image_in
     VkSubmitInfo submitInfo{};
     submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 
-    VkPipelineStageFlags waitStages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
-    submitInfo.waitSemaphoreCount = 1;
-    submitInfo.pWaitSemaphores = &frame->present_semaphore;
+    // the frame may read everything that was uploaded before it was submitted,
+    // except chunks of unfinished file uploads. the defragmenter may copy
+    // any resource, frames that defragment wait for all submitted uploads.
+    u64 upload_value = ctx->memory_manager.defragmenter.max_bytes_per_frame > 0 ? ctx->transfer.value : ctx->transfer.frame_wait_value;
+
+    VkSemaphore waitSemaphores[] = {frame->present_semaphore, ctx->transfer.timeline};
+    u64 waitValues[] = {0, upload_value};
+    VkPipelineStageFlags waitStages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT};
+
+    VkTimelineSemaphoreSubmitInfo timelineInfo{};
+    timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    timelineInfo.waitSemaphoreValueCount = 2;
+    timelineInfo.pWaitSemaphoreValues = waitValues;
+
+    // upload batches wait for the frame before overwriting what it reads.
+    // frames with uploads signal when they are done, see record_frame_uploads
+    VkSemaphore signalSemaphores[] = {frame->render_semaphore, ctx->transfer.graphics_timeline, ctx->transfer.timeline};
+    u64 signalValues[] = {0, mg::next_graphics_value(&ctx->transfer), frame->upload_value};
+    u32 signalCount = frame->upload_value != 0 ? 3 : 2;
+
+    timelineInfo.signalSemaphoreValueCount = signalCount;
+    timelineInfo.pSignalSemaphoreValues = signalValues;
+
+    submitInfo.pNext = &timelineInfo;
+    submitInfo.waitSemaphoreCount = 2;
+    submitInfo.pWaitSemaphores = waitSemaphores;
     submitInfo.pWaitDstStageMask = waitStages;
-    submitInfo.signalSemaphoreCount = 1;
-    submitInfo.pSignalSemaphores = &frame->render_semaphore;
+    submitInfo.signalSemaphoreCount = signalCount;
+    submitInfo.pSignalSemaphores = signalSemaphores;
 
     submitInfo.commandBufferCount = 1;
     submitInfo.pCommandBuffers = &frame->command_buffers[image_index];
@@ -159,6 +187,9 @@ void submit_frame_commands(mg::context *ctx, mg::frame_data *frame, u32 image_in
 
     if (res != VK_SUCCESS)
         throw_vk_error(res, "%p failed to submit draw command buffer", ctx);
+
+    if (frame->upload_value != 0)
+        ctx->transfer.value = frame->upload_value;
 }
 
 void recreate_swapchain(mg::context *ctx)
@@ -173,6 +204,7 @@ void recreate_swapchain(mg::context *ctx)
     mg::create_swapchain(ctx);
     mg::set_swapchain_images(ctx);
     mg::create_swapchain_image_views(ctx);
+    mg::update_depth_buffers(ctx);
     mg::create_render_pass(ctx);
     mg::create_framebuffers(ctx);
     mg::create_frame_data(ctx);
@@ -208,6 +240,7 @@ void mg::update(mg::context *ctx, float dt)
 {
     ctx->time_data.elapsed_time += dt;
 
+    mg::stream_file_uploads(ctx);
     mg::upload_queued_buffers(ctx);
 }
 
@@ -219,6 +252,9 @@ bool mg::start_rendering(mg::context *ctx)
     vkWaitForFences(ctx->device, 1, &frame->render_fence, true, UINT64_MAX);
     mg::descriptor_pool_manager *descriptor_mgr = &frame->descriptor_pool_manager;
     mg::reset_pools(descriptor_mgr);
+    mg::reset(&frame->frame_allocator);
+    mg::update_uploads(ctx);
+    mg::complete_downloads(&ctx->downloads, &ctx->memory_manager, ctx->current_frame);
 
     res = vkAcquireNextImageKHR(ctx->device, ctx->swapchain, UINT64_MAX, frame->present_semaphore, nullptr, &ctx->current_image_index);
     u32 image_index = ctx->current_image_index;
@@ -250,6 +286,13 @@ bool mg::start_rendering(mg::context *ctx)
     if (res != VK_SUCCESS)
         throw_vk_error(res, "%p could not begin command buffer", ctx);
 
+    mg::record_acquire_barriers(&ctx->transfer, buf);
+    // before defragmenting, which may move the destinations
+    mg::record_frame_uploads(ctx, frame, buf);
+    mg::defragment(&ctx->memory_manager, buf);
+    mg::release_empty_memory(&ctx->memory_manager.allocator);
+    mg::update_memory_budget(&ctx->memory_manager.allocator);
+
     VkRenderPassBeginInfo renderPassInfo{};
     renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
     renderPassInfo.renderPass = ctx->render_pass;
@@ -270,6 +313,13 @@ bool mg::start_rendering(mg::context *ctx)
     return true;
 }
 
+mg::frame_allocation mg::allocate_frame_memory(mg::context *ctx, VkDeviceSize size)
+{
+    assert(ctx != nullptr);
+
+    return mg::allocate_frame_memory(&ctx->frames[ctx->current_frame].frame_allocator, size);
+}
+
 void mg::end_rendering(mg::context *ctx)
 {
     mg::frame_data *frame = ctx->frames + ctx->current_frame;
@@ -277,8 +327,11 @@ void mg::end_rendering(mg::context *ctx)
     VkCommandBuffer buf = frame->command_buffers[image_index];
 
     vkCmdEndRenderPass(buf);
+    mg::record_downloads(&ctx->downloads, buf, ctx->current_frame);
     vkEndCommandBuffer(buf);
 
+    mg::flush_queued_ranges(&ctx->memory_manager);
+
     vkResetFences(ctx->device, 1, &frame->render_fence);
     ::submit_frame_commands(ctx, frame, image_index);
 }
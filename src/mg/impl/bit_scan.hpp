@@ -0,0 +1,33 @@
+#pragma once
+
+#include "shl/number_types.hpp"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+
+inline u32 bit_scan_reverse(u64 x)
+{
+    unsigned long ret;
+    _BitScanReverse64(&ret, x);
+    return (u32)ret;
+}
+
+inline u32 bit_scan_forward(u64 x)
+{
+    unsigned long ret;
+    _BitScanForward64(&ret, x);
+    return (u32)ret;
+}
+#else
+// index of the highest set bit, x must not be 0
+inline u32 bit_scan_reverse(u64 x)
+{
+    return 63 - (u32)__builtin_clzll(x);
+}
+
+// index of the lowest set bit, x must not be 0
+inline u32 bit_scan_forward(u64 x)
+{
+    return (u32)__builtin_ctzll(x);
+}
+#endif
@@ -0,0 +1,247 @@
+
+#include <assert.h>
+
+#include "shl/compare.hpp"
+#include "shl/debug.hpp"
+#include "shl/number_types.hpp"
+
+#include "mg/impl/buddy_allocator.hpp"
+
+u32 log2_floor(VkDeviceSize x)
+{
+    u32 ret = 0;
+
+    while (x >>= 1)
+        ++ret;
+
+    return ret;
+}
+
+VkDeviceSize next_power_of_two(VkDeviceSize x)
+{
+    VkDeviceSize ret = 1;
+
+    while (ret < x)
+        ret <<= 1;
+
+    return ret;
+}
+
+// the value a node has when its whole range is free
+inline u8 buddy_full_value(const mg::buddy_allocator *alloc, u32 depth)
+{
+    return (u8)(alloc->levels - depth);
+}
+
+inline u32 buddy_node_index(const mg::buddy_allocator *alloc, VkDeviceSize offset, VkDeviceSize block_size, u32 *out_depth)
+{
+    u32 depth = ::log2_floor(alloc->tree_size / block_size);
+    *out_depth = depth;
+
+    return (u32)((1ull << depth) - 1 + offset / block_size);
+}
+
+void buddy_update_parents(mg::buddy_allocator *alloc, u32 node, u32 depth)
+{
+    while (node > 0)
+    {
+        node = (node - 1) / 2;
+        depth--;
+
+        u8 left = alloc->longest[2 * node + 1];
+        u8 right = alloc->longest[2 * node + 2];
+        u8 child_full = ::buddy_full_value(alloc, depth + 1);
+
+        if (left == child_full && right == child_full)
+            alloc->longest[node] = ::buddy_full_value(alloc, depth);
+        else
+            alloc->longest[node] = Max(left, right);
+    }
+}
+
+void buddy_mark_allocated(mg::buddy_allocator *alloc, VkDeviceSize offset, VkDeviceSize block_size)
+{
+    u32 depth;
+    u32 node = ::buddy_node_index(alloc, offset, block_size, &depth);
+
+    alloc->longest[node] = 0;
+    ::buddy_update_parents(alloc, node, depth);
+}
+
+void mg::init(mg::buddy_allocator *alloc, VkDeviceSize size, VkDeviceSize min_block_size)
+{
+    assert(alloc != nullptr);
+    assert(min_block_size > 0);
+
+    min_block_size = ::next_power_of_two(min_block_size);
+
+    if (size < min_block_size)
+        min_block_size = size > 0 ? (1ull << ::log2_floor(size)) : 1;
+
+    alloc->min_block_size = min_block_size;
+    alloc->size = size - (size % min_block_size);
+    alloc->tree_size = ::next_power_of_two(Max(alloc->size, min_block_size));
+    alloc->levels = ::log2_floor(alloc->tree_size / min_block_size) + 1;
+
+    ::init(&alloc->longest, (1ull << alloc->levels) - 1);
+
+    mg::free_all_blocks(alloc);
+}
+
+void mg::free(mg::buddy_allocator *alloc)
+{
+    assert(alloc != nullptr);
+
+    ::free(&alloc->longest);
+}
+
+bool mg::allocate_block(mg::buddy_allocator *alloc, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize *out_offset)
+{
+    assert(alloc != nullptr);
+    assert(out_offset != nullptr);
+    assert(size > 0);
+
+    if (!mg::has_space_for(alloc, size, alignment))
+        return false;
+
+    VkDeviceSize block_size = mg::block_size_for(alloc, size, alignment);
+    u8 value = (u8)(::log2_floor(block_size / alloc->min_block_size) + 1);
+    u32 target_depth = alloc->levels - value;
+
+    u32 node = 0;
+    u32 depth = 0;
+
+    // best fit: descend into the child with the smaller sufficient block
+    while (depth < target_depth)
+    {
+        u32 left = 2 * node + 1;
+        u32 right = left + 1;
+        u8 lval = alloc->longest[left];
+        u8 rval = alloc->longest[right];
+
+        if (lval >= value && (rval < value || lval <= rval))
+            node = left;
+        else
+            node = right;
+
+        depth++;
+    }
+
+    alloc->longest[node] = 0;
+    ::buddy_update_parents(alloc, node, depth);
+
+    alloc->total_free_space -= block_size;
+    *out_offset = (node + 1 - (1ull << depth)) * block_size;
+
+    return true;
+}
+
+void mg::free_block(mg::buddy_allocator *alloc, VkDeviceSize offset, VkDeviceSize size)
+{
+    assert(alloc != nullptr);
+    assert(offset < alloc->size);
+
+    // the block that was allocated is at least as large as the smallest
+    // block that fits size. its descendants all still hold their full
+    // values, so the first node above offset with value 0 is the block.
+    u32 depth;
+    u32 node = ::buddy_node_index(alloc, offset, mg::block_size_for(alloc, size, 1), &depth);
+
+    while (alloc->longest[node] != 0)
+    {
+        assert(node > 0);
+        node = (node - 1) / 2;
+        depth--;
+    }
+
+    u8 full = ::buddy_full_value(alloc, depth);
+    alloc->longest[node] = full;
+    alloc->total_free_space += alloc->min_block_size << (full - 1);
+
+    ::buddy_update_parents(alloc, node, depth);
+}
+
+void mg::free_all_blocks(mg::buddy_allocator *alloc)
+{
+    assert(alloc != nullptr);
+
+    for (u32 depth = 0; depth < alloc->levels; ++depth)
+    {
+        u64 first = (1ull << depth) - 1;
+        u64 last = (2ull << depth) - 1;
+        u8 full = ::buddy_full_value(alloc, depth);
+
+        for (u64 node = first; node < last; ++node)
+            alloc->longest[node] = full;
+    }
+
+    alloc->total_free_space = alloc->size;
+
+    // the part of the tree beyond the usable size is never free
+    VkDeviceSize offset = alloc->size;
+
+    while (offset < alloc->tree_size)
+    {
+        VkDeviceSize block_size = offset & (~offset + 1);
+
+        if (block_size == 0)
+            block_size = alloc->tree_size;
+
+        while (offset + block_size > alloc->tree_size)
+            block_size >>= 1;
+
+        ::buddy_mark_allocated(alloc, offset, block_size);
+        offset += block_size;
+    }
+}
+
+VkDeviceSize mg::block_size_for(const mg::buddy_allocator *alloc, VkDeviceSize size, VkDeviceSize alignment)
+{
+    assert(alloc != nullptr);
+
+    VkDeviceSize ret = Max(size, alloc->min_block_size);
+    ret = Max(ret, alignment);
+
+    return ::next_power_of_two(ret);
+}
+
+bool mg::has_space_for(mg::buddy_allocator *alloc, VkDeviceSize size, VkDeviceSize alignment)
+{
+    assert(alloc != nullptr);
+
+    VkDeviceSize block_size = mg::block_size_for(alloc, size, alignment);
+
+    if (block_size > alloc->tree_size)
+        return false;
+
+    u8 value = (u8)(::log2_floor(block_size / alloc->min_block_size) + 1);
+
+    return alloc->longest[0] >= value;
+}
+
+mg::buddy_range mg::largest_free_range(mg::buddy_allocator *alloc)
+{
+    assert(alloc != nullptr);
+
+    u8 value = alloc->longest[0];
+
+    if (value == 0)
+        return mg::buddy_range{0, 0};
+
+    u32 node = 0;
+    u32 depth = 0;
+
+    while (::buddy_full_value(alloc, depth) != value)
+    {
+        node = 2 * node + 1;
+
+        if (alloc->longest[node] != value)
+            node++;
+
+        depth++;
+    }
+
+    VkDeviceSize block_size = alloc->tree_size >> depth;
+
+    return mg::buddy_range{(node + 1 - (1ull << depth)) * block_size, block_size};
+}
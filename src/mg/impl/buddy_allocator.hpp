@@ -0,0 +1,52 @@
+#pragma once
+
+#include <vulkan/vulkan_core.h>
+
+#include "shl/array.hpp"
+#include "shl/number_types.hpp"
+
+#include "mg/number_range.hpp"
+
+// binary buddy allocator.
+// only keeps track of ranges inside [0, size), does not allocate any GPU
+// memory by itself. blocks are powers of two, at least min_block_size large
+// and aligned to their size. the allocator is a complete binary tree in which
+// every node stores the order of the largest free block in its subtree,
+// so allocating and freeing are O(log n), free buddies are merged
+// automatically and the largest free block is always known exactly.
+namespace mg
+{
+constexpr const VkDeviceSize BUDDY_DEFAULT_MIN_BLOCK_SIZE = 256;
+
+typedef number_range<VkDeviceSize> buddy_range;
+
+struct buddy_allocator
+{
+    VkDeviceSize size;      // usable size, the tree may be larger
+    VkDeviceSize tree_size; // power of two
+    VkDeviceSize min_block_size;
+    VkDeviceSize total_free_space;
+    u32 levels;
+
+    // order + 1 of the largest free block in the subtree of each node,
+    // order 0 being a block of min_block_size. 0 means no free block.
+    array<u8> longest;
+};
+
+void init(mg::buddy_allocator *alloc, VkDeviceSize size, VkDeviceSize min_block_size = BUDDY_DEFAULT_MIN_BLOCK_SIZE);
+void free(mg::buddy_allocator *alloc);
+
+// writes the offset of the allocated block to out_offset and returns true,
+// or returns false if there is no free block large enough.
+bool allocate_block(mg::buddy_allocator *alloc, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize *out_offset);
+
+// size is the size that was requested when allocating the block at offset.
+void free_block(mg::buddy_allocator *alloc, VkDeviceSize offset, VkDeviceSize size);
+void free_all_blocks(mg::buddy_allocator *alloc);
+
+// size of the block that allocate_block would use for size and alignment
+VkDeviceSize block_size_for(const mg::buddy_allocator *alloc, VkDeviceSize size, VkDeviceSize alignment);
+
+bool has_space_for(mg::buddy_allocator *alloc, VkDeviceSize size, VkDeviceSize alignment);
+mg::buddy_range largest_free_range(mg::buddy_allocator *alloc);
+}
@@ -1,6 +1,8 @@
 
+#include <stdlib.h>
 #include <string.h>
 
+#include "shl/compare.hpp"
 #include "shl/debug.hpp"
 #include "shl/defer.hpp"
 #include "shl/string.hpp"
@@ -58,6 +60,16 @@ void mg::init(mg::vk_config *conf)
 
     conf->scissor.offset = {0, 0};
     conf->scissor.extent = {640, 480};
+
+    conf->frame_allocator_size = mg::DEFAULT_FRAME_ALLOCATOR_SIZE;
+    conf->staging_ring_size = mg::DEFAULT_STAGING_RING_SIZE;
+    conf->file_upload_chunk_size = mg::DEFAULT_FILE_UPLOAD_CHUNK_SIZE;
+    conf->copy_thread_count = UINT32_MAX;
+    conf->min_parallel_copy_size = mg::DEFAULT_MIN_PARALLEL_COPY_SIZE;
+    conf->upload_cache = false;
+
+    conf->attachments.depth_format = VK_FORMAT_UNDEFINED;
+    conf->attachments.samples = VK_SAMPLE_COUNT_1_BIT;
 }
 
 void mg::free(mg::vk_config *conf)
@@ -73,6 +85,7 @@ void mg::init(mg::context *ctx)
     assert(ctx != nullptr);
 
     ctx->changed.extent = false;
+    ctx->extensions.memory_budget = false;
 
     mg::init(&ctx->config);
 
@@ -82,6 +95,13 @@ void mg::init(mg::context *ctx)
     ::init(&ctx->swap_buffers);
     ::init(&ctx->image_swap_buffers);
 
+    ctx->staging_ring.buffer = nullptr;
+    ctx->transfer.command_pool = nullptr;
+    mg::init(&ctx->downloads);
+    ::init(&ctx->file_uploads);
+    mg::init(&ctx->copy_pool, 0);
+    mg::init(&ctx->upload_cache);
+
     ctx->physical_device = nullptr;
     
     ctx->graphics_queue_index = UINT32_MAX;
@@ -90,6 +110,9 @@ void mg::init(mg::context *ctx)
     ctx->present_queue_index = UINT32_MAX;
     ctx->present_queue_max_count = 0;
     ctx->present_queue = nullptr;
+    ctx->transfer_queue_index = UINT32_MAX;
+    ctx->transfer_queue_max_count = 0;
+    ctx->transfer_queue = nullptr;
     
     ctx->device = nullptr;
     ctx->target_surface = nullptr;
@@ -100,6 +123,12 @@ void mg::init(mg::context *ctx)
     ::init(&ctx->swapchain_image_fences);
     ::init(&ctx->swapchains_to_delete);
 
+    ctx->depth_buffer = nullptr;
+    ctx->depth_buffer_view = nullptr;
+    ctx->msaa_buffer = nullptr;
+    ctx->msaa_buffer_view = nullptr;
+    ctx->samples = VK_SAMPLE_COUNT_1_BIT;
+
     ctx->render_pass = nullptr;
 
     ::init(&ctx->framebuffers);
@@ -114,6 +143,7 @@ void mg::init(mg::context *ctx)
         mg::frame_data *frame = ctx->frames +i;
 
         ::init(&frame->command_buffers);
+        frame->frame_allocator.buffer = nullptr;
     }
 }
 
@@ -273,19 +303,132 @@ void mg::submit_immediate_vulkan_command_to_current_frame(mg::context *ctx, void
     vkQueueWaitIdle(ctx->graphics_queue);
 }
 
-void mg::write_buffer(mg::context *ctx, mg::vk_sub_buffer *dest, const void *data, u64 size)
+// memory that is not host cached is write-combined, see copy_pool
+void write_mapped_memory(mg::context *ctx, const mg::vk_memory *mem, void *dst, const void *data, u64 size)
+{
+    bool non_temporal = (mem->type & VK_MEMORY_PROPERTY_HOST_CACHED_BIT) == 0;
+
+    mg::parallel_copy(&ctx->copy_pool, dst, data, size, non_temporal);
+}
+
+void mg::write_buffer(mg::context *ctx, mg::vk_sub_buffer *dest, const void *data, u64 size, VkDeviceSize dest_offset)
 {
     assert(ctx != nullptr);
     assert(dest != nullptr);
     assert(data != nullptr);
     assert(size > 0);
+    assert(dest_offset + size <= dest->range.size);
 
-    VkDeviceSize offset = mg::total_memory_offset(dest);
-    
-    void* pdata;
-    vkMapMemory(ctx->device, dest->buffer->memory->memory, offset, size, 0, &pdata);
-    memcpy(pdata, data, size);
-    vkUnmapMemory(ctx->device, dest->buffer->memory->memory);
+    void *mapped = mg::get_mapped_pointer(dest);
+
+    VkDeviceSize offset = mg::total_memory_offset(dest) + dest_offset;
+    mg::vk_memory *mem = dest->buffer->memory;
+
+    if (mapped != nullptr)
+        ::write_mapped_memory(ctx, mem, (u8*)mapped + dest_offset, data, size);
+    else
+    {
+        // memory was unmapped explicitly
+        void* pdata;
+        vkMapMemory(ctx->device, mem->memory, offset, size, 0, &pdata);
+        memcpy(pdata, data, size);
+        vkUnmapMemory(ctx->device, mem->memory);
+    }
+
+    mg::queue_flush(&ctx->memory_manager, mem, offset, size);
+}
+
+// copies data to staging memory, see queue_buffer_upload
+mg::staging_source stage_upload_data(mg::context *ctx, const void *data, u64 size)
+{
+    mg::staging_source ret;
+    mg::frame_allocation alloc;
+    mg::staging_ring *ring = &ctx->staging_ring;
+    mg::transfer_queue *q = &ctx->transfer;
+
+    bool staged = mg::allocate_staging_memory(ring, size, &alloc);
+
+    if (!staged && size <= ring->buffer->size)
+    {
+        mg::update_uploads(ctx);
+        staged = mg::allocate_staging_memory(ring, size, &alloc);
+
+        if (!staged && ring->submitted != ring->tail)
+        {
+            trace("staging ring full, waiting for submitted uploads\n");
+            mg::wait(q, ctx->device, &ctx->memory_manager, q->value);
+            mg::retire(ring, q->completed);
+
+            staged = mg::allocate_staging_memory(ring, size, &alloc);
+        }
+    }
+
+    if (staged)
+    {
+        ::write_mapped_memory(ctx, alloc.buffer->memory, alloc.data, data, size);
+
+        ret.buffer = alloc.buffer;
+        ret.offset = alloc.offset;
+        ret.spilled = nullptr;
+        return ret;
+    }
+
+    trace("spilling %u bytes of upload data out of the staging ring\n", size);
+
+    mg::vk_sub_buffer *sbuf = mg::get_new_staging_sub_buffer(&ctx->memory_manager, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
+    mg::write_buffer(ctx, sbuf, data, size);
+
+    ret.buffer = sbuf->buffer;
+    ret.offset = sbuf->range.offset;
+    ret.spilled = sbuf;
+    return ret;
+}
+
+// whether dest is host visible and can be written on the host right away.
+// frames submitted after dest was last written and the last upload queued
+// to dest may still access it, if they aren't done the data goes through
+// the staging ring so that the GPU orders the copy after them.
+// throws if dest can't be copied to either.
+bool can_write_directly(mg::context *ctx, const mg::vk_sub_buffer *dest)
+{
+    const mg::vk_memory *mem = dest->buffer->memory;
+
+    if (mem == nullptr
+     || (mem->type & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) != VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+        return false;
+
+    mg::transfer_queue *q = &ctx->transfer;
+
+    bool frames_done = dest->graphics_value >= q->graphics_value
+                    || mg::update_graphics_completed(q, ctx->device) == q->graphics_value;
+
+    bool uploads_done = dest->transfer_value <= q->completed
+                     || dest->transfer_value <= mg::update_completed(q, ctx->device, &ctx->memory_manager);
+
+    if (frames_done && uploads_done)
+        return true;
+
+    if ((dest->buffer->usage & VK_BUFFER_USAGE_TRANSFER_DST_BIT) == VK_BUFFER_USAGE_TRANSFER_DST_BIT)
+        return false;
+
+    throw_error("%p can't write to %p, the GPU may still use it and it is not a transfer destination", ctx, dest);
+}
+
+// see can_write_directly
+void write_directly(mg::context *ctx, mg::vk_sub_buffer *dest, const void *data, u64 size, VkDeviceSize offset)
+{
+    mg::write_buffer(ctx, dest, data, size, offset);
+
+    // frames submitted before are done with the old data or never read it
+    dest->graphics_value = ctx->transfer.graphics_value;
+}
+
+// dest is written by an upload of the next submission on the transfer
+// timeline, frames submitted before may still read the old data.
+void mark_queued_write(mg::context *ctx, mg::vk_sub_buffer *dest)
+{
+    dest->graphics_value = Min(dest->graphics_value, ctx->transfer.graphics_value);
+    dest->transfer_value = ctx->transfer.value + 1;
 }
 
 void mg::queue_buffer_upload(mg::context *ctx, mg::vk_sub_buffer *dest, const void *data, u64 size)
@@ -295,14 +438,31 @@ void mg::queue_buffer_upload(mg::context *ctx, mg::vk_sub_buffer *dest, const vo
     assert(data != nullptr);
     assert(size > 0);
 
-    mg::vk_sub_buffer *sbuf = mg::get_new_host_coherent_sub_buffer(&ctx->memory_manager, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
+    if (ctx->config.upload_cache)
+    {
+        mg::upload_cache_region region{};
+        region.layer_count = 1;
 
-    mg::write_buffer(ctx, sbuf, data, size);
+        if (mg::check_upload(&ctx->upload_cache, dest, &region, data, size))
+            return;
+    }
+
+    // no staging copy needed
+    if (::can_write_directly(ctx, dest))
+    {
+        ::write_directly(ctx, dest, data, size, 0);
+        return;
+    }
+
+    mg::staging_source source = ::stage_upload_data(ctx, data, size);
+    ::mark_queued_write(ctx, dest);
 
     mg::swap_buffer_data *bdata = ::add_at_end(&ctx->swap_buffers);
-    bdata->source = sbuf;
+    bdata->source = source;
     bdata->destination = dest;
+    bdata->destination_offset = 0;
     bdata->size = size;
+    bdata->file_chunk = false;
 }
 
 void mg::queue_image_upload(mg::context *ctx, mg::vk_image *dest, const void *data, u64 data_size, u32 width, u32 height, VkOffset3D offset, VkImageAspectFlags aspects, u32 mipmap_level, u32 layer_start, u32 layer_count)
@@ -314,12 +474,23 @@ void mg::queue_image_upload(mg::context *ctx, mg::vk_image *dest, const void *da
     assert(width > 0);
     assert(height > 0);
 
-    mg::vk_sub_buffer *sbuf = mg::get_new_host_coherent_sub_buffer(&ctx->memory_manager, data_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
-
-    mg::write_buffer(ctx, sbuf, data, data_size);
+    if (ctx->config.upload_cache)
+    {
+        mg::upload_cache_region region;
+        region.offset = offset;
+        region.width = width;
+        region.height = height;
+        region.aspects = aspects;
+        region.mipmap_level = mipmap_level;
+        region.layer_start = layer_start;
+        region.layer_count = layer_count;
+
+        if (mg::check_upload(&ctx->upload_cache, dest, &region, data, data_size))
+            return;
+    }
 
     mg::image_swap_buffer_data *idata = ::add_at_end(&ctx->image_swap_buffers);
-    idata->source = sbuf;
+    idata->source = ::stage_upload_data(ctx, data, data_size);
     idata->destination = dest;
 
     idata->source_width = width;
@@ -331,44 +502,586 @@ void mg::queue_image_upload(mg::context *ctx, mg::vk_image *dest, const void *da
     idata->layer_count = layer_count;
 }
 
-void _upload_queued_buffers_cmd(VkCommandBuffer commandBuffer, void *userdata)
+// the queued uploads were recorded into the submission that signals value
+void finish_queued_uploads(mg::context *ctx, u64 value)
+{
+    mg::transfer_queue *q = &ctx->transfer;
+
+    // destroyed once the uploads are done
+    for_array(sb, &ctx->swap_buffers)
+        if (sb->source.spilled != nullptr)
+        {
+            mg::add_spill(q, value, sb->source.spilled);
+            sb->source.spilled = nullptr;
+        }
+
+    for_array(isb, &ctx->image_swap_buffers)
+        if (isb->source.spilled != nullptr)
+        {
+            mg::add_spill(q, value, isb->source.spilled);
+            isb->source.spilled = nullptr;
+        }
+
+    for_array(pfu, &ctx->file_uploads)
+        if ((*pfu)->pending)
+        {
+            (*pfu)->value = value;
+            (*pfu)->pending = false;
+        }
+
+    mg::mark_submitted(&ctx->staging_ring, value);
+    mg::clear_queued_buffers(ctx);
+}
+
+struct queued_buffer_copy
+{
+    VkBuffer source;
+    mg::vk_buffer *destination;
+    VkBufferCopy region;
+    u32 index; // queue order
+    bool recorded;
+};
+
+struct queued_image_copy
+{
+    VkBuffer source;
+    mg::vk_image *destination;
+    VkBufferImageCopy region;
+    u32 index;
+};
+
+// by destination, then destination offset, then queue order
+int compare_buffer_copies(const void *pa, const void *pb)
+{
+    const queued_buffer_copy *a = (const queued_buffer_copy*)pa;
+    const queued_buffer_copy *b = (const queued_buffer_copy*)pb;
+
+    if (a->destination != b->destination)
+        return (uintptr_t)a->destination < (uintptr_t)b->destination ? -1 : 1;
+
+    if (a->region.dstOffset != b->region.dstOffset)
+        return a->region.dstOffset < b->region.dstOffset ? -1 : 1;
+
+    return (a->index > b->index) - (a->index < b->index);
+}
+
+int compare_buffer_copy_order(const void *pa, const void *pb)
+{
+    const queued_buffer_copy *a = (const queued_buffer_copy*)pa;
+    const queued_buffer_copy *b = (const queued_buffer_copy*)pb;
+
+    return (a->index > b->index) - (a->index < b->index);
+}
+
+// by destination, then queue order
+int compare_image_copies(const void *pa, const void *pb)
+{
+    const queued_image_copy *a = (const queued_image_copy*)pa;
+    const queued_image_copy *b = (const queued_image_copy*)pb;
+
+    if (a->destination != b->destination)
+        return (uintptr_t)a->destination < (uintptr_t)b->destination ? -1 : 1;
+
+    return (a->index > b->index) - (a->index < b->index);
+}
+
+void record_buffer_copies(mg::context *ctx, VkCommandBuffer cmd, VkBuffer source, mg::vk_buffer *dest, array<VkBufferCopy> *regions)
+{
+    trace("copying %u regions from %p to buffer %p\n", regions->size, source, dest);
+
+    vkCmdCopyBuffer(cmd, source, dest->buffer, (u32)regions->size, regions->data);
+}
+
+void record_image_copies(mg::context *ctx, VkCommandBuffer cmd, VkBuffer source, mg::vk_image *dest, array<VkBufferImageCopy> *regions)
+{
+    trace("copying %u regions from %p to image %p\n", regions->size, source, dest);
+
+    vkCmdCopyBufferToImage(cmd, source, dest->image, dest->layout, (u32)regions->size, regions->data);
+}
+
+// copies that write what an earlier command wrote have to wait for it,
+// commands are not ordered by themselves.
+void record_write_after_write_barrier(VkCommandBuffer cmd)
+{
+    VkMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+    vkCmdPipelineBarrier(cmd,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         0,
+                         1, &barrier,
+                         0, nullptr,
+                         0, nullptr);
+}
+
+inline bool buffer_copy_covers(const VkBufferCopy *a, const VkBufferCopy *b)
+{
+    return a->dstOffset <= b->dstOffset
+        && a->dstOffset + a->size >= b->dstOffset + b->size;
+}
+
+// the regions of a single copy command must not overlap
+bool image_regions_overlap(const VkBufferImageCopy *a, const VkBufferImageCopy *b)
+{
+    const VkImageSubresourceLayers *sa = &a->imageSubresource;
+    const VkImageSubresourceLayers *sb = &b->imageSubresource;
+
+    return (sa->aspectMask & sb->aspectMask) != 0
+        && sa->mipLevel == sb->mipLevel
+        && sa->baseArrayLayer < sb->baseArrayLayer + sb->layerCount
+        && sb->baseArrayLayer < sa->baseArrayLayer + sa->layerCount;
+}
+
+// records the buffer copies to one destination, copies must be sorted
+// by destination offset.
+void record_destination_copies(mg::context *ctx, VkCommandBuffer cmd, queued_buffer_copy *copies, u64 count, array<VkBufferCopy> *regions)
+{
+    mg::vk_buffer *dest = copies[0].destination;
+    bool overlap = false;
+    VkDeviceSize max_end = 0;
+
+    for (u64 i = 0; i < count; ++i)
+    {
+        if (i > 0 && copies[i].region.dstOffset < max_end)
+            overlap = true;
+
+        max_end = Max(max_end, copies[i].region.dstOffset + copies[i].region.size);
+    }
+
+    if (overlap)
+    {
+        // later uploads have to win, keep the queue order
+        qsort(copies, count, sizeof(queued_buffer_copy), ::compare_buffer_copy_order);
+
+        bool recorded = false;
+
+        for (u64 i = 0; i < count; ++i)
+        {
+            // completely overwritten by a later upload
+            bool superseded = false;
+
+            for (u64 j = i + 1; j < count; ++j)
+                if (::buffer_copy_covers(&copies[j].region, &copies[i].region))
+                {
+                    superseded = true;
+                    break;
+                }
+
+            if (superseded)
+                continue;
+
+            if (recorded)
+                ::record_write_after_write_barrier(cmd);
+
+            ::clear(regions);
+            ::add_at_end(regions, copies[i].region);
+            ::record_buffer_copies(ctx, cmd, copies[i].source, dest, regions);
+            recorded = true;
+        }
+
+        return;
+    }
+
+    // one command per source, adjacent ranges are merged
+    for (u64 first = 0; first < count; ++first)
+    {
+        if (copies[first].recorded)
+            continue;
+
+        VkBuffer source = copies[first].source;
+        ::clear(regions);
+
+        for (u64 i = first; i < count; ++i)
+        {
+            queued_buffer_copy *c = copies + i;
+
+            if (c->recorded || c->source != source)
+                continue;
+
+            c->recorded = true;
+
+            VkBufferCopy *last = regions->size > 0 ? regions->data + regions->size - 1 : nullptr;
+
+            if (last != nullptr
+             && last->srcOffset + last->size == c->region.srcOffset
+             && last->dstOffset + last->size == c->region.dstOffset)
+                last->size += c->region.size;
+            else
+                ::add_at_end(regions, c->region);
+        }
+
+        ::record_buffer_copies(ctx, cmd, source, dest, regions);
+    }
+}
+
+// records one copy command to dest, after a barrier if it overlaps
+// regions of dest that were recorded before
+void record_image_command(mg::context *ctx, VkCommandBuffer cmd, VkBuffer source, mg::vk_image *dest, array<VkBufferImageCopy> *regions, array<VkBufferImageCopy> *recorded)
+{
+    bool overlap = false;
+
+    for_array(region, regions)
+    {
+        for_array(other, recorded)
+            if (::image_regions_overlap(region, other))
+            {
+                overlap = true;
+                break;
+            }
+
+        if (overlap)
+            break;
+    }
+
+    if (overlap)
+        ::record_write_after_write_barrier(cmd);
+
+    ::record_image_copies(ctx, cmd, source, dest, regions);
+
+    for_array(region, regions)
+        ::add_at_end(recorded, *region);
+}
+
+// the graphics queue may own the destinations already, ownership is taken
+// once per destination before any copy and given back after all of them.
+// destinations no queue used yet are taken without a transfer.
+// returns whether frames submitted before may use any of the destinations.
+bool transfer_destination_ownership(mg::context *ctx, VkCommandBuffer cmd, const array<queued_buffer_copy> *copies, const array<queued_image_copy> *image_copies)
+{
+    mg::transfer_queue *q = &ctx->transfer;
+    bool used = false;
+
+    // sorted by destination
+    for (u64 first = 0; first < copies->size;)
+    {
+        mg::vk_buffer *dest = copies->data[first].destination;
+        VkDeviceSize start = copies->data[first].region.dstOffset;
+        VkDeviceSize end = start;
+        u64 last = first;
+
+        for (; last < copies->size && copies->data[last].destination == dest; ++last)
+        {
+            const VkBufferCopy *region = &copies->data[last].region;
+            start = Min(start, region->dstOffset);
+            end = Max(end, region->dstOffset + region->size);
+        }
+
+        used = used || dest->queue_family != VK_QUEUE_FAMILY_IGNORED;
+
+        if (mg::transfers_ownership(q, dest->sharemode))
+        {
+            mg::acquire_buffer(q, dest, start, end - start);
+            mg::release_buffer(q, dest, start, end - start);
+        }
+        else
+            dest->queue_family = q->graphics_family_index;
+
+        first = last;
+    }
+
+    for_array(i, c, image_copies)
+    {
+        mg::vk_image *dest = c->destination;
+
+        if (i > 0 && image_copies->data[i - 1].destination == dest)
+            continue;
+
+        used = used || dest->queue_family != VK_QUEUE_FAMILY_IGNORED;
+
+        if (!mg::transfers_ownership(q, dest->sharemode))
+        {
+            dest->queue_family = q->graphics_family_index;
+            continue;
+        }
+
+        VkImageSubresourceRange range;
+        range.aspectMask = mg::get_image_aspect(dest->format);
+        range.baseMipLevel = 0;
+        range.levelCount = dest->mipmap_levels;
+        range.baseArrayLayer = 0;
+        range.layerCount = dest->array_layers;
+
+        mg::acquire_image(q, dest, range);
+        mg::release_image(q, dest, range);
+    }
+
+    mg::record_transfer_acquires(q, cmd);
+
+    return used;
+}
+
+// groups the queued copies by source and destination, so there is one copy
+// command with many regions per group instead of one command per upload.
+// returns whether frames submitted before may use any of the destinations.
+bool record_queued_uploads(mg::context *ctx, VkCommandBuffer commandBuffer)
+{
+    array<queued_buffer_copy> copies;
+    ::init(&copies, ctx->swap_buffers.size);
+    defer { ::free(&copies); };
+
+    array<VkBufferCopy> regions;
+    ::init(&regions);
+    defer { ::free(&regions); };
+
+    for_array(i, sbuf, &ctx->swap_buffers)
+    {
+        queued_buffer_copy *c = copies.data + i;
+        c->source = sbuf->source.buffer->buffer;
+        c->destination = sbuf->destination->buffer;
+        c->region.srcOffset = sbuf->source.offset;
+        c->region.dstOffset = sbuf->destination->range.offset + sbuf->destination_offset;
+        c->region.size = sbuf->size;
+        c->index = (u32)i;
+        c->recorded = false;
+    }
+
+    if (copies.size > 0)
+        qsort(copies.data, copies.size, sizeof(queued_buffer_copy), ::compare_buffer_copies);
+
+    array<queued_image_copy> image_copies;
+    ::init(&image_copies, ctx->image_swap_buffers.size);
+    defer { ::free(&image_copies); };
+
+    array<VkBufferImageCopy> image_regions;
+    ::init(&image_regions);
+    defer { ::free(&image_regions); };
+
+    for_array(i, isbuf, &ctx->image_swap_buffers)
+    {
+        queued_image_copy *c = image_copies.data + i;
+        c->source = isbuf->source.buffer->buffer;
+        c->destination = isbuf->destination;
+        c->index = (u32)i;
+
+        VkBufferImageCopy *copyRegion = &c->region;
+        *copyRegion = VkBufferImageCopy{};
+        copyRegion->bufferOffset = isbuf->source.offset;
+        copyRegion->bufferRowLength = isbuf->source_width;
+        copyRegion->bufferImageHeight = isbuf->source_height;
+        copyRegion->imageSubresource.aspectMask = isbuf->aspect;
+        copyRegion->imageSubresource.mipLevel = isbuf->mipmap_level;
+        copyRegion->imageSubresource.baseArrayLayer = isbuf->layer_start;
+        copyRegion->imageSubresource.layerCount = isbuf->layer_count;
+        copyRegion->imageOffset = isbuf->destination_offset;
+        copyRegion->imageExtent = isbuf->destination->extent;
+    }
+
+    if (image_copies.size > 0)
+        qsort(image_copies.data, image_copies.size, sizeof(queued_image_copy), ::compare_image_copies);
+
+    bool used = ::transfer_destination_ownership(ctx, commandBuffer, &copies, &image_copies);
+
+    for (u64 first = 0; first < copies.size;)
+    {
+        u64 last = first + 1;
+
+        while (last < copies.size && copies[last].destination == copies[first].destination)
+            ++last;
+
+        ::record_destination_copies(ctx, commandBuffer, copies.data + first, last - first, &regions);
+        first = last;
+    }
+
+    // regions already recorded for the current destination
+    array<VkBufferImageCopy> recorded_regions;
+    ::init(&recorded_regions);
+    defer { ::free(&recorded_regions); };
+
+    // queue order per image, a new command starts whenever the source changes
+    // or a region overlaps one that is already in the command.
+    // commands that overlap earlier commands to the same image wait for them.
+    for_array(i, c, &image_copies)
+    {
+        bool flush = i > 0
+                  && (c->destination != image_copies[i - 1].destination
+                   || c->source != image_copies[i - 1].source);
+
+        if (!flush)
+            for_array(region, &image_regions)
+                if (::image_regions_overlap(region, &c->region))
+                {
+                    flush = true;
+                    break;
+                }
+
+        if (flush && image_regions.size > 0)
+        {
+            queued_image_copy *prev = c - 1;
+            ::record_image_command(ctx, commandBuffer, prev->source, prev->destination, &image_regions, &recorded_regions);
+            ::clear(&image_regions);
+
+            if (c->destination != prev->destination)
+                ::clear(&recorded_regions);
+        }
+
+        ::add_at_end(&image_regions, c->region);
+    }
+
+    if (image_regions.size > 0)
+    {
+        queued_image_copy *prev = image_copies.data + image_copies.size - 1;
+        ::record_image_command(ctx, commandBuffer, prev->source, prev->destination, &image_regions, &recorded_regions);
+    }
+
+    return used;
+}
+
+mg::file_upload *mg::queue_file_upload(mg::context *ctx, mg::vk_sub_buffer *dest, const char *path, u64 offset, u64 size, mg::file_upload_callback callback, void *userdata)
+{
+    assert(ctx != nullptr);
+    assert(dest != nullptr);
+
+    // chunks are always copied from the staging ring, see stream_file_uploads
+    if ((dest->buffer->usage & VK_BUFFER_USAGE_TRANSFER_DST_BIT) != VK_BUFFER_USAGE_TRANSFER_DST_BIT)
+        throw_error("%p can't upload %s to %p, it is not a transfer destination", ctx, path, dest);
+
+    mg::file_upload *ret = mg::create_file_upload(dest, path, offset, size, callback, userdata);
+    mg::forget_cached_uploads(ctx, dest);
+    ::add_at_end(&ctx->file_uploads, ret);
+
+    return ret;
+}
+
+void mg::forget_cached_uploads(mg::context *ctx, const void *dest)
+{
+    assert(ctx != nullptr);
+
+    mg::forget_uploads(&ctx->upload_cache, dest);
+}
+
+void mg::release_file_upload(mg::context *ctx, mg::file_upload *fu)
+{
+    assert(ctx != nullptr);
+    assert(fu != nullptr);
+    assert(!fu->released);
+
+    // chunks may still be copied, see complete_file_uploads
+    fu->released = true;
+}
+
+// copies a chunk of a file upload into the staging ring, halving the chunk
+// while it doesn't fit. chunks that don't fit at the smallest size are
+// spilled into their own staging sub-buffer, so uploads always make progress.
+// returns the size of the chunk.
+VkDeviceSize stage_file_chunk(mg::context *ctx, mg::file_upload *fu, VkDeviceSize size, bool *out_spilled)
+{
+    const u8 *data = fu->mapping.data + fu->queued;
+
+    mg::swap_buffer_data bdata;
+    bdata.destination = fu->destination;
+    bdata.destination_offset = fu->queued;
+    bdata.file_chunk = true;
+
+    mg::frame_allocation alloc;
+    *out_spilled = false;
+
+    while (!mg::allocate_staging_memory(&ctx->staging_ring, size, &alloc))
+    {
+        if (size <= mg::MIN_FILE_UPLOAD_CHUNK_SIZE)
+        {
+            trace("spilling %u bytes of file upload %p out of the staging ring\n", size, fu);
+
+            mg::vk_sub_buffer *sbuf = mg::get_new_staging_sub_buffer(&ctx->memory_manager, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
+            mg::write_buffer(ctx, sbuf, data, size);
+
+            bdata.source.buffer = sbuf->buffer;
+            bdata.source.offset = sbuf->range.offset;
+            bdata.source.spilled = sbuf;
+            bdata.size = size;
+            ::add_at_end(&ctx->swap_buffers, bdata);
+            ::mark_queued_write(ctx, fu->destination);
+
+            fu->pending = true;
+            *out_spilled = true;
+            return size;
+        }
+
+        size = Max(size / 2, mg::MIN_FILE_UPLOAD_CHUNK_SIZE);
+    }
+
+    ::write_mapped_memory(ctx, alloc.buffer->memory, alloc.data, data, size);
+
+    bdata.source.buffer = alloc.buffer;
+    bdata.source.offset = alloc.offset;
+    bdata.source.spilled = nullptr;
+    bdata.size = size;
+    ::add_at_end(&ctx->swap_buffers, bdata);
+    ::mark_queued_write(ctx, fu->destination);
+
+    fu->pending = true;
+    return size;
+}
+
+void mg::stream_file_uploads(mg::context *ctx)
 {
-    mg::context *ctx = (mg::context *)userdata;
+    assert(ctx != nullptr);
+
+    // a chunk never takes more than the whole ring
+    VkDeviceSize budget = ctx->config.file_upload_chunk_size;
+    VkDeviceSize max_chunk = Min(budget, ctx->staging_ring.buffer->size);
 
-    for_array(sbuf, &ctx->swap_buffers)
+    for_array(pfu, &ctx->file_uploads)
     {
-        VkBufferCopy copyRegion{};
-        copyRegion.srcOffset = sbuf->source->range.offset;
-        copyRegion.dstOffset = sbuf->destination->range.offset;
-        copyRegion.size = sbuf->size;
+        mg::file_upload *fu = *pfu;
+
+        if (fu->released)
+            continue;
 
-        trace("copying %u bytes from %p:%u to buffer %p:%u\n",
-              copyRegion.size, sbuf->source, copyRegion.srcOffset,
-              sbuf->destination, copyRegion.dstOffset);
+        while (budget > 0 && fu->queued < fu->mapping.size)
+        {
+            VkDeviceSize size = Min(Min(budget, max_chunk), fu->mapping.size - fu->queued);
+            bool spilled = false;
+
+            // chunks are staged even for host visible destinations, writing
+            // them directly could wait for the GPU.
+            size = ::stage_file_chunk(ctx, fu, size, &spilled);
+
+            fu->queued += size;
+            budget -= size;
+
+            mg::discard_file_pages(&fu->mapping, fu->queued);
 
-        vkCmdCopyBuffer(commandBuffer, sbuf->source->buffer->buffer, sbuf->destination->buffer->buffer, 1, &copyRegion);
+            // never waits for the GPU, the ring has to retire first
+            if (spilled)
+                return;
+        }
+
+        if (budget == 0)
+            return;
     }
+}
+
+// file uploads whose last chunk is done on the GPU
+void complete_file_uploads(mg::context *ctx)
+{
+    u64 completed = ctx->transfer.completed;
 
-    for_array(isbuf, &ctx->image_swap_buffers)
+    for (u64 i = 0; i < ctx->file_uploads.size;)
     {
-        VkBufferImageCopy copyRegion{};
-        copyRegion.bufferOffset = isbuf->source->range.offset;
-        copyRegion.bufferRowLength = isbuf->source_width;
-        copyRegion.bufferImageHeight = isbuf->source_height;
-        copyRegion.imageSubresource.aspectMask = isbuf->aspect;
-        copyRegion.imageSubresource.mipLevel = isbuf->mipmap_level;
-        copyRegion.imageSubresource.baseArrayLayer = isbuf->layer_start;
-        copyRegion.imageSubresource.layerCount = isbuf->layer_count;
-        copyRegion.imageOffset = isbuf->destination_offset;
-        copyRegion.imageExtent = isbuf->destination->extent;
-
-        trace("copying (%u x %u) from %p:%u to image %p:(%u, %u, %u)\n",
-              copyRegion.bufferRowLength, copyRegion.bufferImageHeight,
-              isbuf->source, copyRegion.bufferOffset,
-              isbuf->destination,
-              copyRegion.imageOffset.x, copyRegion.imageOffset.y, copyRegion.imageOffset.z);
-
-        vkCmdCopyBufferToImage(commandBuffer, isbuf->source->buffer->buffer, isbuf->destination->image, isbuf->destination->layout, 1, &copyRegion);
+        mg::file_upload *fu = ctx->file_uploads[i];
+        bool idle = !fu->pending && fu->value <= completed;
+
+        if (fu->released && idle)
+        {
+            mg::destroy_file_upload(fu);
+            ::remove_elements(&ctx->file_uploads, i, 1);
+            continue;
+        }
+
+        if (!fu->done && idle && fu->queued == fu->mapping.size)
+        {
+            fu->done = true;
+            // nothing is read from the file anymore
+            mg::unmap_file(&fu->mapping);
+
+            if (fu->callback != nullptr)
+                fu->callback(fu, fu->userdata);
+        }
+
+        ++i;
     }
 }
 
@@ -376,12 +1089,136 @@ void mg::upload_queued_buffers(mg::context *ctx)
 {
     assert(ctx != nullptr);
 
-    if (ctx->swap_buffers.size == 0)
+    mg::flush_queued_ranges(&ctx->memory_manager);
+
+    if (ctx->swap_buffers.size == 0
+     && ctx->image_swap_buffers.size == 0)
+        return;
+
+    // saves a submit, see record_frame_uploads
+    if (mg::uploads_in_frame(ctx))
         return;
 
-    mg::submit_immediate_vulkan_command_to_current_frame(ctx, _upload_queued_buffers_cmd, ctx);
+    // chunks of file uploads are only read by frames once the whole file is
+    // done, which update_uploads sees after the batch is done.
+    bool read_by_frames = ctx->image_swap_buffers.size > 0;
 
-    mg::clear_queued_buffers(ctx);
+    for_array(sb, &ctx->swap_buffers)
+        if (!sb->file_chunk)
+        {
+            read_by_frames = true;
+            break;
+        }
+
+    mg::transfer_queue *q = &ctx->transfer;
+    mg::transfer_batch *batch = mg::begin_batch(q, ctx->device, &ctx->memory_manager);
+
+    bool used = ::record_queued_uploads(ctx, batch->command_buffer);
+
+    u64 value = mg::submit_batch(q, ctx->device, batch, used, read_by_frames);
+    ::finish_queued_uploads(ctx, value);
+}
+
+bool mg::uploads_in_frame(const mg::context *ctx)
+{
+    assert(ctx != nullptr);
+
+    return ctx->transfer_queue == ctx->graphics_queue;
+}
+
+void mg::record_frame_uploads(mg::context *ctx, mg::frame_data *frame, VkCommandBuffer cmd)
+{
+    assert(ctx != nullptr);
+    assert(frame != nullptr);
+    assert(cmd != nullptr);
+
+    frame->upload_value = 0;
+
+    if (!mg::uploads_in_frame(ctx))
+        return;
+
+    if (ctx->swap_buffers.size == 0
+     && ctx->image_swap_buffers.size == 0)
+        return;
+
+    mg::flush_queued_ranges(&ctx->memory_manager);
+
+    // previous frames on the same queue may still read the destinations,
+    // submission order alone does not keep the copies from overtaking them.
+    VkMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+    vkCmdPipelineBarrier(cmd,
+                         VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         0,
+                         1, &barrier,
+                         0, nullptr,
+                         0, nullptr);
+
+    ::record_queued_uploads(ctx, cmd);
+
+    // everything after the copies may read the uploaded data
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+
+    vkCmdPipelineBarrier(cmd,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                         0,
+                         1, &barrier,
+                         0, nullptr,
+                         0, nullptr);
+
+    // signalled by the frame submission, nothing else signals the
+    // timeline semaphore if uploads are in the frame.
+    frame->upload_value = ctx->transfer.value + 1;
+    ::finish_queued_uploads(ctx, frame->upload_value);
+}
+
+void mg::update_uploads(mg::context *ctx)
+{
+    assert(ctx != nullptr);
+
+    u64 completed = mg::update_completed(&ctx->transfer, ctx->device, &ctx->memory_manager);
+    mg::retire(&ctx->staging_ring, completed);
+    ::complete_file_uploads(ctx);
+}
+
+mg::download *mg::queue_buffer_download(mg::context *ctx, mg::vk_sub_buffer *src, VkDeviceSize offset, VkDeviceSize size, mg::download_callback callback, void *userdata)
+{
+    assert(ctx != nullptr);
+
+    return mg::add_buffer_download(&ctx->downloads, &ctx->memory_manager, src, offset, size, callback, userdata);
+}
+
+mg::download *mg::queue_image_download(mg::context *ctx, mg::vk_image *src, u64 data_size, u32 width, u32 height, VkOffset3D offset, VkImageAspectFlags aspects, u32 mipmap_level, u32 layer_start, u32 layer_count, mg::download_callback callback, void *userdata)
+{
+    assert(ctx != nullptr);
+    assert(width > 0);
+    assert(height > 0);
+
+    VkBufferImageCopy region{};
+    region.bufferOffset = 0;
+    region.bufferRowLength = 0;
+    region.bufferImageHeight = 0;
+    region.imageSubresource.aspectMask = aspects;
+    region.imageSubresource.mipLevel = mipmap_level;
+    region.imageSubresource.baseArrayLayer = layer_start;
+    region.imageSubresource.layerCount = layer_count;
+    region.imageOffset = offset;
+    region.imageExtent = {width, height, 1};
+
+    return mg::add_image_download(&ctx->downloads, &ctx->memory_manager, src, data_size, &region, callback, userdata);
+}
+
+void mg::release_download(mg::context *ctx, mg::download *dl)
+{
+    assert(ctx != nullptr);
+
+    mg::release_download(&ctx->downloads, &ctx->memory_manager, dl);
 }
 
 void mg::clear_queued_buffers(mg::context *ctx)
@@ -389,9 +1226,15 @@ void mg::clear_queued_buffers(mg::context *ctx)
     assert(ctx != nullptr);
 
     for_array(sb, &ctx->swap_buffers)
-        mg::destroy_sub_buffer(sb->source);
+        if (sb->source.spilled != nullptr)
+            mg::destroy_sub_buffer(&ctx->memory_manager, sb->source.spilled);
+
+    for_array(isb, &ctx->image_swap_buffers)
+        if (isb->source.spilled != nullptr)
+            mg::destroy_sub_buffer(&ctx->memory_manager, isb->source.spilled);
 
     ::clear(&ctx->swap_buffers);
+    ::clear(&ctx->image_swap_buffers);
 }
 
 bool is_surface_format_supported(mg::context *ctx)
@@ -454,6 +1297,39 @@ void mg::setup_instance(mg::context *ctx, const char **ext_names, u32 ext_count)
     ctx->instance = ::create_vk_instance(ext_names, ext_count, layer_names.data, layer_names.size);
 }
 
+// prefers a transfer only queue family, which usually has its own DMA engine.
+// otherwise uploads use the graphics queue family, see create_logical_device.
+void set_transfer_queue_family(mg::context *ctx)
+{
+    ctx->transfer_queue_index = ctx->graphics_queue_index;
+    ctx->transfer_queue_max_count = ctx->graphics_queue_max_count;
+
+    u32 family_queue_count = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(ctx->physical_device, &family_queue_count, nullptr);
+
+    array<VkQueueFamilyProperties> queue_properties;
+    ::init(&queue_properties, family_queue_count);
+    defer { ::free(&queue_properties); };
+
+    vkGetPhysicalDeviceQueueFamilyProperties(ctx->physical_device, &family_queue_count, queue_properties.data);
+
+    for_array(i, prop, &queue_properties)
+    {
+        if (prop->queueCount == 0
+         || (prop->queueFlags & VK_QUEUE_TRANSFER_BIT) == 0
+         || (prop->queueFlags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)) != 0)
+            continue;
+
+        ctx->transfer_queue_index = (u32)i;
+        ctx->transfer_queue_max_count = prop->queueCount;
+
+        trace("transfer queue index = %d, count: %d\n", i, prop->queueCount);
+        return;
+    }
+
+    trace("no transfer only queue family, uploading on the graphics queue family\n");
+}
+
 void mg::set_physical_device(mg::context *ctx)
 {
     trace("setting physical device (GPU)\n");
@@ -519,16 +1395,18 @@ void mg::set_physical_device(mg::context *ctx)
     if (ret == nullptr)
         throw_error("%p could not find a GPU with a graphics queue", ctx);
     
+    vkGetPhysicalDeviceProperties(ret, &ctx->physical_device_properties);
+
 #ifndef NDEBUG
-    VkPhysicalDeviceProperties chosen_props;
-    vkGetPhysicalDeviceProperties(ret, &chosen_props);
-    trace("Chosen GPU: %s\n", chosen_props.deviceName);
+    trace("Chosen GPU: %s\n", ctx->physical_device_properties.deviceName);
     trace("  with %d queues in the graphics queue family\n", max_gqueues);
 #endif // NDEBUG
     
     ctx->graphics_queue_index = gqueue_index;
     ctx->graphics_queue_max_count = max_gqueues;
     ctx->physical_device = ret;
+
+    ::set_transfer_queue_family(ctx);
 }
 
 void mg::set_min_swap_image_count(mg::context *ctx, u32 default_min)
@@ -675,6 +1553,7 @@ void mg::create_logical_device(mg::context *ctx, const array<const_string> *laye
     defer { ::free(&device_property_names); };
 
     int count = 0;
+    u64 required_count = 0;
     
     for_array(ext_property, &device_properties)
     {
@@ -688,6 +1567,16 @@ void mg::create_logical_device(mg::context *ctx, const array<const_string> *laye
                 found = true;
                 break;
             }
+
+        if (found)
+            required_count++;
+
+        // optional extensions
+        if (compare_strings(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME, ext_property->extensionName) == 0)
+        {
+            ctx->extensions.memory_budget = true;
+            found = true;
+        }
         
         if (found)
             ::add_at_end(&device_property_names, (const char*)ext_property->extensionName);
@@ -695,30 +1584,50 @@ void mg::create_logical_device(mg::context *ctx, const array<const_string> *laye
         count++;
     }
 
-    assert(device_property_names.size == ctx->config.device_extension_names.size);
+    assert(required_count == ctx->config.device_extension_names.size);
     
 #ifdef TRACE
     for_array(namep, &device_property_names)
         trace("applying extension %s\n", *namep);
 #endif
 
-    VkDeviceQueueCreateInfo queue_create_infos[2];
+    VkDeviceQueueCreateInfo queue_create_infos[3];
     u32 queue_count = 1;
+    float pqueue_priority = 1.0f;
+    // uploads should not hold up rendering
+    float tqueue_priority = 0.5f;
+
+    array<float> gqueue_priorities;
+    ::init(&gqueue_priorities);
+    defer { ::free(&gqueue_priorities); };
+
+    for_array(prio, &ctx->config.graphics_queue_priorities)
+        ::add_at_end(&gqueue_priorities, *prio);
+
+    // index of the transfer queue inside its family. without a transfer only
+    // family, another queue of the graphics family is used if there is one,
+    // and the graphics queue itself if not.
+    u32 tqueue_slot = 0;
+
+    if (ctx->transfer_queue_index == ctx->graphics_queue_index
+     && ctx->graphics_queue_max_count > ctx->config.graphics_queue_count)
+    {
+        tqueue_slot = ctx->config.graphics_queue_count;
+        ::add_at_end(&gqueue_priorities, tqueue_priority);
+    }
     
     VkDeviceQueueCreateInfo *gqueue_create_info = queue_create_infos;
     gqueue_create_info->sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
     gqueue_create_info->queueFamilyIndex = ctx->graphics_queue_index;
-    gqueue_create_info->queueCount = ctx->config.graphics_queue_count;
-    gqueue_create_info->pQueuePriorities = ctx->config.graphics_queue_priorities.data;
+    gqueue_create_info->queueCount = (u32)gqueue_priorities.size;
+    gqueue_create_info->pQueuePriorities = gqueue_priorities.data;
     gqueue_create_info->pNext = nullptr;
     gqueue_create_info->flags = 0;
     
     if (ctx->present_queue_index != ctx->graphics_queue_index)
     {
+        VkDeviceQueueCreateInfo *pqueue_create_info = queue_create_infos + queue_count;
         queue_count++;
-        float pqueue_priority = 1.0f;
-
-        VkDeviceQueueCreateInfo *pqueue_create_info = queue_create_infos + 1;
         pqueue_create_info->sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
         pqueue_create_info->queueFamilyIndex = ctx->present_queue_index;
         pqueue_create_info->queueCount = 1;
@@ -727,6 +1636,26 @@ void mg::create_logical_device(mg::context *ctx, const array<const_string> *laye
         pqueue_create_info->flags = 0;
     }
 
+    // a transfer family that is also the present family shares the present queue
+    if (ctx->transfer_queue_index != ctx->graphics_queue_index
+     && ctx->transfer_queue_index != ctx->present_queue_index)
+    {
+        VkDeviceQueueCreateInfo *tqueue_create_info = queue_create_infos + queue_count;
+        queue_count++;
+
+        tqueue_create_info->sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+        tqueue_create_info->queueFamilyIndex = ctx->transfer_queue_index;
+        tqueue_create_info->queueCount = 1;
+        tqueue_create_info->pQueuePriorities = &tqueue_priority;
+        tqueue_create_info->pNext = nullptr;
+        tqueue_create_info->flags = 0;
+    }
+
+    // core in 1.2, uploads signal a timeline semaphore
+    VkPhysicalDeviceVulkan12Features features12{};
+    features12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+    features12.timelineSemaphore = VK_TRUE;
+
     // Device creation information
     VkDeviceCreateInfo create_info;
     create_info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
@@ -736,7 +1665,7 @@ void mg::create_logical_device(mg::context *ctx, const array<const_string> *laye
     create_info.enabledLayerCount = static_cast<u32>(layers.size);
     create_info.ppEnabledExtensionNames = device_property_names.data;
     create_info.enabledExtensionCount = static_cast<u32>(device_property_names.size);
-    create_info.pNext = nullptr;
+    create_info.pNext = &features12;
     create_info.pEnabledFeatures = nullptr;
     create_info.flags = 0;
 
@@ -748,6 +1677,7 @@ void mg::create_logical_device(mg::context *ctx, const array<const_string> *laye
     
     vkGetDeviceQueue(ctx->device, ctx->graphics_queue_index, 0, &ctx->graphics_queue);
     vkGetDeviceQueue(ctx->device, ctx->present_queue_index, 0, &ctx->present_queue);
+    vkGetDeviceQueue(ctx->device, ctx->transfer_queue_index, tqueue_slot, &ctx->transfer_queue);
     
     trace("logical device created successfully\n");
 }
@@ -875,33 +1805,208 @@ void mg::create_swapchain_image_views(mg::context *ctx)
     trace("image views created successfully\n");
 }
 
+// highest sample count up to requested that all attachments support
+VkSampleCountFlagBits get_supported_sample_count(mg::context *ctx, VkSampleCountFlagBits requested)
+{
+    const VkPhysicalDeviceLimits *limits = &ctx->physical_device_properties.limits;
+    VkSampleCountFlags supported = limits->framebufferColorSampleCounts;
+
+    if (ctx->config.attachments.depth_format != VK_FORMAT_UNDEFINED)
+        supported &= limits->framebufferDepthSampleCounts;
+
+    u32 ret = (u32)requested;
+
+    while (ret > VK_SAMPLE_COUNT_1_BIT && (supported & ret) == 0)
+        ret >>= 1;
+
+    if (ret == 0)
+        ret = VK_SAMPLE_COUNT_1_BIT;
+
+    return (VkSampleCountFlagBits)ret;
+}
+
+mg::vk_image *create_attachment(mg::context *ctx, VkFormat format, VkImageUsageFlags usage, VkImageView *out_view)
+{
+    VkExtent3D extent{ctx->config.surface.extent.width, ctx->config.surface.extent.height, 1};
+
+    // transient: the contents never leave the render pass
+    mg::vk_image *img = mg::create_image(&ctx->memory_manager, extent, 0, VK_IMAGE_TYPE_2D, format, 1, 1, ctx->samples, VK_IMAGE_TILING_OPTIMAL, usage | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT);
+
+    mg::auto_bind_transient_image(&ctx->memory_manager, img);
+
+    VkImageViewCreateInfo createInfo{};
+    createInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    createInfo.image = img->image;
+    createInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    createInfo.format = format;
+    createInfo.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
+    createInfo.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
+    createInfo.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
+    createInfo.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
+    createInfo.subresourceRange.aspectMask = mg::get_image_aspect(format);
+    createInfo.subresourceRange.baseMipLevel = 0;
+    createInfo.subresourceRange.levelCount = 1;
+    createInfo.subresourceRange.baseArrayLayer = 0;
+    createInfo.subresourceRange.layerCount = 1;
+
+    VkResult res = vkCreateImageView(ctx->device, &createInfo, nullptr, out_view);
+
+    if (res != VK_SUCCESS)
+        throw_vk_error(res, "%p failed to create attachment image view", ctx);
+
+    return img;
+}
+
+void mg::create_depth_buffers(mg::context *ctx)
+{
+    trace("creating depth buffers\n");
+    assert(ctx->device != nullptr);
+    assert(ctx->depth_buffer == nullptr);
+    assert(ctx->msaa_buffer == nullptr);
+
+    VkFormat depth_format = ctx->config.attachments.depth_format;
+
+    if (depth_format != VK_FORMAT_UNDEFINED)
+    {
+        VkFormatProperties props;
+        vkGetPhysicalDeviceFormatProperties(ctx->physical_device, depth_format, &props);
+
+        if ((props.optimalTilingFeatures & VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT) == 0)
+            throw_error("%p depth format %u is not supported as depth / stencil attachment", ctx, (u32)depth_format);
+    }
+
+    ctx->samples = ::get_supported_sample_count(ctx, ctx->config.attachments.samples);
+
+    if (depth_format != VK_FORMAT_UNDEFINED)
+        ctx->depth_buffer = ::create_attachment(ctx, depth_format, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, &ctx->depth_buffer_view);
+
+    if (ctx->samples != VK_SAMPLE_COUNT_1_BIT)
+        ctx->msaa_buffer = ::create_attachment(ctx, ctx->config.surface.format.format, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, &ctx->msaa_buffer_view);
+
+    trace("depth buffers created successfully\n");
+}
+
+inline bool attachment_matches(const mg::context *ctx, const mg::vk_image *img, VkFormat format)
+{
+    return img->format == format
+        && img->samples == ctx->samples
+        && img->extent.width == ctx->config.surface.extent.width
+        && img->extent.height == ctx->config.surface.extent.height;
+}
+
+void mg::update_depth_buffers(mg::context *ctx)
+{
+    assert(ctx->device != nullptr);
+
+    VkFormat depth_format = ctx->config.attachments.depth_format;
+    bool up_to_date = ::get_supported_sample_count(ctx, ctx->config.attachments.samples) == ctx->samples;
+
+    if (up_to_date)
+    {
+        if (depth_format == VK_FORMAT_UNDEFINED)
+            up_to_date = ctx->depth_buffer == nullptr;
+        else
+            up_to_date = ctx->depth_buffer != nullptr && ::attachment_matches(ctx, ctx->depth_buffer, depth_format);
+    }
+
+    if (up_to_date)
+    {
+        if (ctx->samples == VK_SAMPLE_COUNT_1_BIT)
+            up_to_date = ctx->msaa_buffer == nullptr;
+        else
+            up_to_date = ctx->msaa_buffer != nullptr && ::attachment_matches(ctx, ctx->msaa_buffer, ctx->config.surface.format.format);
+    }
+
+    if (up_to_date)
+        return;
+
+    // destroy first so the new attachments can reuse the memory
+    mg::destroy_depth_buffers(ctx);
+    mg::create_depth_buffers(ctx);
+}
+
 void mg::create_render_pass(mg::context *ctx)
 {
     trace("creating render pass\n");
     assert(ctx->device != nullptr);
 
-    VkAttachmentDescription attachments[1];
+    bool depth = ctx->depth_buffer != nullptr;
+    bool msaa = ctx->msaa_buffer != nullptr;
+
+    // color, depth, resolve
+    VkAttachmentDescription attachments[3];
+    u32 attachment_count = 0;
     
-    VkAttachmentDescription *colorAttachment = &attachments[0];
+    VkAttachmentDescription *colorAttachment = &attachments[attachment_count++];
     colorAttachment->flags = 0;
     colorAttachment->format = ctx->config.surface.format.format;
-    colorAttachment->samples = VK_SAMPLE_COUNT_1_BIT;
+    colorAttachment->samples = ctx->samples;
     colorAttachment->loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
     colorAttachment->storeOp = VK_ATTACHMENT_STORE_OP_STORE;
     colorAttachment->stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
     colorAttachment->stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
     colorAttachment->initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
     colorAttachment->finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+
+    if (msaa)
+    {
+        // only the resolved image is presented
+        colorAttachment->storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        colorAttachment->finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    }
     
     VkAttachmentReference colorAttachmentRef{};
     colorAttachmentRef.attachment = 0;
     colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 
+    VkAttachmentReference depthAttachmentRef{};
+
+    if (depth)
+    {
+        VkFormat format = ctx->depth_buffer->format;
+        bool stencil = (mg::get_image_aspect(format) & VK_IMAGE_ASPECT_STENCIL_BIT) != 0;
+
+        depthAttachmentRef.attachment = attachment_count;
+        depthAttachmentRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+        // cleared and discarded every frame, never stored to memory
+        VkAttachmentDescription *depthAttachment = &attachments[attachment_count++];
+        depthAttachment->flags = 0;
+        depthAttachment->format = format;
+        depthAttachment->samples = ctx->samples;
+        depthAttachment->loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+        depthAttachment->storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        depthAttachment->stencilLoadOp = stencil ? VK_ATTACHMENT_LOAD_OP_CLEAR : VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+        depthAttachment->stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        depthAttachment->initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        depthAttachment->finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+    }
+
+    VkAttachmentReference resolveAttachmentRef{};
+
+    if (msaa)
+    {
+        resolveAttachmentRef.attachment = attachment_count;
+        resolveAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+        VkAttachmentDescription *resolveAttachment = &attachments[attachment_count++];
+        resolveAttachment->flags = 0;
+        resolveAttachment->format = ctx->config.surface.format.format;
+        resolveAttachment->samples = VK_SAMPLE_COUNT_1_BIT;
+        resolveAttachment->loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+        resolveAttachment->storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+        resolveAttachment->stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+        resolveAttachment->stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        resolveAttachment->initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        resolveAttachment->finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    }
+
     VkSubpassDescription subpass{};
     subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
     subpass.colorAttachmentCount = 1;
     subpass.pColorAttachments = &colorAttachmentRef;
-    subpass.pDepthStencilAttachment = nullptr;
+    subpass.pResolveAttachments = msaa ? &resolveAttachmentRef : nullptr;
+    subpass.pDepthStencilAttachment = depth ? &depthAttachmentRef : nullptr;
 
     VkSubpassDependency dependencies[1];
 
@@ -914,9 +2019,23 @@ void mg::create_render_pass(mg::context *ctx)
 	dependency->dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
 	dependency->dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
 
+    // the depth and multisampled color buffers are shared by all frames in
+    // flight, the previous frame's writes to them must be done before this
+    // frame clears them.
+    if (depth)
+    {
+        dependency->srcStageMask |= VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+        dependency->srcAccessMask |= VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+        dependency->dstStageMask |= VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+        dependency->dstAccessMask |= VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    }
+
+    if (msaa)
+        dependency->srcAccessMask |= VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+
     VkRenderPassCreateInfo renderPassInfo{};
     renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-    renderPassInfo.attachmentCount = 1;
+    renderPassInfo.attachmentCount = attachment_count;
     renderPassInfo.pAttachments = attachments;
     renderPassInfo.subpassCount = 1;
     renderPassInfo.pSubpasses = &subpass;
@@ -941,14 +2060,22 @@ void mg::create_framebuffers(mg::context *ctx)
     
     for_array(i, iv, &ctx->swapchain_image_views)
     {
-        VkImageView attachments[] = {
-            *iv
-        };
+        // same order as in create_render_pass
+        VkImageView attachments[3];
+        u32 attachment_count = 0;
+
+        attachments[attachment_count++] = ctx->msaa_buffer != nullptr ? ctx->msaa_buffer_view : *iv;
+
+        if (ctx->depth_buffer != nullptr)
+            attachments[attachment_count++] = ctx->depth_buffer_view;
+
+        if (ctx->msaa_buffer != nullptr)
+            attachments[attachment_count++] = *iv;
 
         VkFramebufferCreateInfo framebufferInfo{};
         framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
         framebufferInfo.renderPass = ctx->render_pass;
-        framebufferInfo.attachmentCount = 1;
+        framebufferInfo.attachmentCount = attachment_count;
         framebufferInfo.pAttachments = attachments;
         framebufferInfo.width = ctx->config.surface.extent.width;
         framebufferInfo.height = ctx->config.surface.extent.height;
@@ -1021,9 +2148,57 @@ void mg::create_frame_data(mg::context *ctx)
             throw_vk_error(res, "%p failed to create fence", ctx);
 
         mg::init(&frame->descriptor_pool_manager, ctx);
+        frame->upload_value = 0;
     }
 }
 
+void mg::create_frame_allocators(mg::context *ctx)
+{
+    trace("creating frame allocators\n");
+    assert(ctx->device != nullptr);
+
+    VkDeviceSize alignment = ctx->physical_device_properties.limits.minUniformBufferOffsetAlignment;
+
+    if (alignment == 0)
+        alignment = 1;
+
+    VkBufferUsageFlags usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT
+                             | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT
+                             | VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
+
+    for (u32 i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
+        mg::init(&ctx->frames[i].frame_allocator, &ctx->memory_manager, ctx->config.frame_allocator_size, alignment, usage);
+}
+
+void mg::create_staging_ring(mg::context *ctx)
+{
+    trace("creating staging ring\n");
+    assert(ctx->device != nullptr);
+
+    // buffer image copies need offsets aligned to the texel block size
+    VkDeviceSize alignment = Max(ctx->physical_device_properties.limits.optimalBufferCopyOffsetAlignment, (VkDeviceSize)16);
+
+    mg::init(&ctx->staging_ring, &ctx->memory_manager, ctx->config.staging_ring_size, alignment);
+}
+
+void mg::create_transfer_queue(mg::context *ctx)
+{
+    trace("creating transfer queue\n");
+    assert(ctx->device != nullptr);
+    assert(ctx->transfer_queue != nullptr);
+
+    mg::init(&ctx->transfer, ctx->device, ctx->transfer_queue, ctx->transfer_queue_index, ctx->graphics_queue, ctx->graphics_queue_index);
+}
+
+void mg::create_copy_pool(mg::context *ctx)
+{
+    trace("creating copy pool\n");
+    assert(ctx != nullptr);
+
+    mg::free(&ctx->copy_pool);
+    mg::init(&ctx->copy_pool, ctx->config.copy_thread_count, ctx->config.min_parallel_copy_size);
+}
+
 // =======
 // DESTROY
 // =======
@@ -1046,6 +2221,56 @@ void mg::destroy_frame_data(mg::context *ctx)
     }
 }
 
+void mg::destroy_transfer_queue(mg::context *ctx)
+{
+    trace("destroying transfer queue\n");
+
+    if (ctx->transfer.command_pool == nullptr)
+        return;
+
+    vkQueueWaitIdle(ctx->transfer_queue);
+    mg::free(&ctx->transfer, ctx->device, &ctx->memory_manager);
+}
+
+void mg::destroy_download_queue(mg::context *ctx)
+{
+    assert(ctx != nullptr);
+
+    mg::free(&ctx->downloads, &ctx->memory_manager);
+}
+
+void mg::destroy_file_uploads(mg::context *ctx)
+{
+    assert(ctx != nullptr);
+
+    for_array(fu, &ctx->file_uploads)
+        mg::destroy_file_upload(*fu);
+
+    ::clear(&ctx->file_uploads);
+}
+
+void mg::destroy_copy_pool(mg::context *ctx)
+{
+    assert(ctx != nullptr);
+
+    mg::free(&ctx->copy_pool);
+}
+
+void mg::destroy_staging_ring(mg::context *ctx)
+{
+    trace("destroying staging ring\n");
+
+    mg::free(&ctx->staging_ring, &ctx->memory_manager);
+}
+
+void mg::destroy_frame_allocators(mg::context *ctx)
+{
+    trace("destroying frame allocators\n");
+
+    for (u32 i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
+        mg::free(&ctx->frames[i].frame_allocator, &ctx->memory_manager);
+}
+
 void mg::destroy_framebuffers(mg::context *ctx)
 {
     trace("destroying framebuffers\n");
@@ -1070,6 +2295,29 @@ void mg::destroy_render_pass(mg::context *ctx)
     ctx->render_pass = nullptr;
 }
 
+void mg::destroy_depth_buffers(mg::context *ctx)
+{
+    trace("destroying depth buffers\n");
+    assert(ctx->device != nullptr);
+
+    if (ctx->depth_buffer != nullptr)
+    {
+        vkDestroyImageView(ctx->device, ctx->depth_buffer_view, nullptr);
+        mg::destroy_image(&ctx->memory_manager, ctx->depth_buffer);
+    }
+
+    if (ctx->msaa_buffer != nullptr)
+    {
+        vkDestroyImageView(ctx->device, ctx->msaa_buffer_view, nullptr);
+        mg::destroy_image(&ctx->memory_manager, ctx->msaa_buffer);
+    }
+
+    ctx->depth_buffer = nullptr;
+    ctx->depth_buffer_view = nullptr;
+    ctx->msaa_buffer = nullptr;
+    ctx->msaa_buffer_view = nullptr;
+}
+
 void mg::destroy_swapchain_image_views(mg::context *ctx)
 {
     trace("destroying image views\n");
@@ -1164,12 +2412,19 @@ void mg::free(mg::context *ctx)
 
     destroy_framebuffers(ctx);
     destroy_render_pass(ctx);
+    destroy_depth_buffers(ctx);
     destroy_swapchain_image_views(ctx);
     destroy_swapchain(ctx);
     destroy_old_swapchains(ctx);
     ::clear(&ctx->swapchain_images);
     destroy_target_surface(ctx);
     clear_queued_buffers(ctx);
+    destroy_transfer_queue(ctx);
+    destroy_download_queue(ctx);
+    destroy_file_uploads(ctx);
+    destroy_copy_pool(ctx);
+    destroy_staging_ring(ctx);
+    destroy_frame_allocators(ctx);
     destroy_descriptor_pool_manager(ctx);
     destroy_memory_manager(ctx);
     destroy_logical_device(ctx);
@@ -1177,6 +2432,8 @@ void mg::free(mg::context *ctx)
 
     ::free(&ctx->swap_buffers);
     ::free(&ctx->image_swap_buffers);
+    ::free(&ctx->file_uploads);
+    mg::free(&ctx->upload_cache);
 
     ::free(&ctx->swapchain_images);
     ::free(&ctx->swapchain_image_views);
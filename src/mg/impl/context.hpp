@@ -9,8 +9,15 @@
 #include "shl/number_types.hpp"
 
 #include "mg/impl/vk_buffer.hpp"
+#include "mg/impl/copy_pool.hpp"
 #include "mg/impl/descriptor_pool_manager.hpp"
+#include "mg/impl/download_queue.hpp"
+#include "mg/impl/file_upload.hpp"
+#include "mg/impl/frame_allocator.hpp"
 #include "mg/impl/memory_manager.hpp"
+#include "mg/impl/staging_ring.hpp"
+#include "mg/impl/transfer_queue.hpp"
+#include "mg/impl/upload_cache.hpp"
 #include "mg/window.hpp"
 #include "mg/context.hpp"
 
@@ -44,22 +51,69 @@ struct vk_config
         VkPresentModeKHR fallback_present_mode;
         VkSurfaceTransformFlagBitsKHR transform;
     } swap;
+
+    // size of the transient memory of each frame, see allocate_frame_memory
+    VkDeviceSize frame_allocator_size;
+
+    // size of the staging ring that all queued uploads are copied into,
+    // see queue_buffer_upload
+    VkDeviceSize staging_ring_size;
+
+    // bytes of all file uploads that are copied into the staging ring per
+    // update, see queue_file_upload
+    VkDeviceSize file_upload_chunk_size;
+
+    // workers for large writes into mapped memory, see copy_pool.
+    // UINT32_MAX picks a count based on the hardware threads, 0 disables them.
+    u32 copy_thread_count;
+    u64 min_parallel_copy_size;
+
+    // skip queued uploads of the data that was last uploaded to the same
+    // destination, see upload_cache
+    bool upload_cache;
+
+    // additional attachments of the render pass. both only live inside the
+    // render pass and are bound to lazily allocated memory if the device has any.
+    // depth_format VK_FORMAT_UNDEFINED disables the depth / stencil attachment,
+    // samples above VK_SAMPLE_COUNT_1_BIT render to a multisampled color
+    // attachment that is resolved to the swapchain image.
+    struct _attachments
+    {
+        VkFormat depth_format;
+        VkSampleCountFlagBits samples;
+    } attachments;
 };
 
 // sets default values for a config
 void init(mg::vk_config *conf);
 void free(mg::vk_config *conf);
 
+// upload data in staging memory
+struct staging_source
+{
+    mg::vk_buffer *buffer;
+    VkDeviceSize offset; // inside buffer
+
+    // own staging sub-buffer if the data did not fit into the staging ring,
+    // destroyed once the upload is done. nullptr otherwise.
+    mg::vk_sub_buffer *spilled;
+};
+
 struct swap_buffer_data
 {
-    mg::vk_sub_buffer *source;
+    mg::staging_source source;
     mg::vk_sub_buffer *destination;
+    VkDeviceSize destination_offset; // inside destination
     VkDeviceSize size;
+
+    // chunk of a file upload, frames only read the destination once the
+    // whole file is done, see upload_queued_buffers
+    bool file_chunk;
 };
 
 struct image_swap_buffer_data
 {
-    mg::vk_sub_buffer *source;
+    mg::staging_source source;
     mg::vk_image *destination;
 
     u32                source_width;
@@ -84,6 +138,13 @@ struct frame_data
     array<VkCommandBuffer> command_buffers;
 
     mg::descriptor_pool_manager descriptor_pool_manager;
+
+    // reset in start_rendering once render_fence has signalled
+    mg::frame_allocator frame_allocator;
+
+    // transfer timeline value the frame signals because it carries uploads,
+    // 0 if it doesn't. see record_frame_uploads.
+    u64 upload_value;
 };
 
 struct context
@@ -93,6 +154,12 @@ struct context
         bool extent;
     } changed;
 
+    // optional device extensions, enabled if available
+    struct _extensions
+    {
+        bool memory_budget;
+    } extensions;
+
     vk_config config;
 
     mg::window *window;
@@ -102,9 +169,16 @@ struct context
     mg::image_swap_buffer_list image_swap_buffers;
 
     mg::memory_manager memory_manager;
+    mg::staging_ring staging_ring;
+    mg::transfer_queue transfer;
+    mg::download_queue downloads;
+    array<mg::file_upload*> file_uploads;
+    mg::copy_pool copy_pool;
+    mg::upload_cache upload_cache; // only used if config.upload_cache is set
     mg::descriptor_pool_manager descriptor_pool_manager;
 
     VkPhysicalDevice physical_device;
+    VkPhysicalDeviceProperties physical_device_properties;
     
     u32 graphics_queue_index;
     u32 graphics_queue_max_count;
@@ -112,6 +186,10 @@ struct context
     u32 present_queue_index;
     u32 present_queue_max_count;
     VkQueue present_queue;
+    // uploads, may be the same as the graphics queue
+    u32 transfer_queue_index;
+    u32 transfer_queue_max_count;
+    VkQueue transfer_queue;
     
     VkDevice device;
     VkSurfaceKHR target_surface;
@@ -123,6 +201,13 @@ struct context
 
     array<VkSwapchainKHR> swapchains_to_delete;
 
+    // see vk_config::attachments, nullptr if disabled
+    mg::vk_image *depth_buffer;
+    VkImageView depth_buffer_view;
+    mg::vk_image *msaa_buffer;
+    VkImageView msaa_buffer_view;
+    VkSampleCountFlagBits samples; // supported sample count closest to config.attachments.samples
+
     VkRenderPass render_pass;
     u32 current_image_index; // used in between start_rendering and end_rendering
 
@@ -143,12 +228,74 @@ VkPresentModeKHR get_supported_present_mode(const context *ctx);
 
 void submit_immediate_vulkan_command_to_current_frame(mg::context *ctx, void (*cmd)(VkCommandBuffer, void*), void *userdata);
 
-// only possible on host coherent buffers
-void write_buffer(mg::context *ctx, mg::vk_sub_buffer *dest, const void *data, u64 size);
-// possible on any writable buffers
+// only possible on host visible buffers, non-coherent writes are flushed
+// before the next upload or frame submission.
+// large writes are split across the copy pool and return once all are done.
+void write_buffer(mg::context *ctx, mg::vk_sub_buffer *dest, const void *data, u64 size, VkDeviceSize dest_offset = 0);
+// possible on any writable buffers.
+// the data is copied into the staging ring right away. if the ring is full,
+// this waits for the GPU to finish the submitted uploads, data that still
+// doesn't fit is staged in its own sub-buffer.
+// destinations in host visible memory, e.g. from get_new_upload_sub_buffer
+// on integrated GPUs or with resizable BAR, are written directly instead
+// if no submitted frame or upload may still use them. otherwise they are
+// staged like any other destination, or if they can't be copied to, this
+// throws.
+// queued uploads run asynchronously on the transfer queue once submitted with
+// upload_queued_buffers, frames submitted afterwards wait for them on the GPU.
+// without a separate transfer queue, the copies are recorded at the start
+// of the next frame instead, see record_frame_uploads.
+// destinations must not be used before the next start_rendering.
+// with vk_config::upload_cache, uploads of the data that was last uploaded
+// to the same destination and region are skipped.
 void queue_buffer_upload(mg::context *ctx, mg::vk_sub_buffer *dest, const void *data, u64 size);
 void queue_image_upload(mg::context *ctx, mg::vk_image *dest, const void *data, u64 data_size, u32 width, u32 height, VkOffset3D offset = {0, 0, 0}, VkImageAspectFlags aspects = VK_IMAGE_ASPECT_COLOR_BIT, u32 mipmap_level = 0, u32 layer_start = 0, u32 layer_count = 1);
+// uploads size bytes of the file at path, starting at offset, to dest.
+// size 0 uploads everything from offset to the end of the file.
+// the file is memory mapped and streamed through the staging ring in chunks
+// of at most vk_config::file_upload_chunk_size per update, so large files
+// take several updates and neither stall nor need a heap copy of the file.
+// dest must have been created with VK_BUFFER_USAGE_TRANSFER_DST_BIT, even in
+// host visible memory chunks are copied on the GPU, otherwise this throws.
+// the upload is done once the last chunk is done on the GPU, then callback
+// is called. it must be released with release_file_upload.
+mg::file_upload *queue_file_upload(mg::context *ctx, mg::vk_sub_buffer *dest, const char *path, u64 offset = 0, u64 size = 0, mg::file_upload_callback callback = nullptr, void *userdata = nullptr);
+// the next queued upload to dest is not skipped by the upload cache.
+// needed when dest is written by anything but queued uploads, destroyed
+// sub-buffers and images are forgotten automatically.
+void forget_cached_uploads(mg::context *ctx, const void *dest);
+// may be called before the upload is done, the rest of the file is skipped
+void release_file_upload(mg::context *ctx, mg::file_upload *fu);
+// queues the next chunks of the file uploads, is called automatically in update(ctx)
+void stream_file_uploads(mg::context *ctx);
 void upload_queued_buffers(mg::context *ctx); // is called automatically in update(ctx)
+// reclaims the staging memory of finished uploads and completes file uploads,
+// is called automatically in start_rendering
+void update_uploads(mg::context *ctx);
+// whether uploads share the graphics queue and are recorded into the frame
+// command buffers instead of being submitted on their own
+bool uploads_in_frame(const mg::context *ctx);
+// records the queued uploads into cmd if uploads_in_frame, the memory they
+// were staged in is reclaimed once the frame is done.
+// is called automatically in start_rendering, before the render pass.
+void record_frame_uploads(mg::context *ctx, mg::frame_data *frame, VkCommandBuffer cmd);
+
+// copies from the GPU to host memory, recorded at the end of the next frame
+// after everything the frame rendered. the download is ready once the
+// frame is done on the GPU, which is checked in start_rendering, then
+// download::data points to the mapped data and callback is called.
+// the download must be released with release_download.
+mg::download *queue_buffer_download(mg::context *ctx, mg::vk_sub_buffer *src, VkDeviceSize offset, VkDeviceSize size, mg::download_callback callback = nullptr, void *userdata = nullptr);
+// src must be in VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL or VK_IMAGE_LAYOUT_GENERAL
+// at the end of the frame, data_size is the size of the tightly packed texels.
+mg::download *queue_image_download(mg::context *ctx, mg::vk_image *src, u64 data_size, u32 width, u32 height, VkOffset3D offset = {0, 0, 0}, VkImageAspectFlags aspects = VK_IMAGE_ASPECT_COLOR_BIT, u32 mipmap_level = 0, u32 layer_start = 0, u32 layer_count = 1, mg::download_callback callback = nullptr, void *userdata = nullptr);
+// may be called before the download is ready
+void release_download(mg::context *ctx, mg::download *dl);
+
+// transient memory of the current frame, only valid between start_rendering
+// and end_rendering. reclaimed in start_rendering once the frame is done on
+// the GPU, so nothing has to be freed.
+mg::frame_allocation allocate_frame_memory(mg::context *ctx, VkDeviceSize size);
 void clear_queued_buffers(mg::context *ctx);
 
 void setup_instance(mg::context *ctx, const char** extensions, u32 extension_count);
@@ -159,11 +306,24 @@ void create_logical_device(mg::context *ctx, const array<const_string> *layer_ex
 void create_swapchain(mg::context *ctx);
 void set_swapchain_images(mg::context *ctx);
 void create_swapchain_image_views(mg::context *ctx);
+void create_depth_buffers(mg::context *ctx);
+// recreates the depth buffers if they don't match the surface anymore
+void update_depth_buffers(mg::context *ctx);
 void create_render_pass(mg::context *ctx);
 void create_framebuffers(mg::context *ctx);
 void create_frame_data(mg::context *ctx);
+void create_frame_allocators(mg::context *ctx);
+void create_staging_ring(mg::context *ctx);
+void create_transfer_queue(mg::context *ctx);
+void create_copy_pool(mg::context *ctx);
 
 void destroy_frame_data(mg::context *ctx);
+void destroy_frame_allocators(mg::context *ctx);
+void destroy_staging_ring(mg::context *ctx);
+void destroy_transfer_queue(mg::context *ctx);
+void destroy_download_queue(mg::context *ctx);
+void destroy_file_uploads(mg::context *ctx);
+void destroy_copy_pool(mg::context *ctx);
 void destroy_framebuffers(mg::context *ctx);
 void destroy_render_pass(mg::context *ctx);
 void destroy_depth_buffers(mg::context *ctx);
@@ -0,0 +1,227 @@
+
+#include <assert.h>
+#include <string.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#include <emmintrin.h>
+#define MG_NON_TEMPORAL_STORES 1
+#endif
+
+#include "shl/compare.hpp"
+
+#include "mg/impl/copy_pool.hpp"
+
+// the current copy, workers claim chunks until there are none left
+struct copy_job
+{
+    u8 *dst;
+    const u8 *src;
+    u64 size;
+    u64 chunk_count;
+    bool non_temporal;
+};
+
+struct mg::copy_pool_shared
+{
+    std::thread *threads;
+
+    std::mutex mutex;
+    std::condition_variable start;
+    std::condition_variable finished;
+
+    copy_job job;
+    std::atomic<u64> next_chunk;
+    u64 generation; // incremented for every job
+    u32 busy;       // workers still working on the current job
+    bool quit;
+};
+
+void mg::copy_non_temporal(void *dst, const void *src, u64 size)
+{
+#if MG_NON_TEMPORAL_STORES
+    u8 *d = (u8*)dst;
+    const u8 *s = (const u8*)src;
+
+    // streaming stores need 16 byte aligned destinations
+    u64 head = (16 - ((uintptr_t)d & 15)) & 15;
+
+    if (head > size)
+        head = size;
+
+    memcpy(d, s, head);
+    d += head;
+    s += head;
+    size -= head;
+
+    u64 blocks = size / 64;
+
+    for (u64 i = 0; i < blocks; ++i)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i*)(s +  0));
+        __m128i b = _mm_loadu_si128((const __m128i*)(s + 16));
+        __m128i c = _mm_loadu_si128((const __m128i*)(s + 32));
+        __m128i e = _mm_loadu_si128((const __m128i*)(s + 48));
+        _mm_stream_si128((__m128i*)(d +  0), a);
+        _mm_stream_si128((__m128i*)(d + 16), b);
+        _mm_stream_si128((__m128i*)(d + 32), c);
+        _mm_stream_si128((__m128i*)(d + 48), e);
+
+        d += 64;
+        s += 64;
+    }
+
+    memcpy(d, s, size % 64);
+
+    // streaming stores are weakly ordered
+    _mm_sfence();
+#else
+    memcpy(dst, src, size);
+#endif
+}
+
+void copy_chunks(mg::copy_pool_shared *shared)
+{
+    const copy_job *job = &shared->job;
+
+    while (true)
+    {
+        u64 chunk = shared->next_chunk.fetch_add(1);
+
+        if (chunk >= job->chunk_count)
+            break;
+
+        u64 offset = chunk * mg::PARALLEL_COPY_CHUNK_SIZE;
+        u64 size = Min(mg::PARALLEL_COPY_CHUNK_SIZE, job->size - offset);
+
+        if (job->non_temporal)
+            mg::copy_non_temporal(job->dst + offset, job->src + offset, size);
+        else
+            memcpy(job->dst + offset, job->src + offset, size);
+    }
+}
+
+void copy_worker(mg::copy_pool_shared *shared)
+{
+    u64 generation = 0;
+
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(shared->mutex);
+            shared->start.wait(lock, [&]{ return shared->quit || shared->generation != generation; });
+
+            if (shared->quit)
+                return;
+
+            generation = shared->generation;
+        }
+
+        ::copy_chunks(shared);
+
+        std::lock_guard<std::mutex> lock(shared->mutex);
+        shared->busy -= 1;
+
+        if (shared->busy == 0)
+            shared->finished.notify_one();
+    }
+}
+
+void mg::init(mg::copy_pool *pool, u32 thread_count, u64 min_parallel_size)
+{
+    assert(pool != nullptr);
+
+    if (thread_count == UINT32_MAX)
+    {
+        u32 hw = (u32)std::thread::hardware_concurrency();
+        thread_count = hw > 1 ? Min(hw - 1, mg::MAX_COPY_THREADS) : 0;
+    }
+
+    pool->thread_count = thread_count;
+    pool->min_parallel_size = Max(min_parallel_size, mg::PARALLEL_COPY_CHUNK_SIZE);
+    pool->shared = nullptr;
+
+    if (thread_count == 0)
+        return;
+
+    mg::copy_pool_shared *shared = new mg::copy_pool_shared;
+    shared->next_chunk = 0;
+    shared->generation = 0;
+    shared->busy = 0;
+    shared->quit = false;
+    shared->threads = new std::thread[thread_count];
+
+    for (u32 i = 0; i < thread_count; ++i)
+        shared->threads[i] = std::thread(::copy_worker, shared);
+
+    pool->shared = shared;
+}
+
+void mg::free(mg::copy_pool *pool)
+{
+    assert(pool != nullptr);
+
+    mg::copy_pool_shared *shared = pool->shared;
+
+    if (shared == nullptr)
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(shared->mutex);
+        shared->quit = true;
+    }
+
+    shared->start.notify_all();
+
+    for (u32 i = 0; i < pool->thread_count; ++i)
+        shared->threads[i].join();
+
+    delete[] shared->threads;
+    delete shared;
+
+    pool->shared = nullptr;
+    pool->thread_count = 0;
+}
+
+void mg::parallel_copy(mg::copy_pool *pool, void *dst, const void *src, u64 size, bool non_temporal)
+{
+    assert(pool != nullptr);
+    assert(dst != nullptr);
+    assert(src != nullptr);
+
+    mg::copy_pool_shared *shared = pool->shared;
+
+    if (shared == nullptr || size < pool->min_parallel_size)
+    {
+        if (non_temporal)
+            mg::copy_non_temporal(dst, src, size);
+        else
+            memcpy(dst, src, size);
+
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(shared->mutex);
+        shared->job.dst = (u8*)dst;
+        shared->job.src = (const u8*)src;
+        shared->job.size = size;
+        shared->job.chunk_count = (size + mg::PARALLEL_COPY_CHUNK_SIZE - 1) / mg::PARALLEL_COPY_CHUNK_SIZE;
+        shared->job.non_temporal = non_temporal;
+        shared->next_chunk = 0;
+        shared->busy = pool->thread_count;
+        shared->generation += 1;
+    }
+
+    shared->start.notify_all();
+
+    // the calling thread copies too
+    ::copy_chunks(shared);
+
+    std::unique_lock<std::mutex> lock(shared->mutex);
+    shared->finished.wait(lock, [&]{ return shared->busy == 0; });
+}
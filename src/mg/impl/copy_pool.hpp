@@ -0,0 +1,40 @@
+#pragma once
+
+#include "shl/number_types.hpp"
+
+// worker threads for large copies into mapped memory.
+// a single memcpy is limited by the memory bandwidth one core can use,
+// copies of at least min_parallel_size bytes are split into chunks that
+// the workers and the calling thread copy at the same time.
+//
+// memory that is not host cached is usually write-combined, reading it back
+// into the cache is pointless, so copies into it use non-temporal stores
+// where available.
+namespace mg
+{
+constexpr const u64 DEFAULT_MIN_PARALLEL_COPY_SIZE = 8388608ull;
+constexpr const u64 PARALLEL_COPY_CHUNK_SIZE = 1048576ull;
+constexpr const u32 MAX_COPY_THREADS = 8;
+
+struct copy_pool_shared;
+
+struct copy_pool
+{
+    u32 thread_count; // workers, not counting the calling thread
+    u64 min_parallel_size;
+
+    // threads and synchronization, nullptr without workers
+    mg::copy_pool_shared *shared;
+};
+
+// thread_count UINT32_MAX picks one less than the number of hardware threads,
+// at most MAX_COPY_THREADS. 0 copies everything on the calling thread.
+void init(mg::copy_pool *pool, u32 thread_count = UINT32_MAX, u64 min_parallel_size = mg::DEFAULT_MIN_PARALLEL_COPY_SIZE);
+void free(mg::copy_pool *pool);
+
+// copies with non-temporal stores if possible, followed by a store fence
+void copy_non_temporal(void *dst, const void *src, u64 size);
+
+// returns once everything is copied. only one thread may copy at a time.
+void parallel_copy(mg::copy_pool *pool, void *dst, const void *src, u64 size, bool non_temporal);
+}
@@ -0,0 +1,525 @@
+
+#include <assert.h>
+
+#include "shl/compare.hpp"
+#include "shl/debug.hpp"
+#include "shl/defer.hpp"
+
+#include "mg/vk_error.hpp"
+#include "mg/impl/context.hpp"
+#include "mg/impl/memory_manager.hpp"
+#include "mg/impl/defragmenter.hpp"
+
+// a move that still has to be copied in the command buffer
+struct defragment_move
+{
+    mg::memory_binding_type type;
+    mg::vk_buffer *buffer;
+    mg::vk_image *image;
+    VkBuffer old_buffer;
+    VkImage old_image;
+};
+
+void mg::init(mg::defragmenter *defrag)
+{
+    assert(defrag != nullptr);
+
+    defrag->max_bytes_per_frame = 0;
+    defrag->max_usage = mg::DEFAULT_DEFRAGMENT_MAX_USAGE;
+    defrag->buffer_moved = nullptr;
+    defrag->image_moved = nullptr;
+    defrag->userdata = nullptr;
+    defrag->source = nullptr;
+
+    ::init(&defrag->retired);
+}
+
+void mg::free(mg::defragmenter *defrag)
+{
+    assert(defrag != nullptr);
+
+    ::free(&defrag->retired);
+    defrag->source = nullptr;
+}
+
+inline bool is_host_visible(const mg::vk_memory *mem)
+{
+    return (mem->type & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) == VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+}
+
+bool can_move(mg::memory_manager *mgr, mg::vk_buffer *buf)
+{
+    const VkBufferUsageFlags transfer = VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+
+    if ((buf->usage & transfer) != transfer)
+        return false;
+
+    VkMemoryRequirements reqs;
+    vkGetBufferMemoryRequirements(mgr->context->device, buf->buffer, &reqs);
+
+    return reqs.size <= mgr->defragmenter.max_bytes_per_frame;
+}
+
+bool can_move(mg::memory_manager *mgr, mg::vk_image *img)
+{
+    const VkImageUsageFlags transfer = VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+
+    if ((img->usage & transfer) != transfer
+     || img->tiling != VK_IMAGE_TILING_OPTIMAL
+     || img->layout == VK_IMAGE_LAYOUT_PREINITIALIZED)
+        return false;
+
+    VkMemoryRequirements reqs;
+    vkGetImageMemoryRequirements(mgr->context->device, img->image, &reqs);
+
+    return reqs.size <= mgr->defragmenter.max_bytes_per_frame;
+}
+
+// free space in all other blocks the resources of mem could be moved to
+VkDeviceSize free_space_outside_of(mg::memory_manager *mgr, mg::vk_memory *mem)
+{
+    VkDeviceSize ret = 0;
+
+    for_array(other, &mgr->allocator.allocated_memory)
+        if (*other != mem
+         && !(*other)->dedicated
+         && (*other)->type_index == mem->type_index
+         && mg::can_bind(*other, mem->binding_type))
+            ret += (*other)->total_free_space;
+
+    return ret;
+}
+
+bool can_evacuate(mg::memory_manager *mgr, mg::vk_memory *mem)
+{
+    if (mg::can_bind(mem, mg::memory_binding_type::Buffer))
+    {
+        for_array(buf, &mgr->buffers)
+            if ((*buf)->memory == mem && !::can_move(mgr, *buf))
+                return false;
+    }
+
+    if (mg::can_bind(mem, mg::memory_binding_type::Image))
+    {
+        for_array(img, &mgr->images)
+            if ((*img)->memory == mem && !::can_move(mgr, *img))
+                return false;
+    }
+
+    return ::free_space_outside_of(mgr, mem) >= mem->size - mem->total_free_space;
+}
+
+// the block with the least used space below max_usage
+mg::vk_memory *select_source(mg::memory_manager *mgr)
+{
+    mg::vk_memory *ret = nullptr;
+    VkDeviceSize ret_used = 0;
+
+    for_array(_mem, &mgr->allocator.allocated_memory)
+    {
+        mg::vk_memory *mem = *_mem;
+
+        if (::is_host_visible(mem) || mem->dedicated)
+            continue;
+
+        VkDeviceSize used = mem->size - mem->total_free_space;
+
+        if (used == 0
+         || (float)used >= mgr->defragmenter.max_usage * (float)mem->size
+         || (ret != nullptr && used >= ret_used))
+            continue;
+
+        if (!::can_evacuate(mgr, mem))
+            continue;
+
+        ret = mem;
+        ret_used = used;
+    }
+
+    return ret;
+}
+
+// the densest block other than source that fits reqs
+mg::vk_memory *select_target(mg::memory_manager *mgr, mg::vk_memory *source, VkMemoryRequirements *reqs, mg::memory_binding_type type, mg::memory_resource_kind kind)
+{
+    mg::vk_memory *ret = nullptr;
+
+    for_array(_mem, &mgr->allocator.allocated_memory)
+    {
+        mg::vk_memory *mem = *_mem;
+
+        if (mem == source
+         || mem->dedicated
+         || mem->type_index != source->type_index
+         || !mg::can_bind(mem, type)
+         || !mg::has_space_for(mem, reqs->size, reqs->alignment, kind))
+            continue;
+
+        if (ret == nullptr || mem->total_free_space < ret->total_free_space)
+            ret = mem;
+    }
+
+    return ret;
+}
+
+void retire(mg::memory_manager *mgr, mg::memory_binding_type type, VkBuffer buffer, VkImage image, mg::vk_memory *mem, u32 block)
+{
+    mg::defragment_retired *r = ::add_at_end(&mgr->defragmenter.retired);
+    r->type = type;
+    r->buffer = buffer;
+    r->image = image;
+    r->memory = mem;
+    r->memory_block = block;
+    r->frame = mgr->context->time_data.total_frame_count;
+}
+
+// returns the number of bytes moved, 0 if no target was found
+VkDeviceSize move_buffer(mg::memory_manager *mgr, mg::vk_buffer *buf, array<defragment_move> *moves)
+{
+    VkDevice dev = mgr->context->device;
+
+    VkMemoryRequirements reqs;
+    vkGetBufferMemoryRequirements(dev, buf->buffer, &reqs);
+
+    mg::vk_memory *target = ::select_target(mgr, buf->memory, &reqs, mg::memory_binding_type::Buffer, mg::memory_resource_kind::Linear);
+
+    if (target == nullptr)
+        return 0;
+
+    VkBufferCreateInfo bufferInfo{};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = buf->size;
+    bufferInfo.usage = buf->usage;
+    bufferInfo.sharingMode = buf->sharemode;
+
+    VkBuffer newbuf;
+    VkResult res = vkCreateBuffer(dev, &bufferInfo, nullptr, &newbuf);
+
+    if (res != VK_SUCCESS)
+        throw_vk_error(res, "%p could not create buffer to move vk_buffer %p to", mgr, buf);
+
+    trace("defragment: moving buffer %p from memory %p to %p\n", buf, buf->memory->memory, target->memory);
+
+    ::retire(mgr, mg::memory_binding_type::Buffer, buf->buffer, nullptr, buf->memory, buf->memory_block);
+
+    defragment_move *mv = ::add_at_end(moves);
+    mv->type = mg::memory_binding_type::Buffer;
+    mv->buffer = buf;
+    mv->image = nullptr;
+    mv->old_buffer = buf->buffer;
+    mv->old_image = nullptr;
+
+    // the graphics queue copies into the new buffer, which makes it its owner
+    buf->buffer = newbuf;
+    buf->queue_family = mgr->context->graphics_queue_index;
+    buf->memory = nullptr;
+    buf->memory_block = mg::TLSF_INVALID_BLOCK;
+    mg::bind_buffer_to_memory(target, dev, buf);
+
+    return reqs.size;
+}
+
+VkDeviceSize move_image(mg::memory_manager *mgr, mg::vk_image *img, array<defragment_move> *moves)
+{
+    VkDevice dev = mgr->context->device;
+
+    VkMemoryRequirements reqs;
+    vkGetImageMemoryRequirements(dev, img->image, &reqs);
+
+    mg::vk_memory *target = ::select_target(mgr, img->memory, &reqs, mg::memory_binding_type::Image, mg::get_resource_kind(img));
+
+    if (target == nullptr)
+        return 0;
+
+    VkImageCreateInfo info{};
+    info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    info.flags = img->flags;
+    info.imageType = img->image_type;
+    info.format = img->format;
+    info.extent = img->extent;
+    info.mipLevels = img->mipmap_levels;
+    info.arrayLayers = img->array_layers;
+    info.samples = img->samples;
+    info.tiling = img->tiling;
+    info.usage = img->usage;
+    info.sharingMode = img->sharemode;
+    info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+    VkImage newimg;
+    VkResult res = vkCreateImage(dev, &info, nullptr, &newimg);
+
+    if (res != VK_SUCCESS)
+        throw_vk_error(res, "%p could not create image to move vk_image %p to", mgr, img);
+
+    trace("defragment: moving image %p from memory %p to %p\n", img, img->memory->memory, target->memory);
+
+    ::retire(mgr, mg::memory_binding_type::Image, nullptr, img->image, img->memory, img->memory_block);
+
+    // contents of an undefined image don't have to be copied
+    if (img->layout != VK_IMAGE_LAYOUT_UNDEFINED)
+    {
+        defragment_move *mv = ::add_at_end(moves);
+        mv->type = mg::memory_binding_type::Image;
+        mv->buffer = nullptr;
+        mv->image = img;
+        mv->old_buffer = nullptr;
+        mv->old_image = img->image;
+    }
+
+    // see move_buffer, undefined images are not used by any queue yet
+    img->queue_family = img->layout != VK_IMAGE_LAYOUT_UNDEFINED ? mgr->context->graphics_queue_index : VK_QUEUE_FAMILY_IGNORED;
+    img->image = newimg;
+    img->memory = nullptr;
+    img->memory_block = mg::TLSF_INVALID_BLOCK;
+    mg::bind_image_to_memory(target, dev, img);
+
+    return reqs.size;
+}
+
+VkImageMemoryBarrier image_barrier(mg::vk_image *img, VkImage image, VkImageLayout from, VkImageLayout to, VkAccessFlags src_access, VkAccessFlags dst_access)
+{
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcAccessMask = src_access;
+    barrier.dstAccessMask = dst_access;
+    barrier.oldLayout = from;
+    barrier.newLayout = to;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image;
+    barrier.subresourceRange.aspectMask = mg::get_image_aspect(img->format);
+    barrier.subresourceRange.baseMipLevel = 0;
+    barrier.subresourceRange.levelCount = img->mipmap_levels;
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount = img->array_layers;
+
+    return barrier;
+}
+
+void record_moves(VkCommandBuffer cmd, array<defragment_move> *moves)
+{
+    array<VkImageMemoryBarrier> barriers;
+    ::init(&barriers);
+    defer { ::free(&barriers); };
+
+    array<VkImageCopy> regions;
+    ::init(&regions);
+    defer { ::free(&regions); };
+
+    // everything written before, including previous frames, has to be
+    // done before copying.
+    for_array(mv, moves)
+    {
+        if (mv->type != mg::memory_binding_type::Image)
+            continue;
+
+        mg::vk_image *img = mv->image;
+
+        ::add_at_end(&barriers, ::image_barrier(img, mv->old_image, img->layout, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                                                VK_ACCESS_MEMORY_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT));
+        ::add_at_end(&barriers, ::image_barrier(img, img->image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                                                0, VK_ACCESS_TRANSFER_WRITE_BIT));
+    }
+
+    VkMemoryBarrier mem_barrier{};
+    mem_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    mem_barrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+    mem_barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                         1, &mem_barrier, 0, nullptr, (u32)barriers.size, barriers.data);
+
+    for_array(mv, moves)
+    {
+        if (mv->type == mg::memory_binding_type::Buffer)
+        {
+            VkBufferCopy copyRegion{};
+            copyRegion.srcOffset = 0;
+            copyRegion.dstOffset = 0;
+            copyRegion.size = mv->buffer->size;
+
+            vkCmdCopyBuffer(cmd, mv->old_buffer, mv->buffer->buffer, 1, &copyRegion);
+            continue;
+        }
+
+        mg::vk_image *img = mv->image;
+        ::clear(&regions);
+
+        for (u32 level = 0; level < img->mipmap_levels; ++level)
+        {
+            VkImageCopy *region = ::add_at_end(&regions);
+            *region = VkImageCopy{};
+            region->srcSubresource.aspectMask = mg::get_image_aspect(img->format);
+            region->srcSubresource.mipLevel = level;
+            region->srcSubresource.baseArrayLayer = 0;
+            region->srcSubresource.layerCount = img->array_layers;
+            region->dstSubresource = region->srcSubresource;
+            region->extent.width  = Max(img->extent.width  >> level, 1u);
+            region->extent.height = Max(img->extent.height >> level, 1u);
+            region->extent.depth  = Max(img->extent.depth  >> level, 1u);
+        }
+
+        vkCmdCopyImage(cmd, mv->old_image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                            img->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                            (u32)regions.size, regions.data);
+    }
+
+    // moved images go back to the layout they were in
+    ::clear(&barriers);
+
+    for_array(mv, moves)
+    {
+        if (mv->type != mg::memory_binding_type::Image)
+            continue;
+
+        mg::vk_image *img = mv->image;
+
+        ::add_at_end(&barriers, ::image_barrier(img, img->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, img->layout,
+                                                VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT));
+    }
+
+    mem_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    mem_barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0,
+                         1, &mem_barrier, 0, nullptr, (u32)barriers.size, barriers.data);
+}
+
+void release_retired(mg::memory_manager *mgr, mg::defragment_retired *r)
+{
+    if (r->type == mg::memory_binding_type::Buffer)
+        vkDestroyBuffer(mgr->context->device, r->buffer, nullptr);
+    else
+        vkDestroyImage(mgr->context->device, r->image, nullptr);
+
+    mg::release_block(r->memory, r->memory_block);
+}
+
+void release_retired_resources(mg::memory_manager *mgr, bool all)
+{
+    mg::defragmenter *defrag = &mgr->defragmenter;
+    u64 frame = mgr->context->time_data.total_frame_count;
+    u64 count = 0;
+
+    // retired resources are ordered by frame
+    for_array(r, &defrag->retired)
+    {
+        if (!all && frame < r->frame + MAX_FRAMES_IN_FLIGHT)
+            break;
+
+        ::release_retired(mgr, r);
+        count++;
+    }
+
+    if (count > 0)
+        ::remove_elements(&defrag->retired, 0, count);
+
+    // the evacuated block is freed once nothing refers to it anymore
+    if (defrag->source != nullptr
+     && defrag->source->total_free_space == defrag->source->size)
+    {
+        trace("defragment: freeing memory %p\n", defrag->source->memory);
+        mg::free_memory(&mgr->allocator, defrag->source);
+        defrag->source = nullptr;
+    }
+}
+
+void mg::defragment(mg::memory_manager *mgr, VkCommandBuffer cmd)
+{
+    assert(mgr != nullptr);
+    assert(cmd != nullptr);
+
+    mg::defragmenter *defrag = &mgr->defragmenter;
+
+    ::release_retired_resources(mgr, false);
+
+    if (defrag->max_bytes_per_frame == 0)
+        return;
+
+    if (defrag->source == nullptr)
+        defrag->source = ::select_source(mgr);
+
+    mg::vk_memory *source = defrag->source;
+
+    if (source == nullptr)
+        return;
+
+    array<defragment_move> moves;
+    ::init(&moves);
+    defer { ::free(&moves); };
+
+    VkDeviceSize budget = defrag->max_bytes_per_frame;
+    VkDeviceSize moved = 0;
+    bool stuck = false;
+
+    if (mg::can_bind(source, mg::memory_binding_type::Buffer))
+    {
+        for_array(_buf, &mgr->buffers)
+        {
+            mg::vk_buffer *buf = *_buf;
+
+            if (buf->memory != source)
+                continue;
+
+            if (buf->size > budget - moved)
+                break;
+
+            VkDeviceSize sz = ::move_buffer(mgr, buf, &moves);
+
+            if (sz == 0)
+            {
+                stuck = true;
+                break;
+            }
+
+            moved += Min(sz, budget - moved);
+
+            if (defrag->buffer_moved != nullptr)
+                defrag->buffer_moved(buf, defrag->userdata);
+        }
+    }
+
+    if (!stuck && mg::can_bind(source, mg::memory_binding_type::Image))
+    {
+        for_array(_img, &mgr->images)
+        {
+            mg::vk_image *img = *_img;
+
+            if (img->memory != source)
+                continue;
+
+            VkMemoryRequirements reqs;
+            vkGetImageMemoryRequirements(mgr->context->device, img->image, &reqs);
+
+            if (reqs.size > budget - moved)
+                break;
+
+            VkDeviceSize sz = ::move_image(mgr, img, &moves);
+
+            if (sz == 0)
+            {
+                stuck = true;
+                break;
+            }
+
+            moved += Min(sz, budget - moved);
+
+            if (defrag->image_moved != nullptr)
+                defrag->image_moved(img, defrag->userdata);
+        }
+    }
+
+    // the rest doesn't fit anywhere, try another block next frame
+    if (stuck)
+        defrag->source = nullptr;
+
+    if (moves.size > 0)
+        ::record_moves(cmd, &moves);
+}
+
+void mg::release_all_retired_resources(mg::memory_manager *mgr)
+{
+    assert(mgr != nullptr);
+
+    ::release_retired_resources(mgr, true);
+}
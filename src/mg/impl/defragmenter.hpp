@@ -0,0 +1,70 @@
+#pragma once
+
+#include <vulkan/vulkan_core.h>
+
+#include "shl/array.hpp"
+#include "shl/number_types.hpp"
+
+#include "mg/impl/vk_buffer.hpp"
+#include "mg/impl/vk_image.hpp"
+#include "mg/impl/vk_memory.hpp"
+
+// incremental defragmentation of device local memory.
+// every frame, buffers and images are moved out of the sparsest memory
+// block into denser blocks of the same memory type until the block is
+// empty and can be freed. a move creates a new resource in the target block,
+// copies the contents inside the frame command buffer and swaps the handle
+// inside the vk_buffer / vk_image, so pointers to them stay valid.
+// the old handles are destroyed once the frame that copied them is done.
+//
+// descriptors and image views still refer to the old handles after a move,
+// which is what buffer_moved and image_moved are for. images are expected
+// to be in vk_image::layout, as with queued image uploads.
+namespace mg
+{
+struct memory_manager;
+
+constexpr const float DEFAULT_DEFRAGMENT_MAX_USAGE = 0.5f;
+
+struct defragment_retired
+{
+    mg::memory_binding_type type;
+    VkBuffer buffer;
+    VkImage image;
+
+    // old binding, released when retired
+    mg::vk_memory *memory;
+    u32 memory_block;
+
+    u64 frame;
+};
+
+struct defragmenter
+{
+    // 0 disables defragmentation
+    VkDeviceSize max_bytes_per_frame;
+
+    // only blocks that are used less than this are evacuated, 0 - 1
+    float max_usage;
+
+    // called after a resource was moved, e.g. to update descriptors
+    void (*buffer_moved)(mg::vk_buffer *buf, void *userdata);
+    void (*image_moved)(mg::vk_image *img, void *userdata);
+    void *userdata;
+
+    // internal things
+    mg::vk_memory *source; // block currently being evacuated
+    array<mg::defragment_retired> retired;
+};
+
+void init(mg::defragmenter *defrag);
+void free(mg::defragmenter *defrag);
+
+// releases resources that were moved in frames that are done on the GPU,
+// then records up to max_bytes_per_frame of copies into cmd.
+// cmd must be recording and outside of a render pass.
+void defragment(mg::memory_manager *mgr, VkCommandBuffer cmd);
+
+// releases all retired resources without checking if the GPU is done with them
+void release_all_retired_resources(mg::memory_manager *mgr);
+}
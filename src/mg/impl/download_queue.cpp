@@ -0,0 +1,236 @@
+
+#include <assert.h>
+
+#include "shl/debug.hpp"
+#include "shl/defer.hpp"
+#include "shl/memory.hpp"
+
+#include "mg/vk_error.hpp"
+#include "mg/impl/context.hpp"
+#include "mg/impl/download_queue.hpp"
+
+void mg::init(mg::download_queue *q)
+{
+    assert(q != nullptr);
+
+    ::init(&q->queued);
+    ::init(&q->recorded);
+}
+
+void destroy_download(mg::memory_manager *mgr, mg::download *dl)
+{
+    mg::destroy_sub_buffer(mgr, dl->staging);
+    ::free_memory(dl);
+}
+
+void mg::free(mg::download_queue *q, mg::memory_manager *mgr)
+{
+    assert(q != nullptr);
+    assert(mgr != nullptr);
+
+    for_array(dl, &q->queued)
+        ::destroy_download(mgr, *dl);
+
+    for_array(dl, &q->recorded)
+        ::destroy_download(mgr, *dl);
+
+    ::free(&q->queued);
+    ::free(&q->recorded);
+}
+
+mg::download *add_download(mg::download_queue *q, mg::memory_manager *mgr, VkDeviceSize size, mg::download_callback callback, void *userdata)
+{
+    mg::download *ret = ::allocate_memory<mg::download>();
+    ret->state = mg::download_state::Queued;
+    ret->source_buffer = nullptr;
+    ret->source_offset = 0;
+    ret->source_image = nullptr;
+    ret->region = VkBufferImageCopy{};
+    ret->staging = mg::get_new_staging_sub_buffer(mgr, size, VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+    ret->size = size;
+    ret->data = nullptr;
+    ret->frame = UINT32_MAX;
+    ret->released = false;
+    ret->callback = callback;
+    ret->userdata = userdata;
+
+    ::add_at_end(&q->queued, ret);
+
+    return ret;
+}
+
+mg::download *mg::add_buffer_download(mg::download_queue *q, mg::memory_manager *mgr, mg::vk_sub_buffer *src, VkDeviceSize offset, VkDeviceSize size, mg::download_callback callback, void *userdata)
+{
+    assert(q != nullptr);
+    assert(mgr != nullptr);
+    assert(src != nullptr);
+    assert(size > 0);
+    assert(offset + size <= src->range.size);
+
+    mg::download *ret = ::add_download(q, mgr, size, callback, userdata);
+    ret->type = mg::memory_binding_type::Buffer;
+    ret->source_buffer = src;
+    ret->source_offset = offset;
+
+    return ret;
+}
+
+mg::download *mg::add_image_download(mg::download_queue *q, mg::memory_manager *mgr, mg::vk_image *src, VkDeviceSize size, const VkBufferImageCopy *region, mg::download_callback callback, void *userdata)
+{
+    assert(q != nullptr);
+    assert(mgr != nullptr);
+    assert(src != nullptr);
+    assert(region != nullptr);
+    assert(size > 0);
+
+    mg::download *ret = ::add_download(q, mgr, size, callback, userdata);
+    ret->type = mg::memory_binding_type::Image;
+    ret->source_image = src;
+    ret->region = *region;
+
+    return ret;
+}
+
+void mg::record_downloads(mg::download_queue *q, VkCommandBuffer cmd, u32 frame)
+{
+    assert(q != nullptr);
+    assert(cmd != nullptr);
+
+    if (q->queued.size == 0)
+        return;
+
+    // the sources may have been written by anything recorded before
+    VkMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+    vkCmdPipelineBarrier(cmd,
+                         VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         0,
+                         1, &barrier,
+                         0, nullptr,
+                         0, nullptr);
+
+    for_array(pdl, &q->queued)
+    {
+        mg::download *dl = *pdl;
+        mg::vk_sub_buffer *staging = dl->staging;
+
+        if (dl->type == mg::memory_binding_type::Buffer)
+        {
+            VkBufferCopy region{};
+            region.srcOffset = dl->source_buffer->range.offset + dl->source_offset;
+            region.dstOffset = staging->range.offset;
+            region.size = dl->size;
+
+            vkCmdCopyBuffer(cmd, dl->source_buffer->buffer->buffer, staging->buffer->buffer, 1, &region);
+        }
+        else
+        {
+            VkBufferImageCopy region = dl->region;
+            region.bufferOffset += staging->range.offset;
+
+            vkCmdCopyImageToBuffer(cmd, dl->source_image->image, dl->source_image->layout, staging->buffer->buffer, 1, &region);
+        }
+
+        dl->state = mg::download_state::Recorded;
+        dl->frame = frame;
+        ::add_at_end(&q->recorded, dl);
+    }
+
+    ::clear(&q->queued);
+
+    // makes the copies visible to the host once the frame fence signals
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+
+    vkCmdPipelineBarrier(cmd,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_HOST_BIT,
+                         0,
+                         1, &barrier,
+                         0, nullptr,
+                         0, nullptr);
+}
+
+void mg::complete_downloads(mg::download_queue *q, mg::memory_manager *mgr, u32 frame)
+{
+    assert(q != nullptr);
+    assert(mgr != nullptr);
+
+    if (q->recorded.size == 0)
+        return;
+
+    array<mg::download*> done;
+    ::init(&done);
+    defer { ::free(&done); };
+
+    for (u64 i = 0; i < q->recorded.size;)
+    {
+        mg::download *dl = q->recorded[i];
+
+        if (dl->frame != frame)
+        {
+            ++i;
+            continue;
+        }
+
+        ::remove_elements(&q->recorded, i, 1);
+
+        if (dl->released)
+        {
+            ::destroy_download(mgr, dl);
+            continue;
+        }
+
+        mg::vk_sub_buffer *staging = dl->staging;
+        mg::queue_invalidate(mgr, staging->buffer->memory, mg::total_memory_offset(staging), dl->size);
+        ::add_at_end(&done, dl);
+    }
+
+    // non-coherent memory has to be invalidated before the host reads it
+    mg::invalidate_queued_ranges(mgr);
+
+    for_array(pdl, &done)
+    {
+        mg::download *dl = *pdl;
+        dl->state = mg::download_state::Ready;
+        dl->data = mg::get_mapped_pointer(dl->staging);
+
+        if (dl->callback != nullptr)
+            dl->callback(dl, dl->userdata);
+    }
+}
+
+bool mg::is_ready(const mg::download *dl)
+{
+    assert(dl != nullptr);
+
+    return dl->state == mg::download_state::Ready;
+}
+
+void mg::release_download(mg::download_queue *q, mg::memory_manager *mgr, mg::download *dl)
+{
+    assert(q != nullptr);
+    assert(mgr != nullptr);
+    assert(dl != nullptr);
+    assert(!dl->released);
+
+    if (dl->state == mg::download_state::Recorded)
+    {
+        dl->released = true;
+        return;
+    }
+
+    if (dl->state == mg::download_state::Queued)
+        for_array(i, pdl, &q->queued)
+            if (*pdl == dl)
+            {
+                ::remove_elements(&q->queued, i, 1);
+                break;
+            }
+
+    ::destroy_download(mgr, dl);
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <vulkan/vulkan_core.h>
+
+#include "shl/array.hpp"
+#include "shl/number_types.hpp"
+
+#include "mg/impl/memory_manager.hpp"
+#include "mg/impl/vk_buffer.hpp"
+#include "mg/impl/vk_image.hpp"
+
+// asynchronous GPU to CPU copies, e.g. for picking, compute results or
+// screenshots.
+// every download gets its own staging sub-buffer in host cached memory
+// (see memory_manager::staging_memory_flags). the copy is recorded at the
+// end of a frame, after everything the frame rendered, and the download
+// becomes ready once the fence of that frame has signalled. the data is
+// read straight from the mapped staging memory, it is not copied again.
+//
+// downloads are owned by the caller until they are released, either poll
+// is_ready or pass a callback which is called once the data is ready.
+namespace mg
+{
+struct download;
+
+typedef void (*download_callback)(mg::download *dl, void *userdata);
+
+enum class download_state : u8
+{
+    Queued,   // not recorded yet
+    Recorded, // recorded into the command buffer of frame
+    Ready     // data may be read
+};
+
+struct download
+{
+    mg::download_state state;
+    mg::memory_binding_type type;
+
+    // source, buffer or image depending on type
+    mg::vk_sub_buffer *source_buffer;
+    VkDeviceSize source_offset; // inside source_buffer
+    mg::vk_image *source_image;
+    VkBufferImageCopy region;   // bufferOffset is relative to staging
+
+    mg::vk_sub_buffer *staging;
+    VkDeviceSize size;
+    const void *data; // mapped staging memory, nullptr until ready
+
+    u32 frame;
+    // released while recorded, destroyed once the frame is done
+    bool released;
+
+    mg::download_callback callback;
+    void *userdata;
+};
+
+struct download_queue
+{
+    array<mg::download*> queued;
+    array<mg::download*> recorded;
+};
+
+void init(mg::download_queue *q);
+// destroys all downloads, including the ones that were not released.
+// the GPU must not be using any of them.
+void free(mg::download_queue *q, mg::memory_manager *mgr);
+
+mg::download *add_buffer_download(mg::download_queue *q, mg::memory_manager *mgr, mg::vk_sub_buffer *src, VkDeviceSize offset, VkDeviceSize size, mg::download_callback callback = nullptr, void *userdata = nullptr);
+// src must be in VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL or VK_IMAGE_LAYOUT_GENERAL
+// when the copy is executed. size is the size of the tightly packed data.
+mg::download *add_image_download(mg::download_queue *q, mg::memory_manager *mgr, mg::vk_image *src, VkDeviceSize size, const VkBufferImageCopy *region, mg::download_callback callback = nullptr, void *userdata = nullptr);
+
+// records the copies of all queued downloads into cmd, after a barrier
+// on everything recorded before. cmd must be outside of a render pass.
+void record_downloads(mg::download_queue *q, VkCommandBuffer cmd, u32 frame);
+// the fence of frame has signalled, makes its downloads ready and
+// calls their callbacks
+void complete_downloads(mg::download_queue *q, mg::memory_manager *mgr, u32 frame);
+
+bool is_ready(const mg::download *dl);
+// dl and its data must not be used afterwards
+void release_download(mg::download_queue *q, mg::memory_manager *mgr, mg::download *dl);
+}
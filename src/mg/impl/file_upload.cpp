@@ -0,0 +1,216 @@
+
+#include <assert.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "shl/error.hpp"
+#include "shl/memory.hpp"
+
+#include "mg/impl/file_upload.hpp"
+
+#if defined(_WIN32)
+u64 mapping_granularity()
+{
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (u64)info.dwAllocationGranularity;
+}
+
+void mg::map_file(mg::file_mapping *out, const char *path, u64 offset, u64 size)
+{
+    assert(out != nullptr);
+    assert(path != nullptr);
+
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+
+    if (file == INVALID_HANDLE_VALUE)
+        throw_error("could not open file %s", path);
+
+    LARGE_INTEGER file_size;
+
+    if (!GetFileSizeEx(file, &file_size))
+    {
+        CloseHandle(file);
+        throw_error("could not get size of file %s", path);
+    }
+
+    if (size == 0 && offset < (u64)file_size.QuadPart)
+        size = (u64)file_size.QuadPart - offset;
+
+    if (size == 0 || offset + size > (u64)file_size.QuadPart)
+    {
+        CloseHandle(file);
+        throw_error("range at offset %u with size %u is outside of file %s", offset, size, path);
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+
+    if (mapping == nullptr)
+    {
+        CloseHandle(file);
+        throw_error("could not map file %s", path);
+    }
+
+    u64 start = offset - (offset % ::mapping_granularity());
+    u64 map_size = offset + size - start;
+    void *base = MapViewOfFile(mapping, FILE_MAP_READ, (DWORD)(start >> 32), (DWORD)(start & 0xffffffff), (SIZE_T)map_size);
+
+    if (base == nullptr)
+    {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        throw_error("could not map view of file %s", path);
+    }
+
+    out->base = base;
+    out->map_size = map_size;
+    out->data = (const u8*)base + (offset - start);
+    out->size = size;
+    out->file = file;
+    out->mapping = mapping;
+}
+
+void mg::unmap_file(mg::file_mapping *mapping)
+{
+    assert(mapping != nullptr);
+
+    if (mapping->base == nullptr)
+        return;
+
+    UnmapViewOfFile(mapping->base);
+    CloseHandle((HANDLE)mapping->mapping);
+    CloseHandle((HANDLE)mapping->file);
+
+    mapping->base = nullptr;
+    mapping->data = nullptr;
+}
+
+void mg::discard_file_pages(mg::file_mapping *mapping, u64 size)
+{
+    // the working set of read-only file views is trimmed by the OS
+    (void)mapping;
+    (void)size;
+}
+#else
+void mg::map_file(mg::file_mapping *out, const char *path, u64 offset, u64 size)
+{
+    assert(out != nullptr);
+    assert(path != nullptr);
+
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0)
+        throw_error("could not open file %s", path);
+
+    struct stat st;
+
+    if (fstat(fd, &st) != 0)
+    {
+        close(fd);
+        throw_error("could not get size of file %s", path);
+    }
+
+    if (size == 0 && offset < (u64)st.st_size)
+        size = (u64)st.st_size - offset;
+
+    if (size == 0 || offset + size > (u64)st.st_size)
+    {
+        close(fd);
+        throw_error("range at offset %u with size %u is outside of file %s", offset, size, path);
+    }
+
+    u64 page_size = (u64)sysconf(_SC_PAGESIZE);
+    u64 start = offset - (offset % page_size);
+    u64 map_size = offset + size - start;
+    void *base = mmap(nullptr, map_size, PROT_READ, MAP_PRIVATE, fd, (off_t)start);
+
+    // the mapping keeps its own reference to the file
+    close(fd);
+
+    if (base == MAP_FAILED)
+        throw_error("could not map file %s", path);
+
+    madvise(base, map_size, MADV_SEQUENTIAL);
+
+    out->base = base;
+    out->map_size = map_size;
+    out->data = (const u8*)base + (offset - start);
+    out->size = size;
+}
+
+void mg::unmap_file(mg::file_mapping *mapping)
+{
+    assert(mapping != nullptr);
+
+    if (mapping->base == nullptr)
+        return;
+
+    munmap(mapping->base, mapping->map_size);
+
+    mapping->base = nullptr;
+    mapping->data = nullptr;
+}
+
+void mg::discard_file_pages(mg::file_mapping *mapping, u64 size)
+{
+    assert(mapping != nullptr);
+
+    u64 page_size = (u64)sysconf(_SC_PAGESIZE);
+    u64 end = (u64)(mapping->data - (const u8*)mapping->base) + size;
+    end -= end % page_size;
+
+    if (end > 0)
+        madvise(mapping->base, end, MADV_DONTNEED);
+}
+#endif
+
+mg::file_upload *mg::create_file_upload(mg::vk_sub_buffer *dest, const char *path, u64 offset, u64 size, mg::file_upload_callback callback, void *userdata)
+{
+    assert(dest != nullptr);
+    assert(path != nullptr);
+
+    mg::file_mapping mapping;
+    mg::map_file(&mapping, path, offset, size);
+
+    if (mapping.size > dest->range.size)
+    {
+        u64 mapped_size = mapping.size;
+        mg::unmap_file(&mapping);
+        throw_error("%u bytes of file %s do not fit into sub-buffer %p of size %u", mapped_size, path, dest, dest->range.size);
+    }
+
+    mg::file_upload *ret = ::allocate_memory<mg::file_upload>();
+    ret->destination = dest;
+    ret->mapping = mapping;
+    ret->queued = 0;
+    ret->value = 0;
+    ret->pending = false;
+    ret->done = false;
+    ret->released = false;
+    ret->callback = callback;
+    ret->userdata = userdata;
+
+    return ret;
+}
+
+void mg::destroy_file_upload(mg::file_upload *fu)
+{
+    assert(fu != nullptr);
+
+    mg::unmap_file(&fu->mapping);
+    ::free_memory(fu);
+}
+
+bool mg::is_done(const mg::file_upload *fu)
+{
+    assert(fu != nullptr);
+
+    return fu->done;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <vulkan/vulkan_core.h>
+
+#include "shl/number_types.hpp"
+
+#include "mg/impl/vk_buffer.hpp"
+
+// uploads straight from memory mapped files.
+// the file is mapped read-only and streamed into the staging ring in chunks
+// of at most vk_config::file_upload_chunk_size per update, so the data is
+// never read into a heap buffer first. chunks are limited to the size of the
+// ring and get smaller while the ring is full, a chunk that doesn't even fit
+// at MIN_FILE_UPLOAD_CHUNK_SIZE is staged in its own sub-buffer.
+// pages that were copied are handed back to the OS right away.
+namespace mg
+{
+constexpr const VkDeviceSize DEFAULT_FILE_UPLOAD_CHUNK_SIZE = 4194304ull;
+// chunks are halved down to this size while they don't fit into the ring
+constexpr const VkDeviceSize MIN_FILE_UPLOAD_CHUNK_SIZE = 65536ull;
+
+struct file_upload;
+
+typedef void (*file_upload_callback)(mg::file_upload *fu, void *userdata);
+
+struct file_mapping
+{
+    void *base;   // start of the mapping, aligned to the mapping granularity
+    u64 map_size; // size of the mapping from base
+    const u8 *data; // requested offset inside the file
+    u64 size;
+#if defined(_WIN32)
+    void *file;
+    void *mapping;
+#endif
+};
+
+struct file_upload
+{
+    mg::vk_sub_buffer *destination;
+    mg::file_mapping mapping;
+
+    VkDeviceSize queued; // bytes of mapping that were queued so far
+    // transfer timeline value of the submission of the last chunk
+    u64 value;
+    // a chunk was queued that has not been submitted yet
+    bool pending;
+    bool done;
+    bool released;
+
+    mg::file_upload_callback callback;
+    void *userdata;
+};
+
+// size 0 maps everything from offset to the end of the file
+void map_file(mg::file_mapping *out, const char *path, u64 offset, u64 size);
+void unmap_file(mg::file_mapping *mapping);
+// the pages of [0, size) of the mapping are not needed anymore
+void discard_file_pages(mg::file_mapping *mapping, u64 size);
+
+mg::file_upload *create_file_upload(mg::vk_sub_buffer *dest, const char *path, u64 offset, u64 size, mg::file_upload_callback callback, void *userdata);
+void destroy_file_upload(mg::file_upload *fu);
+
+bool is_done(const mg::file_upload *fu);
+}
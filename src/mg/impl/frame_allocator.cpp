@@ -0,0 +1,64 @@
+
+#include <assert.h>
+
+#include "shl/error.hpp"
+
+#include "mg/number_range.hpp"
+#include "mg/impl/context.hpp"
+#include "mg/impl/frame_allocator.hpp"
+
+void mg::init(mg::frame_allocator *alloc, mg::memory_manager *mgr, VkDeviceSize size, VkDeviceSize alignment, VkBufferUsageFlags usage)
+{
+    assert(alloc != nullptr);
+    assert(mgr != nullptr);
+    assert(size > 0);
+    assert(alignment > 0);
+
+    mg::vk_buffer *buf = mg::create_buffer(mgr, size, usage);
+    mg::auto_bind_host_coherent_buffer(mgr, buf);
+
+    u8 *mapped = (u8*)mg::map_memory(buf->memory, mgr->context->device);
+
+    alloc->buffer = buf;
+    alloc->data = mapped + buf->offset;
+    alloc->head = 0;
+    alloc->alignment = alignment;
+}
+
+void mg::free(mg::frame_allocator *alloc, mg::memory_manager *mgr)
+{
+    assert(alloc != nullptr);
+    assert(mgr != nullptr);
+
+    if (alloc->buffer == nullptr)
+        return;
+
+    mg::destroy_buffer(mgr, alloc->buffer);
+
+    alloc->buffer = nullptr;
+    alloc->data = nullptr;
+    alloc->head = 0;
+}
+
+mg::frame_allocation mg::allocate_frame_memory(mg::frame_allocator *alloc, VkDeviceSize size)
+{
+    assert(alloc != nullptr);
+    assert(alloc->buffer != nullptr);
+    assert(size > 0);
+
+    VkDeviceSize offset = mg::align_next(alloc->head, alloc->alignment);
+
+    if (offset > alloc->buffer->size || size > alloc->buffer->size - offset)
+        throw_error("frame allocator %p has no space left for %u bytes at offset %u", alloc, size, offset);
+
+    alloc->head = offset + size;
+
+    return mg::frame_allocation{alloc->buffer, offset, size, alloc->data + offset};
+}
+
+void mg::reset(mg::frame_allocator *alloc)
+{
+    assert(alloc != nullptr);
+
+    alloc->head = 0;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <vulkan/vulkan_core.h>
+
+#include "shl/number_types.hpp"
+
+#include "mg/impl/memory_manager.hpp"
+#include "mg/impl/vk_buffer.hpp"
+
+// linear allocator for transient data that only lives for one frame,
+// e.g. dynamic uniform buffers or streamed vertices.
+// the allocator owns a persistently mapped, host coherent buffer. allocating
+// only moves the head forward, everything is reclaimed at once with reset.
+namespace mg
+{
+constexpr const VkDeviceSize DEFAULT_FRAME_ALLOCATOR_SIZE = 4194304ull;
+
+struct frame_allocation
+{
+    mg::vk_buffer *buffer;
+    VkDeviceSize offset; // inside buffer, e.g. for dynamic offsets
+    VkDeviceSize size;
+    void *data;          // mapped, write directly
+};
+
+struct frame_allocator
+{
+    mg::vk_buffer *buffer;
+    u8 *data;
+
+    VkDeviceSize head;
+    VkDeviceSize alignment;
+};
+
+void init(mg::frame_allocator *alloc, mg::memory_manager *mgr, VkDeviceSize size, VkDeviceSize alignment, VkBufferUsageFlags usage);
+void free(mg::frame_allocator *alloc, mg::memory_manager *mgr);
+
+// throws if the allocator has no space left
+mg::frame_allocation allocate_frame_memory(mg::frame_allocator *alloc, VkDeviceSize size);
+void reset(mg::frame_allocator *alloc);
+}
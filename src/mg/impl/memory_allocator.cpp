@@ -1,7 +1,10 @@
 
 #include <assert.h>
 
+#include "shl/array.hpp"
+#include "shl/compare.hpp"
 #include "shl/debug.hpp"
+#include "shl/defer.hpp"
 
 #include "mg/vk_error.hpp"
 #include "mg/impl/context.hpp"
@@ -10,9 +13,11 @@
 void free_memory(mg::memory_allocator *alloc, u64 i, mg::vk_memory *mem)
 {
     vkFreeMemory(alloc->context->device, mem->memory, nullptr);
+    alloc->allocated_size[mem->type_index] -= mem->size;
     
     mg::free(mem);
     ::remove_elements(&alloc->allocated_memory, i, 1);
+    mg::release(&alloc->memory_slab, mem->handle);
 }
 
 void mg::init(mg::memory_allocator *alloc, mg::context *ctx)
@@ -25,7 +30,27 @@ void mg::init(mg::memory_allocator *alloc, mg::context *ctx)
     alloc->context = ctx;
     
     ::init(&alloc->allocated_memory);
+    mg::init(&alloc->memory_slab);
     vkGetPhysicalDeviceMemoryProperties(ctx->physical_device, &alloc->memory_properties);
+
+    alloc->release.spare_empty_blocks = mg::DEFAULT_SPARE_EMPTY_BLOCKS;
+    alloc->release.grace_frames = mg::DEFAULT_RELEASE_GRACE_FRAMES;
+
+    for (u32 i = 0; i < VK_MAX_MEMORY_TYPES; ++i)
+    {
+        alloc->allocated_size[i] = 0;
+        alloc->high_water_mark[i] = 0;
+    }
+    alloc->budget_extension = ctx->extensions.memory_budget;
+
+    for (u32 i = 0; i < VK_MAX_MEMORY_HEAPS; ++i)
+    {
+        alloc->heap_budget[i] = 0;
+        alloc->heap_usage[i] = 0;
+        alloc->heap_allocated_at_update[i] = 0;
+    }
+
+    mg::update_memory_budget(alloc);
 }
 
 // methods
@@ -59,13 +84,14 @@ mg::vk_memory *mg::allocate_memory(mg::memory_allocator *alloc, VkDeviceSize siz
     return allocate_memory_by_memory_type_index(alloc, size, binding_type, i);
 }
 
-mg::vk_memory *mg::allocate_memory_by_memory_type_index(mg::memory_allocator *alloc, VkDeviceSize size, mg::memory_binding_type binding_type, u32 index)
+mg::vk_memory *allocate_memory(mg::memory_allocator *alloc, VkDeviceSize size, mg::memory_binding_type binding_type, u32 index, const void *next)
 {
     assert(alloc != nullptr);
     assert(index != UINT32_MAX);
     
     VkMemoryAllocateInfo allocInfo{};
     allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.pNext = next;
     allocInfo.allocationSize = size;
     allocInfo.memoryTypeIndex = index;
     
@@ -76,17 +102,66 @@ mg::vk_memory *mg::allocate_memory_by_memory_type_index(mg::memory_allocator *al
         throw_vk_error(res, "%p failed to allocate memory", alloc);
     
     const auto flag_bits = alloc->memory_properties.memoryTypes[index].propertyFlags;
+
+    // host visible memory stays mapped for its whole lifetime,
+    // it is implicitly unmapped by vkFreeMemory.
+    void *mapped = nullptr;
+
+    if ((flag_bits & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) == VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+    {
+        res = vkMapMemory(alloc->context->device, vkmem, 0, VK_WHOLE_SIZE, 0, &mapped);
+
+        if (res != VK_SUCCESS)
+        {
+            vkFreeMemory(alloc->context->device, vkmem, nullptr);
+            throw_vk_error(res, "%p failed to map memory", alloc);
+        }
+    }
     
     // get the first already allocated memory of size > than current memory
     // and insert before it.
-    for_list(i, mem, &alloc->allocated_memory)
-        if (mem->size > size)
-            break;
+    u64 i = 0;
+
+    while (i < alloc->allocated_memory.size && alloc->allocated_memory[i]->size <= size)
+        ++i;
+
+    mg::slab_handle handle;
+    mg::vk_memory *ret = mg::allocate(&alloc->memory_slab, &handle);
+    mg::init(ret, vkmem, size, flag_bits, binding_type, index, Max(alloc->context->physical_device_properties.limits.bufferImageGranularity, (VkDeviceSize)1));
+    ret->mapped = mapped;
+    ret->handle = handle;
+
+    mg::vk_memory **at = ::insert_elements(&alloc->allocated_memory, i, 1);
+    *at = ret;
 
-    auto *node = ::insert_elements(&alloc->allocated_memory, i, 1);
-    mg::init(&node->value, vkmem, size, flag_bits, binding_type, index);
+    alloc->allocated_size[index] += size;
+
+    if (alloc->allocated_size[index] > alloc->high_water_mark[index])
+        alloc->high_water_mark[index] = alloc->allocated_size[index];
     
-    return &node->value;
+    return ret;
+}
+
+mg::vk_memory *mg::allocate_memory_by_memory_type_index(mg::memory_allocator *alloc, VkDeviceSize size, mg::memory_binding_type binding_type, u32 index)
+{
+    return ::allocate_memory(alloc, size, binding_type, index, nullptr);
+}
+
+mg::vk_memory *mg::allocate_dedicated_memory(mg::memory_allocator *alloc, VkDeviceSize size, u32 index, VkBuffer buffer, VkImage image)
+{
+    assert(alloc != nullptr);
+    assert((buffer == nullptr) != (image == nullptr));
+
+    VkMemoryDedicatedAllocateInfo dedicated{};
+    dedicated.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO;
+    dedicated.buffer = buffer;
+    dedicated.image = image;
+
+    mg::memory_binding_type binding_type = buffer != nullptr ? mg::memory_binding_type::Buffer : mg::memory_binding_type::Image;
+    mg::vk_memory *ret = ::allocate_memory(alloc, size, binding_type, index, &dedicated);
+    ret->dedicated = true;
+
+    return ret;
 }
 
 mg::vk_memory *mg::allocate_host_memory(mg::memory_allocator *alloc, VkDeviceSize size, mg::memory_binding_type binding_type, u32 filter)
@@ -117,25 +192,233 @@ void mg::free_memory(mg::memory_allocator *alloc, mg::vk_memory *mem)
 {
     assert(alloc != nullptr);
 
-    for_list(i, amem, &alloc->allocated_memory)
-        if (amem->memory == mem->memory)
+    for_array(i, amem, &alloc->allocated_memory)
+        if (*amem == mem)
         {
-            ::free_memory(alloc, i, amem);
+            ::free_memory(alloc, i, mem);
             break;
         }
 }
 
+void mg::free_memory(mg::memory_allocator *alloc, mg::slab_handle handle)
+{
+    assert(alloc != nullptr);
+
+    mg::vk_memory *mem = mg::get(&alloc->memory_slab, handle);
+
+    if (mem != nullptr)
+        mg::free_memory(alloc, mem);
+}
+
+u32 mg::find_host_visible_device_local_memory_type_index(mg::memory_allocator *alloc, u32 filter)
+{
+    assert(alloc != nullptr);
+
+    const VkPhysicalDeviceMemoryProperties *props = &alloc->memory_properties;
+    const VkMemoryPropertyFlags flags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+    VkDeviceSize largest_heap_size = 0;
+
+    for (u32 i = 0; i < props->memoryHeapCount; i++)
+        if ((props->memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)
+         && props->memoryHeaps[i].size > largest_heap_size)
+            largest_heap_size = props->memoryHeaps[i].size;
+
+    u32 ret = UINT32_MAX;
+
+    for (u32 i = 0; i < props->memoryTypeCount; i++)
+    {
+        const VkMemoryType *type = props->memoryTypes + i;
+
+        if ((filter & (1 << i)) == 0
+         || (type->propertyFlags & flags) != flags
+         || props->memoryHeaps[type->heapIndex].size < largest_heap_size)
+            continue;
+
+        // coherent memory needs no flushes
+        if (ret == UINT32_MAX
+         || (type->propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT))
+            ret = i;
+
+        if (type->propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)
+            break;
+    }
+
+    return ret;
+}
+
+mg::vk_memory *mg::get_memory(mg::memory_allocator *alloc, mg::slab_handle handle)
+{
+    assert(alloc != nullptr);
+
+    return mg::get(&alloc->memory_slab, handle);
+}
+
 void mg::free_all_memory(mg::memory_allocator *alloc)
 {
     assert(alloc != nullptr);
     assert(alloc->context != nullptr);
     
-    for_list(mem, &alloc->allocated_memory)
+    for_array(_mem, &alloc->allocated_memory)
+    {
+        mg::vk_memory *mem = *_mem;
         vkFreeMemory(alloc->context->device, mem->memory, nullptr);
+        alloc->allocated_size[mem->type_index] -= mem->size;
+        mg::free(mem);
+        mg::release(&alloc->memory_slab, mem->handle);
+    }
     
     ::clear(&alloc->allocated_memory);
 }
 
+// returns the number of empty blocks of each memory type in empty_counts
+void update_empty_memory(mg::memory_allocator *alloc, u64 frame, u32 *empty_counts)
+{
+    for_array(_mem, &alloc->allocated_memory)
+    {
+        mg::vk_memory *mem = *_mem;
+
+        if (mem->total_free_space != mem->size)
+        {
+            mem->empty_since_frame = mg::MEMORY_NOT_EMPTY;
+            continue;
+        }
+
+        if (mem->empty_since_frame == mg::MEMORY_NOT_EMPTY)
+            mem->empty_since_frame = frame;
+
+        if (!mem->dedicated)
+            empty_counts[mem->type_index]++;
+    }
+}
+
+void mg::release_empty_memory(mg::memory_allocator *alloc)
+{
+    assert(alloc != nullptr);
+    assert(alloc->context != nullptr);
+
+    u64 frame = alloc->context->time_data.total_frame_count;
+    u32 empty_counts[VK_MAX_MEMORY_TYPES] = {};
+
+    ::update_empty_memory(alloc, frame, empty_counts);
+
+    array<mg::vk_memory*> to_release;
+    ::init(&to_release);
+    defer { ::free(&to_release); };
+
+    for_array(_mem, &alloc->allocated_memory)
+    {
+        mg::vk_memory *mem = *_mem;
+
+        if (mem->empty_since_frame == mg::MEMORY_NOT_EMPTY
+         || frame - mem->empty_since_frame < alloc->release.grace_frames)
+            continue;
+
+        // nothing else is ever bound to dedicated memory, no point in keeping it
+        if (!mem->dedicated)
+        {
+            if (empty_counts[mem->type_index] <= alloc->release.spare_empty_blocks)
+                continue;
+
+            empty_counts[mem->type_index]--;
+        }
+
+        ::add_at_end(&to_release, mem);
+    }
+
+    for_array(mem, &to_release)
+    {
+        trace("releasing empty memory %p: %u bytes, index %u\n", (*mem)->memory, (*mem)->size, (*mem)->type_index);
+        mg::free_memory(alloc, *mem);
+    }
+}
+
+VkDeviceSize heap_allocated_size(mg::memory_allocator *alloc, u32 heap_index)
+{
+    VkDeviceSize ret = 0;
+
+    for (u32 i = 0; i < alloc->memory_properties.memoryTypeCount; ++i)
+        if (alloc->memory_properties.memoryTypes[i].heapIndex == heap_index)
+            ret += alloc->allocated_size[i];
+
+    return ret;
+}
+
+void mg::update_memory_budget(mg::memory_allocator *alloc)
+{
+    assert(alloc != nullptr);
+
+    if (!alloc->budget_extension)
+        return;
+
+    VkPhysicalDeviceMemoryBudgetPropertiesEXT budget{};
+    budget.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+
+    VkPhysicalDeviceMemoryProperties2 props{};
+    props.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
+    props.pNext = &budget;
+
+    vkGetPhysicalDeviceMemoryProperties2(alloc->context->physical_device, &props);
+
+    for (u32 i = 0; i < alloc->memory_properties.memoryHeapCount; ++i)
+    {
+        alloc->heap_budget[i] = budget.heapBudget[i];
+        alloc->heap_usage[i] = budget.heapUsage[i];
+        alloc->heap_allocated_at_update[i] = ::heap_allocated_size(alloc, i);
+    }
+}
+
+mg::memory_heap_stats mg::get_memory_heap_stats(mg::memory_allocator *alloc, u32 heap_index)
+{
+    assert(alloc != nullptr);
+    assert(heap_index < alloc->memory_properties.memoryHeapCount);
+
+    mg::memory_heap_stats ret;
+    ret.size = alloc->memory_properties.memoryHeaps[heap_index].size;
+    ret.allocated = ::heap_allocated_size(alloc, heap_index);
+
+    if (!alloc->budget_extension)
+    {
+        ret.budget = (VkDeviceSize)(ret.size * mg::DEFAULT_HEAP_BUDGET_FRACTION);
+        ret.usage = ret.allocated;
+        return ret;
+    }
+
+    VkDeviceSize at_update = alloc->heap_allocated_at_update[heap_index];
+    ret.budget = alloc->heap_budget[heap_index];
+    ret.usage = alloc->heap_usage[heap_index];
+
+    if (ret.allocated >= at_update)
+        ret.usage += ret.allocated - at_update;
+    else if (ret.usage > at_update - ret.allocated)
+        ret.usage -= at_update - ret.allocated;
+    else
+        ret.usage = 0;
+
+    return ret;
+}
+
+void mg::get_memory_stats(mg::memory_allocator *alloc, mg::memory_stats *out)
+{
+    assert(alloc != nullptr);
+    assert(out != nullptr);
+
+    out->heap_count = alloc->memory_properties.memoryHeapCount;
+
+    for (u32 i = 0; i < out->heap_count; ++i)
+        out->heaps[i] = mg::get_memory_heap_stats(alloc, i);
+}
+
+bool mg::would_exceed_budget(mg::memory_allocator *alloc, u32 memory_type_index, VkDeviceSize size)
+{
+    assert(alloc != nullptr);
+    assert(memory_type_index < alloc->memory_properties.memoryTypeCount);
+
+    u32 heap = alloc->memory_properties.memoryTypes[memory_type_index].heapIndex;
+    mg::memory_heap_stats stats = mg::get_memory_heap_stats(alloc, heap);
+
+    return stats.usage + size > stats.budget;
+}
+
 void mg::free(mg::memory_allocator *alloc)
 {
     assert(alloc != nullptr);
@@ -143,6 +426,7 @@ void mg::free(mg::memory_allocator *alloc)
     mg::free_all_memory(alloc);
 
     ::free(&alloc->allocated_memory);
+    mg::free(&alloc->memory_slab);
     alloc->context = nullptr;
 }
 
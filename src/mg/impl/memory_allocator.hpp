@@ -4,32 +4,101 @@
 #include <vulkan/vulkan_core.h>
 
 #include "shl/number_types.hpp"
-#include "shl/linked_list.hpp"
+#include "shl/array.hpp"
+#include "mg/impl/slab.hpp"
 #include "mg/impl/vk_memory.hpp"
 
 namespace mg
 {
-typedef linked_list<vk_memory> memory_list;
+// allocated memory, sorted by size
+typedef array<mg::vk_memory*> memory_list;
+
+constexpr const u32 DEFAULT_SPARE_EMPTY_BLOCKS = 1;
+
+// part of a heap that is used as budget without VK_EXT_memory_budget
+constexpr const float DEFAULT_HEAP_BUDGET_FRACTION = 0.8f;
+
+struct memory_heap_stats
+{
+    VkDeviceSize size;
+    VkDeviceSize budget;    // how much the process should use at most
+    VkDeviceSize usage;     // how much the process uses, including other allocators
+    VkDeviceSize allocated; // how much was allocated by this allocator
+};
+
+struct memory_stats
+{
+    u32 heap_count;
+    mg::memory_heap_stats heaps[VK_MAX_MEMORY_HEAPS];
+};
+constexpr const u32 DEFAULT_RELEASE_GRACE_FRAMES = 60;
 
 struct memory_allocator
 {
     mg::memory_list allocated_memory;
+    mg::slab<mg::vk_memory> memory_slab; // storage of allocated_memory
     mg::context *context;
     VkPhysicalDeviceMemoryProperties memory_properties;
+
+    // when empty memory is freed, see release_empty_memory
+    struct _release
+    {
+        u32 spare_empty_blocks; // per memory type, kept allocated for reuse
+        u32 grace_frames;       // frames memory has to stay empty before it is freed
+    } release;
+
+    // bytes allocated per memory type index, and the most that
+    // was ever allocated at once.
+    VkDeviceSize allocated_size[VK_MAX_MEMORY_TYPES];
+    VkDeviceSize high_water_mark[VK_MAX_MEMORY_TYPES];
+
+    // VK_EXT_memory_budget values as of the last update_memory_budget, if
+    // the extension is available. usage in between is estimated from
+    // the memory allocated since then.
+    bool budget_extension;
+    VkDeviceSize heap_budget[VK_MAX_MEMORY_HEAPS];
+    VkDeviceSize heap_usage[VK_MAX_MEMORY_HEAPS];
+    VkDeviceSize heap_allocated_at_update[VK_MAX_MEMORY_HEAPS];
 };
 
 void init(mg::memory_allocator *alloc, mg::context *ctx);
 u32 find_memory_type_index(mg::memory_allocator *alloc, VkMemoryPropertyFlags flags, u32 filter = UINT32_MAX);
 u32 find_exact_memory_type_index(mg::memory_allocator *alloc, VkMemoryPropertyFlags flags, u32 filter = UINT32_MAX);
+// device local memory type the host can write to directly, e.g. on integrated
+// GPUs or with resizable BAR. only types on the largest device local heap
+// count, not the small host visible window of discrete GPUs without
+// resizable BAR. UINT32_MAX if there is none.
+u32 find_host_visible_device_local_memory_type_index(mg::memory_allocator *alloc, u32 filter = UINT32_MAX);
+
+// nullptr if the memory of the handle was freed
+mg::vk_memory *get_memory(mg::memory_allocator *alloc, mg::slab_handle handle);
 
 mg::vk_memory *allocate_memory(mg::memory_allocator *alloc, VkDeviceSize size, VkMemoryPropertyFlags flag_requirements, mg::memory_binding_type binding_type, u32 filter = UINT32_MAX);
 mg::vk_memory *allocate_memory_by_memory_type_index(mg::memory_allocator *alloc, VkDeviceSize size, mg::memory_binding_type binding_type, u32 memory_type_index);
+// memory for exactly one buffer or image (VkMemoryDedicatedAllocateInfo),
+// one of buffer and image must be nullptr.
+mg::vk_memory *allocate_dedicated_memory(mg::memory_allocator *alloc, VkDeviceSize size, u32 memory_type_index, VkBuffer buffer, VkImage image);
 mg::vk_memory *allocate_host_memory(mg::memory_allocator *alloc, VkDeviceSize size, mg::memory_binding_type binding_type, u32 filter = UINT32_MAX); // CPU visible memory
 mg::vk_memory *allocate_host_coherent_memory(mg::memory_allocator *alloc, VkDeviceSize size, mg::memory_binding_type binding_type, u32 filter = UINT32_MAX);
 mg::vk_memory *allocate_local_memory(mg::memory_allocator *alloc, VkDeviceSize size, mg::memory_binding_type binding_type, u32 filter = UINT32_MAX); // GPU memory
 
 void free_memory(mg::memory_allocator *alloc, vk_memory *mem);
+void free_memory(mg::memory_allocator *alloc, mg::slab_handle handle);
 void free_all_memory(mg::memory_allocator *alloc);
 
+// frees memory that has been empty for at least release.grace_frames frames,
+// keeping up to release.spare_empty_blocks empty blocks per memory type.
+// is called automatically once per frame in start_rendering.
+void release_empty_memory(mg::memory_allocator *alloc);
+
+// budget
+// is called automatically once per frame in start_rendering.
+void update_memory_budget(mg::memory_allocator *alloc);
+void get_memory_stats(mg::memory_allocator *alloc, mg::memory_stats *out);
+mg::memory_heap_stats get_memory_heap_stats(mg::memory_allocator *alloc, u32 heap_index);
+
+// true if allocating size bytes of the memory type would exceed the budget of its heap
+bool would_exceed_budget(mg::memory_allocator *alloc, u32 memory_type_index, VkDeviceSize size);
+
 void free(mg::memory_allocator *alloc);
 }
@@ -3,9 +3,11 @@
 
 #include "shl/compare.hpp"
 #include "shl/debug.hpp"
+#include "shl/memory.hpp"
 #include "shl/number_types.hpp"
 
 #include "mg/vk_error.hpp"
+#include "mg/impl/bit_scan.hpp"
 #include "mg/impl/context.hpp"
 #include "mg/impl/memory_manager.hpp"
 
@@ -19,60 +21,286 @@ void mg::init(mg::memory_manager *mgr, mg::context *ctx)
     mg::init(&mgr->allocator, ctx);
     ::init(&mgr->buffers);
     ::init(&mgr->images);
+    ::init(&mgr->buckets);
+    mg::init(&mgr->buffer_slab);
+    mg::init(&mgr->image_slab);
+    mg::init(&mgr->sub_buffer_slab);
 
     mgr->min_allocation_size = mg::DEFAULT_MIN_ALLOC_SIZE;
+    mgr->dedicated_allocation_size = mg::DEFAULT_DEDICATED_ALLOCATION_SIZE;
+    mgr->mixed_blocks = true;
+    mgr->sub_buffer_mode = mg::sub_buffer_allocation_mode::Linear;
+
+    mgr->pools.small_max_size = mg::DEFAULT_SMALL_POOL_MAX_SIZE;
+    mgr->pools.small_buffer_size = mg::DEFAULT_SMALL_POOL_BUFFER_SIZE;
+    mgr->pools.medium_max_size = mg::DEFAULT_MEDIUM_POOL_MAX_SIZE;
+    mgr->pools.medium_buffer_size = mg::DEFAULT_MEDIUM_POOL_BUFFER_SIZE;
+    mgr->pools.large_max_size = mg::DEFAULT_LARGE_POOL_MAX_SIZE;
+    mgr->pools.large_buffer_size = mg::DEFAULT_LARGE_POOL_BUFFER_SIZE;
+
+    const VkMemoryPropertyFlags cached = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+
+    if (mg::find_memory_type_index(&mgr->allocator, cached) != UINT32_MAX)
+        mgr->staging_memory_flags = cached;
+    else
+        mgr->staging_memory_flags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+
+    u32 upload_index = mg::find_host_visible_device_local_memory_type_index(&mgr->allocator);
+
+    if (upload_index != UINT32_MAX)
+        mgr->upload_memory_flags = mgr->allocator.memory_properties.memoryTypes[upload_index].propertyFlags
+                                 & (VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    else
+        mgr->upload_memory_flags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+
+    mgr->non_coherent_atom_size = Max(ctx->physical_device_properties.limits.nonCoherentAtomSize, (VkDeviceSize)1);
+    ::init(&mgr->flush_ranges);
+    ::init(&mgr->invalidate_ranges);
+
+    mg::init(&mgr->defragmenter);
 }
 
 void mg::free(mg::memory_manager *mgr)
 {
+    mg::release_all_retired_resources(mgr);
+    mg::free(&mgr->defragmenter);
+
     mg::destroy_all_buffers(mgr);
     mg::destroy_all_images(mgr);
 
+    for_array(bucket, &mgr->buckets)
+        for (u32 i = 0; i < mg::BUCKET_BIN_COUNT; ++i)
+            ::free(bucket->bins + i);
+
+    ::free(&mgr->buckets);
+    ::free(&mgr->buffers);
+    ::free(&mgr->images);
+    mg::free(&mgr->buffer_slab);
+    mg::free(&mgr->image_slab);
+    mg::free(&mgr->sub_buffer_slab);
+
+    ::free(&mgr->flush_ranges);
+    ::free(&mgr->invalidate_ranges);
+
     mg::free(&mgr->allocator);
     mgr->context = nullptr;
 }
 
-mg::vk_sub_buffer *mg::get_new_sub_buffer(mg::memory_manager *mgr, VkDeviceSize size, VkBufferUsageFlags usage, VkSharingMode sharemode)
+mg::buffer_pool mg::get_buffer_pool(mg::memory_manager *mgr, VkDeviceSize size)
 {
-    mg::vk_buffer *buf = nullptr;
+    assert(mgr != nullptr);
 
-    for_list(tmp, &mgr->buffers)
-        if ((tmp->usage & usage) == usage
-          && tmp->sharemode == sharemode
-          && mg::has_space_for(tmp, size))
-        {
-            buf = tmp;
-            break;
-        }
+    if (size <= mgr->pools.small_max_size)
+        return mg::buffer_pool::Small;
 
-    if (buf == nullptr)
-        buf = mg::create_buffer(mgr, AUTO_SIZE, usage, sharemode);
+    if (size <= mgr->pools.medium_max_size)
+        return mg::buffer_pool::Medium;
 
-    return mg::create_sub_buffer(buf, size);
+    if (size <= mgr->pools.large_max_size)
+        return mg::buffer_pool::Large;
+
+    return mg::buffer_pool::Dedicated;
 }
 
-mg::vk_sub_buffer *mg::get_new_bound_sub_buffer(mg::memory_manager *mgr, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags memflags, VkSharingMode sharemode)
+VkDeviceSize mg::get_sub_buffer_alignment(mg::memory_manager *mgr, VkBufferUsageFlags usage)
 {
+    assert(mgr != nullptr);
+
+    const VkPhysicalDeviceLimits *limits = &mgr->context->physical_device_properties.limits;
+    VkDeviceSize ret = 1;
+
+    if (usage & VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT)
+        ret = Max(ret, limits->minUniformBufferOffsetAlignment);
+
+    if (usage & VK_BUFFER_USAGE_STORAGE_BUFFER_BIT)
+        ret = Max(ret, limits->minStorageBufferOffsetAlignment);
+
+    if (usage & (VK_BUFFER_USAGE_UNIFORM_TEXEL_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_TEXEL_BUFFER_BIT))
+        ret = Max(ret, limits->minTexelBufferOffsetAlignment);
+
+    return ret;
+}
+
+VkDeviceSize pool_buffer_size(mg::memory_manager *mgr, mg::buffer_pool pool, VkDeviceSize size)
+{
+    switch (pool)
+    {
+    case mg::buffer_pool::Small:  return mgr->pools.small_buffer_size;
+    case mg::buffer_pool::Medium: return mgr->pools.medium_buffer_size;
+    case mg::buffer_pool::Large:  return mgr->pools.large_buffer_size;
+    default:                      return size;
+    }
+}
+
+u32 get_bucket(mg::memory_manager *mgr, VkBufferUsageFlags usage, VkSharingMode sharemode, VkMemoryPropertyFlags memflags, mg::buffer_pool pool)
+{
+    for_array(i, bucket, &mgr->buckets)
+        if (bucket->usage == usage
+         && bucket->sharemode == sharemode
+         && bucket->memflags == memflags
+         && bucket->pool == pool)
+            return (u32)i;
+
+    mg::buffer_bucket *bucket = ::add_at_end(&mgr->buckets);
+    bucket->usage = usage;
+    bucket->sharemode = sharemode;
+    bucket->memflags = memflags;
+    bucket->pool = pool;
+    bucket->bin_bitmap = 0;
+
+    for (u32 i = 0; i < mg::BUCKET_BIN_COUNT; ++i)
+        ::init(bucket->bins + i);
+
+    return (u32)(mgr->buckets.size - 1);
+}
+
+inline VkDeviceSize bucket_free_space(const mg::vk_buffer *buf)
+{
+    return buf->largest_contiguous_free_space.size;
+}
+
+inline u32 bucket_bin(VkDeviceSize free_space)
+{
+    if (free_space == 0)
+        return 0;
+
+    return ::bit_scan_reverse(free_space) + 1;
+}
+
+void add_to_bin(mg::buffer_bucket *bucket, mg::vk_buffer *buf, u32 bin)
+{
+    array<mg::vk_buffer*> *buffers = bucket->bins + bin;
+
+    buf->bucket_bin = bin;
+    buf->bucket_index = (u32)buffers->size;
+    ::add_at_end(buffers, buf);
+
+    if (bin > 0)
+        bucket->bin_bitmap |= 1ull << (bin - 1);
+}
+
+void remove_from_bin(mg::buffer_bucket *bucket, mg::vk_buffer *buf)
+{
+    array<mg::vk_buffer*> *buffers = bucket->bins + buf->bucket_bin;
+
+    // swap with the last buffer to remove in O(1)
+    mg::vk_buffer *last = buffers->data[buffers->size - 1];
+    last->bucket_index = buf->bucket_index;
+    buffers->data[buf->bucket_index] = last;
+    buffers->size -= 1;
+
+    if (buffers->size == 0 && buf->bucket_bin > 0)
+        bucket->bin_bitmap &= ~(1ull << (buf->bucket_bin - 1));
+}
+
+// good fit: the last buffer of the bin of size if it happens to fit,
+// otherwise a buffer of the lowest bin above, all of which fit size
+// even with the most padding alignment can need.
+mg::vk_buffer *find_in_bucket(mg::buffer_bucket *bucket, VkDeviceSize size, VkDeviceSize alignment)
+{
+    array<mg::vk_buffer*> *buffers = bucket->bins + ::bucket_bin(size);
+
+    if (buffers->size > 0 && mg::has_space_for(buffers->data[buffers->size - 1], size, alignment))
+        return buffers->data[buffers->size - 1];
+
+    u32 bin = ::bucket_bin(size + alignment - 1);
+
+    if (bin >= 64)
+        return nullptr;
+
+    u64 bins = bucket->bin_bitmap & (~0ull << bin);
+
+    if (bins == 0)
+        return nullptr;
+
+    buffers = bucket->bins + ::bit_scan_forward(bins) + 1;
+    mg::vk_buffer *ret = buffers->data[buffers->size - 1];
+
+    assert(mg::has_space_for(ret, size, alignment));
+    return ret;
+}
+
+// moves buf to the bin of its free space after the free space changed
+void update_bucket_position(mg::memory_manager *mgr, mg::vk_buffer *buf)
+{
+    if (buf->bucket == UINT32_MAX)
+        return;
+
+    u32 bin = ::bucket_bin(::bucket_free_space(buf));
+
+    if (bin == buf->bucket_bin)
+        return;
+
+    mg::buffer_bucket *bucket = mgr->buckets.data + buf->bucket;
+    ::remove_from_bin(bucket, buf);
+    ::add_to_bin(bucket, buf, bin);
+}
+
+void add_to_bucket(mg::memory_manager *mgr, mg::vk_buffer *buf, u32 bucket_index)
+{
+    buf->bucket = bucket_index;
+    ::add_to_bin(mgr->buckets.data + bucket_index, buf, ::bucket_bin(::bucket_free_space(buf)));
+}
+
+void remove_from_bucket(mg::memory_manager *mgr, mg::vk_buffer *buf)
+{
+    if (buf->bucket == UINT32_MAX)
+        return;
+
+    ::remove_from_bin(mgr->buckets.data + buf->bucket, buf);
+
+    buf->bucket = UINT32_MAX;
+    buf->bucket_bin = UINT32_MAX;
+    buf->bucket_index = UINT32_MAX;
+}
+
+// if bind is true, only buffers bound to memory with memflags are considered
+// and new buffers are bound to such memory.
+mg::vk_sub_buffer *get_new_pooled_sub_buffer(mg::memory_manager *mgr, VkDeviceSize size, VkBufferUsageFlags usage, bool bind, VkMemoryPropertyFlags memflags, VkSharingMode sharemode)
+{
+    assert(mgr != nullptr);
+    assert(size > 0);
+
+    mg::buffer_pool pool = mg::get_buffer_pool(mgr, size);
+    VkDeviceSize alignment = mg::get_sub_buffer_alignment(mgr, usage);
     mg::vk_buffer *buf = nullptr;
+    u32 bucket = UINT32_MAX;
 
-    for_list(tmp, &mgr->buffers)
-        if ((tmp->usage & usage) == usage
-         && tmp->sharemode == sharemode
-         && tmp->memory != nullptr
-         && (tmp->memory->type & memflags) == memflags
-         && mg::has_space_for(tmp, size))
-        {
-            buf = tmp;
-            break;
-        }
+    if (pool != mg::buffer_pool::Dedicated)
+    {
+        bucket = ::get_bucket(mgr, usage, sharemode, bind ? memflags : 0, pool);
+        buf = ::find_in_bucket(mgr->buckets.data + bucket, size, alignment);
+    }
 
     if (buf == nullptr)
     {
-        buf = mg::create_buffer(mgr, AUTO_SIZE, usage, sharemode);
-        mg::auto_bind_buffer(mgr, buf, memflags);
+        buf = mg::create_buffer(mgr, ::pool_buffer_size(mgr, pool, size), usage, sharemode);
+        buf->pool = pool;
+
+        if (bind)
+            mg::auto_bind_buffer(mgr, buf, memflags);
+
+        if (bucket != UINT32_MAX)
+            ::add_to_bucket(mgr, buf, bucket);
     }
 
-    return mg::create_sub_buffer(buf, size);
+    mg::vk_sub_buffer *ret = mg::create_sub_buffer(buf, size, alignment);
+    ::update_bucket_position(mgr, buf);
+
+    mg::vk_sub_buffer **slot = mg::allocate(&mgr->sub_buffer_slab, &ret->handle);
+    *slot = ret;
+
+    return ret;
+}
+
+mg::vk_sub_buffer *mg::get_new_sub_buffer(mg::memory_manager *mgr, VkDeviceSize size, VkBufferUsageFlags usage, VkSharingMode sharemode)
+{
+    return ::get_new_pooled_sub_buffer(mgr, size, usage, false, 0, sharemode);
+}
+
+mg::vk_sub_buffer *mg::get_new_bound_sub_buffer(mg::memory_manager *mgr, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags memflags, VkSharingMode sharemode)
+{
+    return ::get_new_pooled_sub_buffer(mgr, size, usage, true, memflags, sharemode);
 }
 
 mg::vk_sub_buffer *mg::get_new_device_local_sub_buffer(mg::memory_manager *mgr, VkDeviceSize size, VkBufferUsageFlags usage, VkSharingMode sharemode)
@@ -90,6 +318,42 @@ mg::vk_sub_buffer *mg::get_new_host_coherent_sub_buffer(mg::memory_manager *mgr,
     return mg::get_new_bound_sub_buffer(mgr, size, usage, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, sharemode);
 }
 
+mg::vk_sub_buffer *mg::get_new_staging_sub_buffer(mg::memory_manager *mgr, VkDeviceSize size, VkBufferUsageFlags usage, VkSharingMode sharemode)
+{
+    return mg::get_new_bound_sub_buffer(mgr, size, usage, mgr->staging_memory_flags, sharemode);
+}
+
+mg::vk_sub_buffer *mg::get_new_upload_sub_buffer(mg::memory_manager *mgr, VkDeviceSize size, VkBufferUsageFlags usage, VkSharingMode sharemode)
+{
+    return mg::get_new_bound_sub_buffer(mgr, size, usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT, mgr->upload_memory_flags, sharemode);
+}
+
+mg::vk_sub_buffer *mg::get_sub_buffer(mg::memory_manager *mgr, mg::slab_handle handle)
+{
+    assert(mgr != nullptr);
+
+    mg::vk_sub_buffer **slot = mg::get(&mgr->sub_buffer_slab, handle);
+
+    if (slot == nullptr)
+        return nullptr;
+
+    return *slot;
+}
+
+mg::vk_buffer *mg::get_buffer(mg::memory_manager *mgr, mg::slab_handle handle)
+{
+    assert(mgr != nullptr);
+
+    return mg::get(&mgr->buffer_slab, handle);
+}
+
+mg::vk_image *mg::get_image(mg::memory_manager *mgr, mg::slab_handle handle)
+{
+    assert(mgr != nullptr);
+
+    return mg::get(&mgr->image_slab, handle);
+}
+
 mg::vk_buffer *mg::create_buffer(mg::memory_manager *mgr, VkDeviceSize size, VkBufferUsageFlags usage, VkSharingMode sharemode)
 {
     assert(mgr != nullptr);
@@ -109,9 +373,13 @@ mg::vk_buffer *mg::create_buffer(mg::memory_manager *mgr, VkDeviceSize size, VkB
     if (res != VK_SUCCESS)
         throw_vk_error(res, "%p could not create buffer", mgr);
     
-    auto node = ::add_at_end(&mgr->buffers);
-    mg::vk_buffer *ret = &node->value;
-    mg::init(ret, buf, size, 0, usage, sharemode);
+    mg::slab_handle handle;
+    mg::vk_buffer *ret = mg::allocate(&mgr->buffer_slab, &handle);
+    mg::init(ret, buf, size, 0, usage, sharemode, mgr->sub_buffer_mode);
+
+    ret->handle = handle;
+    ret->index = (u32)mgr->buffers.size;
+    ::add_at_end(&mgr->buffers, ret);
 
     return ret;
 }
@@ -136,36 +404,160 @@ mg::vk_buffer *mg::create_vertex_buffer(mg::memory_manager *mgr, VkDeviceSize si
     return mg::create_buffer(mgr, size, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | additional_flags, sharemode);
 }
 
-void mg::auto_bind_buffer(mg::memory_manager *mgr, mg::vk_buffer *buf, VkMemoryPropertyFlags flags)
+mg::vk_memory *find_bindable_memory(mg::memory_manager *mgr, u32 memtypeindex, VkMemoryRequirements *reqs, mg::memory_binding_type binding_type, mg::memory_resource_kind kind)
 {
-    assert(mgr != nullptr);
-    assert(buf != nullptr);
-    assert(buf->buffer != nullptr);
-    assert(buf->memory == nullptr);
-    
-    VkMemoryRequirements reqs;
-    vkGetBufferMemoryRequirements(mgr->context->device, buf->buffer, &reqs);
-    
-    u32 memtypeindex = mg::find_memory_type_index(&mgr->allocator, flags, reqs.memoryTypeBits);
     mg::vk_memory *memory = nullptr;
     
-    for_list(_mem, &mgr->allocator.allocated_memory)
+    for_array(it, &mgr->allocator.allocated_memory)
     {
+        mg::vk_memory *_mem = *it;
+
         if (_mem->type_index != memtypeindex
-         || _mem->binding_type != mg::memory_binding_type::Buffer
-         || !mg::has_space_for(_mem, reqs.size, reqs.alignment))
+         || !mg::can_bind(_mem, binding_type)
+         || _mem->dedicated
+         || _mem == mgr->defragmenter.source
+         || !mg::has_space_for(_mem, reqs->size, reqs->alignment, kind))
             continue;
         
-        trace("suitable memory found: %u bytes, index %u\n", mem->size, mem->type_index);
+        trace("suitable memory found: %u bytes, index %u\n", _mem->size, _mem->type_index);
         memory = _mem;
     }
-        
-    if (memory == nullptr)
+
+    return memory;
+}
+
+// host visible memory type on another heap than memtypeindex
+u32 find_fallback_memory_type_index(mg::memory_allocator *alloc, u32 memtypeindex, u32 filter)
+{
+    const VkPhysicalDeviceMemoryProperties *props = &alloc->memory_properties;
+    u32 heap = props->memoryTypes[memtypeindex].heapIndex;
+
+    for (u32 i = 0; i < props->memoryTypeCount; i++)
+        if ((filter & (1 << i))
+         && props->memoryTypes[i].heapIndex != heap
+         && (props->memoryTypes[i].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) == VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+            return i;
+
+    return UINT32_MAX;
+}
+
+// finds memory with enough space for reqs or allocates new memory.
+// if new device local memory would exceed the budget of its heap,
+// host visible memory is used instead.
+// memory requirements of a buffer or image, one of them must be nullptr.
+// dedicated is true if the resource should get its own memory, which is
+// the case if the driver asks for it or if by_size is set and the resource
+// is at least dedicated_allocation_size bytes large.
+struct resource_requirements
+{
+    VkBuffer buffer;
+    VkImage image;
+    VkMemoryRequirements reqs;
+    mg::memory_resource_kind kind;
+    bool dedicated;
+};
+
+void get_resource_requirements(mg::memory_manager *mgr, VkBuffer buffer, VkImage image, mg::memory_resource_kind kind, bool by_size, resource_requirements *out)
+{
+    VkMemoryDedicatedRequirements dedicated{};
+    dedicated.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_REQUIREMENTS;
+
+    VkMemoryRequirements2 reqs{};
+    reqs.sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2;
+    reqs.pNext = &dedicated;
+
+    if (buffer != nullptr)
+    {
+        VkBufferMemoryRequirementsInfo2 info{};
+        info.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_REQUIREMENTS_INFO_2;
+        info.buffer = buffer;
+        vkGetBufferMemoryRequirements2(mgr->context->device, &info, &reqs);
+    }
+    else
     {
-        const VkDeviceSize newsz = Max(reqs.size, mgr->min_allocation_size);
-        trace("no suitable memory found, allocating mem: %u bytes, index %u\n", newsz, memtypeindex);
-        memory = mg::allocate_memory_by_memory_type_index(&mgr->allocator, newsz, mg::memory_binding_type::Buffer, memtypeindex);
+        VkImageMemoryRequirementsInfo2 info{};
+        info.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_REQUIREMENTS_INFO_2;
+        info.image = image;
+        vkGetImageMemoryRequirements2(mgr->context->device, &info, &reqs);
     }
+
+    out->buffer = buffer;
+    out->image = image;
+    out->reqs = reqs.memoryRequirements;
+    out->kind = kind;
+    out->dedicated = dedicated.prefersDedicatedAllocation
+                  || dedicated.requiresDedicatedAllocation
+                  || (by_size && out->reqs.size >= mgr->dedicated_allocation_size);
+}
+
+mg::vk_memory *get_bindable_memory(mg::memory_manager *mgr, resource_requirements *res, VkMemoryPropertyFlags flags, mg::memory_binding_type binding_type)
+{
+    VkMemoryRequirements *reqs = &res->reqs;
+    u32 memtypeindex = mg::find_memory_type_index(&mgr->allocator, flags, reqs->memoryTypeBits);
+
+    if (memtypeindex == UINT32_MAX)
+        throw_error("%p no memory type with flags %u for memory requirements %u", mgr, flags, reqs->memoryTypeBits);
+
+    mg::vk_memory *memory = nullptr;
+
+    if (!res->dedicated)
+    {
+        memory = ::find_bindable_memory(mgr, memtypeindex, reqs, binding_type, res->kind);
+
+        if (memory != nullptr)
+            return memory;
+    }
+
+    const VkDeviceSize newsz = res->dedicated ? reqs->size : Max(reqs->size, mgr->min_allocation_size);
+
+    if ((flags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) == VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+     && mg::would_exceed_budget(&mgr->allocator, memtypeindex, newsz))
+    {
+        u32 fallback = ::find_fallback_memory_type_index(&mgr->allocator, memtypeindex, reqs->memoryTypeBits);
+
+        if (fallback != UINT32_MAX)
+        {
+            trace("device local memory over budget, falling back to index %u\n", fallback);
+
+            if (!res->dedicated)
+            {
+                memory = ::find_bindable_memory(mgr, fallback, reqs, binding_type, res->kind);
+
+                if (memory != nullptr)
+                    return memory;
+            }
+
+            if (!mg::would_exceed_budget(&mgr->allocator, fallback, newsz))
+                memtypeindex = fallback;
+        }
+    }
+
+    if (res->dedicated)
+    {
+        trace("allocating dedicated mem: %u bytes, index %u\n", newsz, memtypeindex);
+        return mg::allocate_dedicated_memory(&mgr->allocator, newsz, memtypeindex, res->buffer, res->image);
+    }
+
+    // shared blocks hold buffers and images alike, unless mixed_blocks is off
+    trace("no suitable memory found, allocating mem: %u bytes, index %u\n", newsz, memtypeindex);
+    const mg::memory_binding_type block_type = mgr->mixed_blocks ? mg::memory_binding_type::Mixed : binding_type;
+    return mg::allocate_memory_by_memory_type_index(&mgr->allocator, newsz, block_type, memtypeindex);
+}
+
+void mg::auto_bind_buffer(mg::memory_manager *mgr, mg::vk_buffer *buf, VkMemoryPropertyFlags flags)
+{
+    assert(mgr != nullptr);
+    assert(buf != nullptr);
+    assert(buf->buffer != nullptr);
+    assert(buf->memory == nullptr);
+    
+    // pool buffers and buffers of the context, e.g. the staging ring, are
+    // meant to share blocks, only buffers of a single large sub-buffer
+    // get dedicated memory because of their size.
+    resource_requirements res;
+    ::get_resource_requirements(mgr, buf->buffer, nullptr, mg::memory_resource_kind::Linear, buf->pool == mg::buffer_pool::Dedicated, &res);
+    
+    mg::vk_memory *memory = ::get_bindable_memory(mgr, &res, flags, mg::memory_binding_type::Buffer);
     
     mg::bind_buffer_to_memory(memory, mgr->context->device, buf);
 }
@@ -185,41 +577,197 @@ void mg::auto_bind_host_coherent_buffer(mg::memory_manager *mgr, mg::vk_buffer *
     mg::auto_bind_buffer(mgr, buf, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
 }
 
+// the upload cache is keyed by address, a new resource at the address of a
+// destroyed one must not skip its first upload
+void forget_cached_uploads(mg::memory_manager *mgr, const void *dest)
+{
+    if (mgr->context != nullptr)
+        mg::forget_uploads(&mgr->context->upload_cache, dest);
+}
+
+// sub-buffers are destroyed together with their buffer
+void release_sub_buffer_handles(mg::memory_manager *mgr, mg::vk_buffer *buf)
+{
+    for_array(sb, &buf->sub_buffers)
+    {
+        ::forget_cached_uploads(mgr, *sb);
+        mg::release(&mgr->sub_buffer_slab, (*sb)->handle);
+    }
+
+    for_array(bsb, &buf->buddy_sub_buffers)
+    {
+        ::forget_cached_uploads(mgr, *bsb);
+        mg::release(&mgr->sub_buffer_slab, (*bsb)->handle);
+    }
+}
+
 void destroy_buffer(mg::memory_manager *mgr, mg::vk_buffer *buf)
 {
-    if (buf->memory != nullptr)
-        mg::unbind_buffer_from_memory(buf->memory, buf);
+    ::release_sub_buffer_handles(mgr, buf);
+
+    mg::vk_memory *mem = buf->memory;
+
+    if (mem != nullptr)
+        mg::unbind_buffer_from_memory(mem, buf);
 
     if (buf->buffer != nullptr)
         vkDestroyBuffer(mgr->context->device, buf->buffer, nullptr);
+
+    if (mem != nullptr && mem->dedicated)
+        mg::free_memory(&mgr->allocator, mem);
     
     mg::free(buf);
 }
 
+void mg::destroy_sub_buffer(mg::memory_manager *mgr, mg::vk_sub_buffer *sb)
+{
+    assert(mgr != nullptr);
+    assert(sb != nullptr);
+
+    mg::vk_buffer *buf = sb->buffer;
+    ::forget_cached_uploads(mgr, sb);
+    mg::release(&mgr->sub_buffer_slab, sb->handle);
+    mg::destroy_sub_buffer(sb);
+
+    if (buf->pool == mg::buffer_pool::Dedicated)
+        mg::destroy_buffer(mgr, buf);
+    else
+        ::update_bucket_position(mgr, buf);
+}
+
+void mg::destroy_sub_buffer(mg::memory_manager *mgr, mg::slab_handle handle)
+{
+    mg::vk_sub_buffer *sb = mg::get_sub_buffer(mgr, handle);
+
+    if (sb != nullptr)
+        mg::destroy_sub_buffer(mgr, sb);
+}
+
 void mg::destroy_buffer(mg::memory_manager *mgr, mg::vk_buffer *buf)
 {
     assert(mgr != nullptr);
     assert(buf != nullptr);
     
-    for_list(i, tmp, &mgr->buffers)
-        if (tmp->buffer == buf->buffer)
-            break;
+    assert(buf->index < mgr->buffers.size);
+    assert(mgr->buffers[buf->index] == buf);
 
-    if (i < mgr->buffers.size)
-    {
-        ::destroy_buffer(mgr, tmp);
-        ::remove_elements(&mgr->buffers, i, 1);
-    }
+    ::remove_from_bucket(mgr, buf);
+
+    // swap with the last buffer to remove in O(1)
+    u32 index = buf->index;
+    mg::vk_buffer *last = mgr->buffers[mgr->buffers.size - 1];
+    last->index = index;
+    mgr->buffers[index] = last;
+    mgr->buffers.size -= 1;
+
+    ::destroy_buffer(mgr, buf);
+    mg::release(&mgr->buffer_slab, buf->handle);
+}
+
+void mg::destroy_buffer(mg::memory_manager *mgr, mg::slab_handle handle)
+{
+    mg::vk_buffer *buf = mg::get_buffer(mgr, handle);
+
+    if (buf != nullptr)
+        mg::destroy_buffer(mgr, buf);
 }
 
 void mg::destroy_all_buffers(mg::memory_manager *mgr)
 {
     assert(mgr != nullptr);
 
-    for_list(buf, &mgr->buffers)
-        ::destroy_buffer(mgr, buf);
+    for_array(buf, &mgr->buffers)
+    {
+        ::destroy_buffer(mgr, *buf);
+        mg::release(&mgr->buffer_slab, (*buf)->handle);
+    }
     
     ::clear(&mgr->buffers);
+
+    for_array(bucket, &mgr->buckets)
+    {
+        for (u32 i = 0; i < mg::BUCKET_BIN_COUNT; ++i)
+            ::clear(bucket->bins + i);
+
+        bucket->bin_bitmap = 0;
+    }
+}
+
+void add_mapped_range(mg::memory_manager *mgr, array<VkMappedMemoryRange> *ranges, mg::vk_memory *mem, VkDeviceSize offset, VkDeviceSize size)
+{
+    assert(mgr != nullptr);
+    assert(mem != nullptr);
+
+    if ((mem->type & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) == VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)
+        return;
+
+    const VkDeviceSize atom = mgr->non_coherent_atom_size;
+    VkDeviceSize start = (offset / atom) * atom;
+    VkDeviceSize end = mg::align_next(offset + size, atom);
+
+    // the last range may end at the end of the memory instead of an atom
+    if (end > mem->size)
+        end = mem->size;
+
+    if (ranges->size > 0)
+    {
+        VkMappedMemoryRange *last = ranges->data + (ranges->size - 1);
+
+        if (last->memory == mem->memory
+         && start <= last->offset + last->size
+         && end >= last->offset)
+        {
+            VkDeviceSize last_end = last->offset + last->size;
+            last->offset = Min(last->offset, start);
+            last->size = Max(last_end, end) - last->offset;
+            return;
+        }
+    }
+
+    VkMappedMemoryRange *range = ::add_at_end(ranges);
+    range->sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+    range->pNext = nullptr;
+    range->memory = mem->memory;
+    range->offset = start;
+    range->size = end - start;
+}
+
+void mg::queue_flush(mg::memory_manager *mgr, mg::vk_memory *mem, VkDeviceSize offset, VkDeviceSize size)
+{
+    ::add_mapped_range(mgr, &mgr->flush_ranges, mem, offset, size);
+}
+
+void mg::flush_queued_ranges(mg::memory_manager *mgr)
+{
+    assert(mgr != nullptr);
+
+    if (mgr->flush_ranges.size == 0)
+        return;
+
+    VkResult res = vkFlushMappedMemoryRanges(mgr->context->device, (u32)mgr->flush_ranges.size, mgr->flush_ranges.data);
+    ::clear(&mgr->flush_ranges);
+
+    if (res != VK_SUCCESS)
+        throw_vk_error(res, "%p could not flush mapped memory ranges", mgr);
+}
+
+void mg::queue_invalidate(mg::memory_manager *mgr, mg::vk_memory *mem, VkDeviceSize offset, VkDeviceSize size)
+{
+    ::add_mapped_range(mgr, &mgr->invalidate_ranges, mem, offset, size);
+}
+
+void mg::invalidate_queued_ranges(mg::memory_manager *mgr)
+{
+    assert(mgr != nullptr);
+
+    if (mgr->invalidate_ranges.size == 0)
+        return;
+
+    VkResult res = vkInvalidateMappedMemoryRanges(mgr->context->device, (u32)mgr->invalidate_ranges.size, mgr->invalidate_ranges.data);
+    ::clear(&mgr->invalidate_ranges);
+
+    if (res != VK_SUCCESS)
+        throw_vk_error(res, "%p could not invalidate mapped memory ranges", mgr);
 }
 
 mg::vk_image *mg::create_image(mg::memory_manager *mgr, VkImageCreateInfo *info)
@@ -233,10 +781,14 @@ mg::vk_image *mg::create_image(mg::memory_manager *mgr, VkImageCreateInfo *info)
     if (res != VK_SUCCESS)
         throw_vk_error(res, "%p could not create image", mgr);
 
-    auto node = ::add_at_end(&mgr->images);
-    mg::vk_image *ret = &node->value;
+    mg::slab_handle handle;
+    mg::vk_image *ret = mg::allocate(&mgr->image_slab, &handle);
     mg::init(ret, img, info);
 
+    ret->handle = handle;
+    ret->index = (u32)mgr->images.size;
+    ::add_at_end(&mgr->images, ret);
+
     return ret;
 }
 
@@ -273,29 +825,10 @@ void mg::auto_bind_image(mg::memory_manager *mgr, mg::vk_image *img, VkMemoryPro
     assert(img->image != nullptr);
     assert(img->memory == nullptr);
     
-    VkMemoryRequirements reqs;
-    vkGetImageMemoryRequirements(mgr->context->device, img->image, &reqs);
-    
-    u32 memtypeindex = mg::find_memory_type_index(&mgr->allocator, flags, reqs.memoryTypeBits);
-    mg::vk_memory *memory = nullptr;
+    resource_requirements res;
+    ::get_resource_requirements(mgr, nullptr, img->image, mg::get_resource_kind(img), true, &res);
     
-    for_list(_mem, &mgr->allocator.allocated_memory)
-    {
-        if (_mem->type_index != memtypeindex
-         || _mem->binding_type != mg::memory_binding_type::Image
-         || !mg::has_space_for(_mem, reqs.size, reqs.alignment))
-            continue;
-        
-        trace("suitable memory found: %u bytes, index %u\n", mem->size, mem->type_index);
-        memory = _mem;
-    }
-        
-    if (memory == nullptr)
-    {
-        const VkDeviceSize newsz = Max(reqs.size, mgr->min_allocation_size);
-        trace("no suitable memory found, allocating mem: %u bytes, index %u\n", newsz, memtypeindex);
-        memory = mg::allocate_memory_by_memory_type_index(&mgr->allocator, newsz, mg::memory_binding_type::Image, memtypeindex);
-    }
+    mg::vk_memory *memory = ::get_bindable_memory(mgr, &res, flags, mg::memory_binding_type::Image);
     
     mg::bind_image_to_memory(memory, mgr->context->device, img);
 }
@@ -315,13 +848,49 @@ void mg::auto_bind_host_coherent_image(mg::memory_manager *mgr, mg::vk_image *im
     mg::auto_bind_image(mgr, img, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
 }
 
+void mg::auto_bind_transient_image(mg::memory_manager *mgr, mg::vk_image *img)
+{
+    assert(mgr != nullptr);
+    assert(img != nullptr);
+    assert(img->image != nullptr);
+    assert(img->memory == nullptr);
+    assert((img->usage & VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT) == VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT);
+
+    resource_requirements res;
+    ::get_resource_requirements(mgr, nullptr, img->image, mg::get_resource_kind(img), true, &res);
+
+    u32 memtypeindex = mg::find_memory_type_index(&mgr->allocator, VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT, res.reqs.memoryTypeBits);
+
+    if (memtypeindex == UINT32_MAX)
+    {
+        // no lazily allocated memory, e.g. on desktop GPUs
+        mg::vk_memory *memory = ::get_bindable_memory(mgr, &res, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, mg::memory_binding_type::Image);
+        mg::bind_image_to_memory(memory, mgr->context->device, img);
+        return;
+    }
+
+    // lazily allocated memory is only committed when the driver needs it,
+    // which it might never do. nothing else can use it anyway.
+    trace("allocating lazily allocated mem: %u bytes, index %u\n", res.reqs.size, memtypeindex);
+    mg::vk_memory *memory = mg::allocate_dedicated_memory(&mgr->allocator, res.reqs.size, memtypeindex, nullptr, img->image);
+
+    mg::bind_image_to_memory(memory, mgr->context->device, img);
+}
+
 void destroy_image(mg::memory_manager *mgr, mg::vk_image *img)
 {
-    if (img->memory != nullptr)
-        mg::unbind_image_from_memory(img->memory, img);
+    ::forget_cached_uploads(mgr, img);
+
+    mg::vk_memory *mem = img->memory;
+
+    if (mem != nullptr)
+        mg::unbind_image_from_memory(mem, img);
 
     if (img->image != nullptr)
         vkDestroyImage(mgr->context->device, img->image, nullptr);
+
+    if (mem != nullptr && mem->dedicated)
+        mg::free_memory(&mgr->allocator, mem);
     
     mg::free(img);
 }
@@ -331,23 +900,36 @@ void mg::destroy_image(mg::memory_manager *mgr, mg::vk_image *img)
     assert(mgr != nullptr);
     assert(img != nullptr);
     
-    for_list(i, tmp, &mgr->images)
-        if (tmp->image == img->image)
-            break;
+    assert(img->index < mgr->images.size);
+    assert(mgr->images[img->index] == img);
 
-    if (i < mgr->images.size)
-    {
-        ::destroy_image(mgr, tmp);
-        ::remove_elements(&mgr->images, i, 1);
-    }
+    // swap with the last image to remove in O(1)
+    mg::vk_image *last = mgr->images[mgr->images.size - 1];
+    last->index = img->index;
+    mgr->images[img->index] = last;
+    mgr->images.size -= 1;
+
+    ::destroy_image(mgr, img);
+    mg::release(&mgr->image_slab, img->handle);
+}
+
+void mg::destroy_image(mg::memory_manager *mgr, mg::slab_handle handle)
+{
+    mg::vk_image *img = mg::get_image(mgr, handle);
+
+    if (img != nullptr)
+        mg::destroy_image(mgr, img);
 }
 
 void mg::destroy_all_images(mg::memory_manager *mgr)
 {
     assert(mgr != nullptr);
 
-    for_list(img, &mgr->images)
-        ::destroy_image(mgr, img);
+    for_array(img, &mgr->images)
+    {
+        ::destroy_image(mgr, *img);
+        mg::release(&mgr->image_slab, (*img)->handle);
+    }
     
     ::clear(&mgr->images);
 }
@@ -3,9 +3,11 @@
 
 #include <vulkan/vulkan_core.h>
 
-#include "shl/linked_list.hpp"
+#include "shl/array.hpp"
 
+#include "mg/impl/defragmenter.hpp"
 #include "mg/impl/memory_allocator.hpp"
+#include "mg/impl/slab.hpp"
 #include "mg/impl/vk_buffer.hpp"
 #include "mg/impl/vk_image.hpp"
 
@@ -15,8 +17,39 @@ struct context;
 constexpr const VkDeviceSize DEFAULT_MIN_ALLOC_SIZE = 16777216ull;
 constexpr const VkDeviceSize AUTO_SIZE = -2ull;
 
-typedef linked_list<mg::vk_buffer> buffer_list;
-typedef linked_list<mg::vk_image>  image_list;
+// see memory_manager::dedicated_allocation_size
+constexpr const VkDeviceSize DEFAULT_DEDICATED_ALLOCATION_SIZE = 16777216ull; // 16 MiB
+
+// sub-buffers up to the max size of a pool are placed in buffers of that
+// pool, anything larger than the large pool gets its own buffer.
+constexpr const VkDeviceSize DEFAULT_SMALL_POOL_MAX_SIZE      = 65536ull;     // 64 KiB
+constexpr const VkDeviceSize DEFAULT_SMALL_POOL_BUFFER_SIZE   = 4194304ull;   // 4 MiB
+constexpr const VkDeviceSize DEFAULT_MEDIUM_POOL_MAX_SIZE     = 1048576ull;   // 1 MiB
+constexpr const VkDeviceSize DEFAULT_MEDIUM_POOL_BUFFER_SIZE  = 16777216ull;  // 16 MiB
+constexpr const VkDeviceSize DEFAULT_LARGE_POOL_MAX_SIZE      = 16777216ull;  // 16 MiB
+constexpr const VkDeviceSize DEFAULT_LARGE_POOL_BUFFER_SIZE   = 67108864ull;  // 64 MiB
+
+typedef array<mg::vk_buffer*> buffer_list;
+typedef array<mg::vk_image*>  image_list;
+
+// bin 0 of a bucket holds full buffers, bin i the buffers whose largest
+// contiguous free space is at least 2^(i - 1) and less than 2^i bytes.
+constexpr const u32 BUCKET_BIN_COUNT = 65;
+
+// pooled buffers with the same usage, sharemode, memory flags and pool,
+// binned by their largest contiguous free space. a buffer that fits is
+// found in O(1) through the bitmap of non-empty bins, adding, moving and
+// removing buffers swaps them with the last buffer of their bin.
+struct buffer_bucket
+{
+    VkBufferUsageFlags usage;
+    VkSharingMode sharemode;
+    VkMemoryPropertyFlags memflags; // 0 if not bound by the manager
+    mg::buffer_pool pool;
+
+    u64 bin_bitmap; // bit i - 1 is set if bin i is not empty
+    array<mg::vk_buffer*> bins[BUCKET_BIN_COUNT];
+};
 
 struct memory_manager
 {
@@ -24,22 +57,100 @@ struct memory_manager
     // is smaller than or equal to this size.
     VkDeviceSize min_allocation_size;    
 
+    // images and buffers of the Dedicated pool at least this large are bound
+    // to dedicated memory instead of being placed in a shared block, as are
+    // resources the driver prefers or requires dedicated memory for.
+    // pool buffers and other buffers only get dedicated memory if the
+    // driver asks for it, no matter their size.
+    VkDeviceSize dedicated_allocation_size;
+
+    // if true, new shared blocks are Mixed and hold buffers and images alike.
+    // if false, every block only holds the binding type it was allocated
+    // for, like before blocks were shared.
+    bool mixed_blocks;
+
+    // how sub-buffers are placed in buffers created by the manager
+    mg::sub_buffer_allocation_mode sub_buffer_mode;
+
+    // size classes of sub-buffers, see get_new_sub_buffer
+    struct _pools
+    {
+        VkDeviceSize small_max_size;
+        VkDeviceSize small_buffer_size;
+        VkDeviceSize medium_max_size;
+        VkDeviceSize medium_buffer_size;
+        VkDeviceSize large_max_size;
+        VkDeviceSize large_buffer_size;
+    } pools;
+
+    // memory flags used for staging buffers. host cached if the device
+    // has such memory, otherwise host coherent.
+    VkMemoryPropertyFlags staging_memory_flags;
+
+    // memory flags used for buffers that are written by the host and read
+    // by the GPU, see get_new_upload_sub_buffer. device local and host
+    // visible if the device has such memory with the size of its device
+    // local memory (integrated GPUs, resizable BAR), otherwise device local.
+    VkMemoryPropertyFlags upload_memory_flags;
+
     mg::context *context;
     mg::memory_allocator allocator;
     mg::buffer_list buffers;
     mg::image_list images;
+    array<mg::buffer_bucket> buckets;
+
+    // storage of buffers and images. the lists above point into the slabs
+    // so they can be iterated without walking the slabs.
+    // sub-buffers are stored in their buffer, the slab only maps handles
+    // of sub-buffers obtained from the manager to them.
+    mg::slab<mg::vk_buffer> buffer_slab;
+    mg::slab<mg::vk_image> image_slab;
+    mg::slab<mg::vk_sub_buffer*> sub_buffer_slab;
+
+    // ranges of non-coherent memory, see queue_flush and queue_invalidate
+    VkDeviceSize non_coherent_atom_size;
+    array<VkMappedMemoryRange> flush_ranges;
+    array<VkMappedMemoryRange> invalidate_ranges;
+
+    // disabled by default, see defragmenter::max_bytes_per_frame
+    mg::defragmenter defragmenter;
 };
     
 void init(mg::memory_manager *mgr, context *ctx);
 void free(mg::memory_manager *mgr);
 
+// the pool a sub-buffer of the given size is placed in
+mg::buffer_pool get_buffer_pool(mg::memory_manager *mgr, VkDeviceSize size);
+// the offset alignment sub-buffers with the given usage need,
+// e.g. minUniformBufferOffsetAlignment for uniform buffers.
+VkDeviceSize get_sub_buffer_alignment(mg::memory_manager *mgr, VkBufferUsageFlags usage);
+
 // DOES allocate memory if none is available
 // DOES create a buffer it none is available
+// sub-buffers are placed in a buffer of their pool, sub-buffers larger than
+// pools.large_max_size get a dedicated buffer.
 mg::vk_sub_buffer *get_new_sub_buffer(mg::memory_manager *mgr, VkDeviceSize size, VkBufferUsageFlags usage, VkSharingMode sharemode = VK_SHARING_MODE_EXCLUSIVE);
 mg::vk_sub_buffer *get_new_bound_sub_buffer(mg::memory_manager *mgr, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags memflags, VkSharingMode sharemode = VK_SHARING_MODE_EXCLUSIVE);
 mg::vk_sub_buffer *get_new_device_local_sub_buffer(mg::memory_manager *mgr, VkDeviceSize size, VkBufferUsageFlags usage, VkSharingMode sharemode = VK_SHARING_MODE_EXCLUSIVE);
 mg::vk_sub_buffer *get_new_host_coherent_sub_buffer(mg::memory_manager *mgr, VkDeviceSize size, VkBufferUsageFlags usage, VkSharingMode sharemode = VK_SHARING_MODE_EXCLUSIVE);
 mg::vk_sub_buffer *get_new_host_sub_buffer(mg::memory_manager *mgr, VkDeviceSize size, VkBufferUsageFlags usage, VkSharingMode sharemode = VK_SHARING_MODE_EXCLUSIVE);
+// host visible sub-buffer bound to staging_memory_flags memory.
+// writes to it must be followed by queue_flush.
+mg::vk_sub_buffer *get_new_staging_sub_buffer(mg::memory_manager *mgr, VkDeviceSize size, VkBufferUsageFlags usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VkSharingMode sharemode = VK_SHARING_MODE_EXCLUSIVE);
+
+// sub-buffer bound to upload_memory_flags memory, which can be written
+// without a staging copy by queue_buffer_upload if it is host visible.
+// transfer destination so uploads can fall back to staging.
+mg::vk_sub_buffer *get_new_upload_sub_buffer(mg::memory_manager *mgr, VkDeviceSize size, VkBufferUsageFlags usage, VkSharingMode sharemode = VK_SHARING_MODE_EXCLUSIVE);
+
+// handles
+// pointers returned by the manager stay valid until the object is destroyed,
+// handles additionally detect use after destruction: the get functions
+// return nullptr if the object of the handle was destroyed.
+// lookups and destruction by handle are O(1).
+mg::vk_sub_buffer *get_sub_buffer(mg::memory_manager *mgr, mg::slab_handle handle);
+mg::vk_buffer *get_buffer(mg::memory_manager *mgr, mg::slab_handle handle);
+mg::vk_image *get_image(mg::memory_manager *mgr, mg::slab_handle handle);
 
 // does not allocate memory, only creates a buffer
 mg::vk_buffer *create_buffer(mg::memory_manager *mgr, VkDeviceSize size, VkBufferUsageFlags usage, VkSharingMode sharemode = VK_SHARING_MODE_EXCLUSIVE);
@@ -51,15 +162,36 @@ mg::vk_buffer *create_vertex_buffer (mg::memory_manager *mgr, VkDeviceSize size
 // searches for available, unbound memory matching the requirements of
 // the buffer and binds the memory to the buffer.
 // allocates memory if no already allocated memory is available.
+// buffers of the Dedicated pool of at least dedicated_allocation_size bytes
+// and buffers the driver wants dedicated memory for get their own memory,
+// which is freed when the buffer is destroyed.
 // throws if something goes wrong.
 void auto_bind_buffer(mg::memory_manager *mgr, mg::vk_buffer *buf, VkMemoryPropertyFlags flags);
 void auto_bind_device_local_buffer(mg::memory_manager *mgr, mg::vk_buffer *buf);
 void auto_bind_host_buffer(mg::memory_manager *mgr, mg::vk_buffer *buf);
 void auto_bind_host_coherent_buffer(mg::memory_manager *mgr, mg::vk_buffer *buf);
 
+// use this instead of destroy_sub_buffer(sb) for sub-buffers obtained from
+// the manager, keeps the buffer lookup up to date and also destroys the
+// buffer of sub-buffers with a dedicated buffer.
+void destroy_sub_buffer(mg::memory_manager *mgr, mg::vk_sub_buffer *sb);
+void destroy_sub_buffer(mg::memory_manager *mgr, mg::slab_handle handle);
+
 void destroy_buffer(mg::memory_manager *mgr, mg::vk_buffer *buf);
+void destroy_buffer(mg::memory_manager *mgr, mg::slab_handle handle);
 void destroy_all_buffers(mg::memory_manager *mgr);
 
+// non-coherent memory
+// host writes to mapped memory have to be flushed before the GPU reads them,
+// GPU writes have to be invalidated before the host reads them.
+// ranges are rounded to non_coherent_atom_size, adjacent ranges are merged
+// and all queued ranges are flushed / invalidated with a single call.
+// does nothing for host coherent memory.
+void queue_flush(mg::memory_manager *mgr, mg::vk_memory *mem, VkDeviceSize offset, VkDeviceSize size);
+void flush_queued_ranges(mg::memory_manager *mgr); // is called automatically before submitting frames and uploads
+void queue_invalidate(mg::memory_manager *mgr, mg::vk_memory *mem, VkDeviceSize offset, VkDeviceSize size);
+void invalidate_queued_ranges(mg::memory_manager *mgr);
+
 // images
 mg::vk_image *create_image(mg::memory_manager *mgr, VkImageCreateInfo *info);
 mg::vk_image *create_image(mg::memory_manager *mgr, VkExtent3D extent, VkImageCreateFlags flags = 0, VkImageType image_type = VK_IMAGE_TYPE_2D, VkFormat format = VK_FORMAT_R8G8B8A8_UINT, u32 mipmap_levels = 1, u32 array_layers = 1, VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT, VkImageTiling tiling = VK_IMAGE_TILING_OPTIMAL, VkImageUsageFlags usage = 0, VkSharingMode sharemode = VK_SHARING_MODE_EXCLUSIVE, VkImageLayout initial_layout = VK_IMAGE_LAYOUT_UNDEFINED);
@@ -68,7 +200,14 @@ void auto_bind_image(mg::memory_manager *mgr, mg::vk_image *img, VkMemoryPropert
 void auto_bind_device_local_image(mg::memory_manager *mgr, mg::vk_image *img);
 void auto_bind_host_image(mg::memory_manager *mgr, mg::vk_image *img);
 void auto_bind_host_coherent_image(mg::memory_manager *mgr, mg::vk_image *img);
+// for images with VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT whose contents never
+// leave a render pass, e.g. depth or multisampled color attachments.
+// binds to its own lazily allocated memory if the device has any, so
+// tile based GPUs may never back the image with physical memory.
+// falls back to device local memory otherwise.
+void auto_bind_transient_image(mg::memory_manager *mgr, mg::vk_image *img);
 
 void destroy_image(mg::memory_manager *mgr, mg::vk_image *img);
+void destroy_image(mg::memory_manager *mgr, mg::slab_handle handle);
 void destroy_all_images(mg::memory_manager *mgr);
 }
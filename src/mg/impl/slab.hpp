@@ -0,0 +1,149 @@
+#pragma once
+
+#include "shl/array.hpp"
+#include "shl/memory.hpp"
+#include "shl/number_types.hpp"
+
+// slot map with stable storage.
+// values live in fixed size pages that never move, so pointers to values
+// stay valid until their slot is released. released slots are reused and
+// every slot counts its generation, so handles to released slots are
+// detected instead of referring to whatever reused the slot.
+// allocating, releasing and looking up are O(1).
+namespace mg
+{
+constexpr const u32 SLAB_PAGE_SIZE = 64;
+constexpr const u32 SLAB_INVALID_INDEX = UINT32_MAX;
+
+struct slab_handle
+{
+    u32 index;
+    u32 generation;
+};
+
+constexpr const mg::slab_handle INVALID_SLAB_HANDLE{SLAB_INVALID_INDEX, 0};
+
+inline bool operator==(mg::slab_handle a, mg::slab_handle b)
+{
+    return a.index == b.index && a.generation == b.generation;
+}
+
+inline bool operator!=(mg::slab_handle a, mg::slab_handle b)
+{
+    return !(a == b);
+}
+
+template<typename T>
+struct slab_slot
+{
+    T value;
+    u32 generation; // odd while the slot is in use
+    u32 next_free;
+};
+
+template<typename T>
+struct slab_page
+{
+    mg::slab_slot<T> slots[SLAB_PAGE_SIZE];
+};
+
+template<typename T>
+struct slab
+{
+    array<mg::slab_page<T>*> pages;
+    u32 first_free;
+    u32 count; // slots in use
+};
+
+template<typename T>
+void init(mg::slab<T> *s)
+{
+    ::init(&s->pages);
+    s->first_free = SLAB_INVALID_INDEX;
+    s->count = 0;
+}
+
+template<typename T>
+void free(mg::slab<T> *s)
+{
+    for_array(page, &s->pages)
+        ::free_memory(*page);
+
+    ::free(&s->pages);
+    s->first_free = SLAB_INVALID_INDEX;
+    s->count = 0;
+}
+
+template<typename T>
+mg::slab_slot<T> *slot_at(mg::slab<T> *s, u32 index)
+{
+    return s->pages[index / SLAB_PAGE_SIZE]->slots + (index % SLAB_PAGE_SIZE);
+}
+
+// returns uninitialized storage for a value and writes its handle to out
+template<typename T>
+T *allocate(mg::slab<T> *s, mg::slab_handle *out)
+{
+    if (s->first_free == SLAB_INVALID_INDEX)
+    {
+        mg::slab_page<T> *page = ::allocate_memory<mg::slab_page<T>>();
+        u32 first = (u32)(s->pages.size * SLAB_PAGE_SIZE);
+
+        for (u32 i = 0; i < SLAB_PAGE_SIZE; ++i)
+        {
+            page->slots[i].generation = 0;
+            page->slots[i].next_free = i + 1 < SLAB_PAGE_SIZE ? first + i + 1 : SLAB_INVALID_INDEX;
+        }
+
+        ::add_at_end(&s->pages, page);
+        s->first_free = first;
+    }
+
+    u32 index = s->first_free;
+    mg::slab_slot<T> *slot = mg::slot_at(s, index);
+
+    s->first_free = slot->next_free;
+    slot->generation++;
+    s->count++;
+
+    out->index = index;
+    out->generation = slot->generation;
+
+    return &slot->value;
+}
+
+// does nothing if the handle was already released or is invalid
+template<typename T>
+void release(mg::slab<T> *s, mg::slab_handle handle)
+{
+    if (handle.index == SLAB_INVALID_INDEX
+     || handle.index >= s->pages.size * SLAB_PAGE_SIZE)
+        return;
+
+    mg::slab_slot<T> *slot = mg::slot_at(s, handle.index);
+
+    if (slot->generation != handle.generation)
+        return;
+
+    slot->generation++;
+    slot->next_free = s->first_free;
+    s->first_free = handle.index;
+    s->count--;
+}
+
+// nullptr if the handle was released
+template<typename T>
+T *get(mg::slab<T> *s, mg::slab_handle handle)
+{
+    if (handle.index == SLAB_INVALID_INDEX
+     || handle.index >= s->pages.size * SLAB_PAGE_SIZE)
+        return nullptr;
+
+    mg::slab_slot<T> *slot = mg::slot_at(s, handle.index);
+
+    if (slot->generation != handle.generation)
+        return nullptr;
+
+    return &slot->value;
+}
+}
@@ -0,0 +1,118 @@
+
+#include <assert.h>
+
+#include "shl/error.hpp"
+
+#include "mg/number_range.hpp"
+#include "mg/impl/context.hpp"
+#include "mg/impl/staging_ring.hpp"
+
+void mg::init(mg::staging_ring *ring, mg::memory_manager *mgr, VkDeviceSize size, VkDeviceSize alignment)
+{
+    assert(ring != nullptr);
+    assert(mgr != nullptr);
+    assert(size > 0);
+    assert(alignment > 0);
+
+    // allocations wrapping around stay aligned
+    size = mg::align_next(size, alignment);
+
+    mg::vk_buffer *buf = mg::create_buffer(mgr, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
+    mg::auto_bind_host_coherent_buffer(mgr, buf);
+
+    u8 *mapped = (u8*)mg::map_memory(buf->memory, mgr->context->device);
+
+    ring->buffer = buf;
+    ring->data = mapped + buf->offset;
+    ring->alignment = alignment;
+    ring->head = 0;
+    ring->submitted = 0;
+    ring->tail = 0;
+
+    ::init(&ring->marks);
+}
+
+void mg::free(mg::staging_ring *ring, mg::memory_manager *mgr)
+{
+    assert(ring != nullptr);
+    assert(mgr != nullptr);
+
+    if (ring->buffer == nullptr)
+        return;
+
+    mg::destroy_buffer(mgr, ring->buffer);
+    ::free(&ring->marks);
+
+    ring->buffer = nullptr;
+    ring->data = nullptr;
+    ring->head = 0;
+    ring->submitted = 0;
+    ring->tail = 0;
+}
+
+bool mg::allocate_staging_memory(mg::staging_ring *ring, VkDeviceSize size, mg::frame_allocation *out)
+{
+    assert(ring != nullptr);
+    assert(ring->buffer != nullptr);
+    assert(out != nullptr);
+    assert(size > 0);
+
+    VkDeviceSize capacity = ring->buffer->size;
+
+    if (size > capacity)
+        return false;
+
+    VkDeviceSize start = mg::align_next(ring->head, ring->alignment);
+    VkDeviceSize offset = start % capacity;
+
+    // allocations are contiguous, the rest of the buffer is skipped
+    if (offset + size > capacity)
+    {
+        start += capacity - offset;
+        offset = 0;
+    }
+
+    if (start + size - ring->tail > capacity)
+        return false;
+
+    ring->head = start + size;
+
+    *out = mg::frame_allocation{ring->buffer, offset, size, ring->data + offset};
+    return true;
+}
+
+void mg::mark_submitted(mg::staging_ring *ring, u64 value)
+{
+    assert(ring != nullptr);
+    assert(ring->marks.size == 0 || ring->marks[ring->marks.size - 1].value < value);
+
+    if (ring->head == ring->submitted)
+        return;
+
+    ring->submitted = ring->head;
+    ::add_at_end(&ring->marks, mg::staging_mark{value, ring->head});
+}
+
+void mg::retire(mg::staging_ring *ring, u64 completed_value)
+{
+    assert(ring != nullptr);
+
+    u64 count = 0;
+
+    while (count < ring->marks.size && ring->marks[count].value <= completed_value)
+    {
+        ring->tail = ring->marks[count].position;
+        ++count;
+    }
+
+    if (count > 0)
+        ::remove_elements(&ring->marks, 0, count);
+}
+
+void mg::retire_all(mg::staging_ring *ring)
+{
+    assert(ring != nullptr);
+
+    ring->tail = ring->submitted;
+    ::clear(&ring->marks);
+}
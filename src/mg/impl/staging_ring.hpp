@@ -0,0 +1,62 @@
+#pragma once
+
+#include <vulkan/vulkan_core.h>
+
+#include "shl/array.hpp"
+#include "shl/number_types.hpp"
+
+#include "mg/impl/frame_allocator.hpp"
+#include "mg/impl/memory_manager.hpp"
+#include "mg/impl/vk_buffer.hpp"
+
+// ring buffer for upload data that is copied to device local memory.
+// the ring owns a persistently mapped, host coherent buffer. allocating
+// only moves the head forward, memory is reclaimed once the frame that
+// copies out of it has finished on the GPU, which is tracked with the
+// values of a timeline semaphore.
+//
+// positions only ever grow, the offset inside the buffer is
+// position % buffer->size. everything from tail to head is in use:
+// [tail, submitted) may still be read by the GPU,
+// [submitted, head) is queued but not yet submitted.
+namespace mg
+{
+constexpr const VkDeviceSize DEFAULT_STAGING_RING_SIZE = 16777216ull;
+
+// end of the memory read by the submission that signals value
+struct staging_mark
+{
+    u64 value;
+    VkDeviceSize position;
+};
+
+struct staging_ring
+{
+    mg::vk_buffer *buffer;
+    u8 *data;
+
+    VkDeviceSize alignment;
+    VkDeviceSize head;
+    VkDeviceSize submitted;
+    VkDeviceSize tail;
+
+    // submissions that may still read from the ring, oldest first
+    array<mg::staging_mark> marks;
+};
+
+// size is rounded up to alignment
+void init(mg::staging_ring *ring, mg::memory_manager *mgr, VkDeviceSize size, VkDeviceSize alignment);
+void free(mg::staging_ring *ring, mg::memory_manager *mgr);
+
+// contiguous memory in the ring, returns false if there is not enough space
+// until more submissions retire.
+bool allocate_staging_memory(mg::staging_ring *ring, VkDeviceSize size, mg::frame_allocation *out);
+
+// everything allocated so far is read by the submission that signals value.
+// values must increase with every call.
+void mark_submitted(mg::staging_ring *ring, u64 value);
+// all submissions up to completed_value are done, their memory can be reused
+void retire(mg::staging_ring *ring, u64 completed_value);
+// the GPU is idle, all submitted memory can be reused
+void retire_all(mg::staging_ring *ring);
+}
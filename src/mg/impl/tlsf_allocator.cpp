@@ -0,0 +1,418 @@
+
+#include <assert.h>
+
+#include "shl/debug.hpp"
+#include "shl/number_types.hpp"
+
+#include "mg/impl/bit_scan.hpp"
+#include "mg/impl/tlsf_allocator.hpp"
+
+void tlsf_mapping(VkDeviceSize size, u32 *fl, u32 *sl)
+{
+    if (size < mg::TLSF_SL_COUNT)
+    {
+        *fl = 0;
+        *sl = (u32)size;
+        return;
+    }
+
+    u32 msb = ::bit_scan_reverse(size);
+    *fl = msb - mg::TLSF_SL_COUNT_LOG2 + 1;
+    *sl = (u32)(size >> (msb - mg::TLSF_SL_COUNT_LOG2)) ^ mg::TLSF_SL_COUNT;
+}
+
+// rounds size up to the next size class so that every block
+// in the resulting class is guaranteed to fit size.
+void tlsf_mapping_search(VkDeviceSize size, u32 *fl, u32 *sl)
+{
+    if (size >= mg::TLSF_SL_COUNT)
+        size += (1ull << (::bit_scan_reverse(size) - mg::TLSF_SL_COUNT_LOG2)) - 1;
+
+    ::tlsf_mapping(size, fl, sl);
+}
+
+u32 tlsf_find_suitable_block(mg::tlsf_allocator *alloc, u32 fl, u32 sl)
+{
+    if (fl >= mg::TLSF_FL_COUNT)
+        return mg::TLSF_INVALID_BLOCK;
+
+    u32 sl_map = alloc->sl_bitmap[fl] & (~0u << sl);
+
+    if (sl_map == 0)
+    {
+        if (fl + 1 >= mg::TLSF_FL_COUNT)
+            return mg::TLSF_INVALID_BLOCK;
+
+        u64 fl_map = alloc->fl_bitmap & (~0ull << (fl + 1));
+
+        if (fl_map == 0)
+            return mg::TLSF_INVALID_BLOCK;
+
+        fl = ::bit_scan_forward(fl_map);
+        sl_map = alloc->sl_bitmap[fl];
+    }
+
+    sl = ::bit_scan_forward(sl_map);
+
+    return alloc->free_lists[fl][sl];
+}
+
+// the largest free block is always in the highest non-empty size class,
+// so only that class has to be searched. only needed when the largest free
+// block stops being free, inserting free blocks keeps it up to date.
+void tlsf_find_largest_free_block(mg::tlsf_allocator *alloc)
+{
+    alloc->largest_free_block = mg::TLSF_INVALID_BLOCK;
+
+    if (alloc->fl_bitmap == 0)
+        return;
+
+    u32 fl = ::bit_scan_reverse(alloc->fl_bitmap);
+    u32 sl = ::bit_scan_reverse(alloc->sl_bitmap[fl]);
+    VkDeviceSize largest_size = 0;
+
+    for (u32 i = alloc->free_lists[fl][sl]; i != mg::TLSF_INVALID_BLOCK; i = alloc->blocks[i].next_free)
+        if (alloc->blocks[i].range.size > largest_size)
+        {
+            largest_size = alloc->blocks[i].range.size;
+            alloc->largest_free_block = i;
+        }
+}
+
+void tlsf_insert_free_block(mg::tlsf_allocator *alloc, u32 index)
+{
+    mg::tlsf_block *block = alloc->blocks.data + index;
+    u32 fl;
+    u32 sl;
+    ::tlsf_mapping(block->range.size, &fl, &sl);
+
+    u32 head = alloc->free_lists[fl][sl];
+    block->state = mg::tlsf_block_state::Free;
+    block->kind = 0;
+    block->prev_free = mg::TLSF_INVALID_BLOCK;
+    block->next_free = head;
+
+    if (head != mg::TLSF_INVALID_BLOCK)
+        alloc->blocks[head].prev_free = index;
+
+    alloc->free_lists[fl][sl] = index;
+    alloc->fl_bitmap |= 1ull << fl;
+    alloc->sl_bitmap[fl] |= 1u << sl;
+
+    if (alloc->largest_free_block == mg::TLSF_INVALID_BLOCK
+     || alloc->blocks[alloc->largest_free_block].range.size < block->range.size)
+        alloc->largest_free_block = index;
+}
+
+void tlsf_remove_free_block(mg::tlsf_allocator *alloc, u32 index)
+{
+    mg::tlsf_block *block = alloc->blocks.data + index;
+    assert(block->state == mg::tlsf_block_state::Free);
+
+    u32 fl;
+    u32 sl;
+    ::tlsf_mapping(block->range.size, &fl, &sl);
+
+    if (block->prev_free != mg::TLSF_INVALID_BLOCK)
+        alloc->blocks[block->prev_free].next_free = block->next_free;
+    else
+        alloc->free_lists[fl][sl] = block->next_free;
+
+    if (block->next_free != mg::TLSF_INVALID_BLOCK)
+        alloc->blocks[block->next_free].prev_free = block->prev_free;
+
+    if (alloc->free_lists[fl][sl] == mg::TLSF_INVALID_BLOCK)
+    {
+        alloc->sl_bitmap[fl] &= ~(1u << sl);
+
+        if (alloc->sl_bitmap[fl] == 0)
+            alloc->fl_bitmap &= ~(1ull << fl);
+    }
+
+    block->prev_free = mg::TLSF_INVALID_BLOCK;
+    block->next_free = mg::TLSF_INVALID_BLOCK;
+
+    if (alloc->largest_free_block == index)
+        ::tlsf_find_largest_free_block(alloc);
+}
+
+// may reallocate the blocks array, invalidating block pointers
+u32 tlsf_new_block(mg::tlsf_allocator *alloc)
+{
+    u32 index = alloc->first_unused_block;
+
+    if (index != mg::TLSF_INVALID_BLOCK)
+        alloc->first_unused_block = alloc->blocks[index].next_free;
+    else
+    {
+        index = (u32)alloc->blocks.size;
+        ::add_at_end(&alloc->blocks);
+    }
+
+    mg::tlsf_block *block = alloc->blocks.data + index;
+    block->range.offset = 0;
+    block->range.size = 0;
+    block->state = mg::tlsf_block_state::Allocated;
+    block->kind = 0;
+    block->prev_physical = mg::TLSF_INVALID_BLOCK;
+    block->next_physical = mg::TLSF_INVALID_BLOCK;
+    block->prev_free = mg::TLSF_INVALID_BLOCK;
+    block->next_free = mg::TLSF_INVALID_BLOCK;
+
+    return index;
+}
+
+void tlsf_release_block(mg::tlsf_allocator *alloc, u32 index)
+{
+    mg::tlsf_block *block = alloc->blocks.data + index;
+    block->state = mg::tlsf_block_state::Unused;
+    block->next_free = alloc->first_unused_block;
+    alloc->first_unused_block = index;
+}
+
+inline bool tlsf_kinds_conflict(u8 a, u8 b)
+{
+    return a != 0 && b != 0 && a != b;
+}
+
+inline VkDeviceSize tlsf_page(VkDeviceSize offset, VkDeviceSize granularity)
+{
+    return offset & ~(granularity - 1);
+}
+
+// writes the offset at which size bytes of the given kind would be placed
+// inside the free block to out_offset, or returns false if they don't fit.
+// the physical neighbours of a free block are never free, so only they
+// can share a page with the new block.
+bool tlsf_fit(mg::tlsf_allocator *alloc, u32 index, VkDeviceSize size, VkDeviceSize alignment, u8 kind, VkDeviceSize *out_offset)
+{
+    const mg::tlsf_block *block = alloc->blocks.data + index;
+    VkDeviceSize offset = mg::align_next(block->range.offset, alignment);
+    VkDeviceSize end = block->range.offset + block->range.size;
+    VkDeviceSize granularity = alloc->granularity;
+
+    if (kind != 0 && granularity > 1)
+    {
+        u32 prev = block->prev_physical;
+        u32 next = block->next_physical;
+
+        if (prev != mg::TLSF_INVALID_BLOCK
+         && ::tlsf_kinds_conflict(alloc->blocks[prev].kind, kind)
+         && ::tlsf_page(block->range.offset - 1, granularity) == ::tlsf_page(offset, granularity))
+            offset = mg::align_next(offset, granularity);
+
+        if (next != mg::TLSF_INVALID_BLOCK
+         && ::tlsf_kinds_conflict(alloc->blocks[next].kind, kind))
+            end = ::tlsf_page(end, granularity);
+    }
+
+    if (offset > end || end - offset < size)
+        return false;
+
+    *out_offset = offset;
+    return true;
+}
+
+void mg::init(mg::tlsf_allocator *alloc, VkDeviceSize size, VkDeviceSize granularity)
+{
+    assert(alloc != nullptr);
+    assert(granularity > 0 && (granularity & (granularity - 1)) == 0);
+
+    alloc->size = size;
+    alloc->granularity = granularity;
+    alloc->first_unused_block = mg::TLSF_INVALID_BLOCK;
+    ::init(&alloc->blocks);
+
+    mg::free_all_blocks(alloc);
+}
+
+void mg::free(mg::tlsf_allocator *alloc)
+{
+    assert(alloc != nullptr);
+
+    ::free(&alloc->blocks);
+}
+
+u32 mg::allocate_block(mg::tlsf_allocator *alloc, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize *out_offset, u8 kind)
+{
+    assert(alloc != nullptr);
+    assert(out_offset != nullptr);
+    assert(size > 0);
+
+    if (alignment == 0)
+        alignment = 1;
+
+    u32 fl;
+    u32 sl;
+    ::tlsf_mapping_search(size + alignment - 1, &fl, &sl);
+    u32 index = ::tlsf_find_suitable_block(alloc, fl, sl);
+    VkDeviceSize aligned;
+
+    if (index == mg::TLSF_INVALID_BLOCK
+     || !::tlsf_fit(alloc, index, size, alignment, kind, &aligned))
+    {
+        // rounding up the size class may skip blocks that would fit and
+        // granularity padding may not fit the block of the class,
+        // the largest free block is always a candidate though.
+        index = alloc->largest_free_block;
+
+        if (index == mg::TLSF_INVALID_BLOCK
+         || !::tlsf_fit(alloc, index, size, alignment, kind, &aligned))
+            return mg::TLSF_INVALID_BLOCK;
+    }
+
+    ::tlsf_remove_free_block(alloc, index);
+
+    VkDeviceSize offset = alloc->blocks[index].range.offset;
+
+    // split off the alignment padding at the front. the physical neighbours
+    // of a free block are never free, so no merging is needed.
+    if (aligned > offset)
+    {
+        u32 front = ::tlsf_new_block(alloc);
+        mg::tlsf_block *block = alloc->blocks.data + index;
+        mg::tlsf_block *fblock = alloc->blocks.data + front;
+
+        fblock->range.offset = offset;
+        fblock->range.size = aligned - offset;
+        fblock->prev_physical = block->prev_physical;
+        fblock->next_physical = index;
+
+        if (block->prev_physical != mg::TLSF_INVALID_BLOCK)
+            alloc->blocks[block->prev_physical].next_physical = front;
+
+        block->prev_physical = front;
+        block->range.offset = aligned;
+        block->range.size -= fblock->range.size;
+
+        ::tlsf_insert_free_block(alloc, front);
+    }
+
+    // split off the remainder at the back
+    if (alloc->blocks[index].range.size > size)
+    {
+        u32 back = ::tlsf_new_block(alloc);
+        mg::tlsf_block *block = alloc->blocks.data + index;
+        mg::tlsf_block *bblock = alloc->blocks.data + back;
+
+        bblock->range.offset = aligned + size;
+        bblock->range.size = block->range.size - size;
+        bblock->prev_physical = index;
+        bblock->next_physical = block->next_physical;
+
+        if (block->next_physical != mg::TLSF_INVALID_BLOCK)
+            alloc->blocks[block->next_physical].prev_physical = back;
+
+        block->next_physical = back;
+        block->range.size = size;
+
+        ::tlsf_insert_free_block(alloc, back);
+    }
+
+    alloc->blocks[index].state = mg::tlsf_block_state::Allocated;
+    alloc->blocks[index].kind = kind;
+    alloc->total_free_space -= size;
+
+    *out_offset = aligned;
+    return index;
+}
+
+void mg::free_block(mg::tlsf_allocator *alloc, u32 index)
+{
+    assert(alloc != nullptr);
+    assert(index < alloc->blocks.size);
+    assert(alloc->blocks[index].state == mg::tlsf_block_state::Allocated);
+
+    alloc->total_free_space += alloc->blocks[index].range.size;
+
+    u32 prev = alloc->blocks[index].prev_physical;
+
+    if (prev != mg::TLSF_INVALID_BLOCK
+     && alloc->blocks[prev].state == mg::tlsf_block_state::Free)
+    {
+        ::tlsf_remove_free_block(alloc, prev);
+
+        mg::tlsf_block *pblock = alloc->blocks.data + prev;
+        mg::tlsf_block *block = alloc->blocks.data + index;
+        pblock->range.size += block->range.size;
+        pblock->next_physical = block->next_physical;
+
+        if (block->next_physical != mg::TLSF_INVALID_BLOCK)
+            alloc->blocks[block->next_physical].prev_physical = prev;
+
+        ::tlsf_release_block(alloc, index);
+        index = prev;
+    }
+
+    u32 next = alloc->blocks[index].next_physical;
+
+    if (next != mg::TLSF_INVALID_BLOCK
+     && alloc->blocks[next].state == mg::tlsf_block_state::Free)
+    {
+        ::tlsf_remove_free_block(alloc, next);
+
+        mg::tlsf_block *block = alloc->blocks.data + index;
+        mg::tlsf_block *nblock = alloc->blocks.data + next;
+        block->range.size += nblock->range.size;
+        block->next_physical = nblock->next_physical;
+
+        if (nblock->next_physical != mg::TLSF_INVALID_BLOCK)
+            alloc->blocks[nblock->next_physical].prev_physical = index;
+
+        ::tlsf_release_block(alloc, next);
+    }
+
+    ::tlsf_insert_free_block(alloc, index);
+}
+
+void mg::free_all_blocks(mg::tlsf_allocator *alloc)
+{
+    assert(alloc != nullptr);
+
+    alloc->total_free_space = alloc->size;
+    alloc->largest_free_block = mg::TLSF_INVALID_BLOCK;
+    alloc->fl_bitmap = 0;
+    alloc->first_unused_block = mg::TLSF_INVALID_BLOCK;
+
+    for (u32 fl = 0; fl < mg::TLSF_FL_COUNT; ++fl)
+    {
+        alloc->sl_bitmap[fl] = 0;
+
+        for (u32 sl = 0; sl < mg::TLSF_SL_COUNT; ++sl)
+            alloc->free_lists[fl][sl] = mg::TLSF_INVALID_BLOCK;
+    }
+
+    ::clear(&alloc->blocks);
+
+    if (alloc->size == 0)
+        return;
+
+    u32 index = ::tlsf_new_block(alloc);
+    alloc->blocks[index].range.offset = 0;
+    alloc->blocks[index].range.size = alloc->size;
+    ::tlsf_insert_free_block(alloc, index);
+}
+
+bool mg::has_space_for(mg::tlsf_allocator *alloc, VkDeviceSize size, VkDeviceSize alignment, u8 kind)
+{
+    assert(alloc != nullptr);
+
+    if (alloc->largest_free_block == mg::TLSF_INVALID_BLOCK)
+        return false;
+
+    if (alignment == 0)
+        alignment = 1;
+
+    VkDeviceSize offset;
+    return ::tlsf_fit(alloc, alloc->largest_free_block, size, alignment, kind, &offset);
+}
+
+mg::tlsf_range mg::largest_free_range(mg::tlsf_allocator *alloc)
+{
+    assert(alloc != nullptr);
+
+    if (alloc->largest_free_block == mg::TLSF_INVALID_BLOCK)
+        return mg::tlsf_range{0, 0};
+
+    return alloc->blocks[alloc->largest_free_block].range;
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <vulkan/vulkan_core.h>
+
+#include "shl/array.hpp"
+#include "shl/number_types.hpp"
+
+#include "mg/number_range.hpp"
+
+// two-level segregated fit (TLSF) allocator.
+// only keeps track of ranges inside [0, size), does not allocate any GPU
+// memory by itself. free blocks are kept in size classes, the first level
+// being the power of two of the size, the second level splitting each power
+// of two linearly into TLSF_SL_COUNT classes. bitmaps of non-empty classes
+// make finding a free block, allocating and freeing O(1).
+// the largest free block is updated whenever a block becomes free, only
+// when it is allocated or merged the highest size class is searched again.
+//
+// blocks are referred to by their index in the blocks array, which stays
+// valid until the block is freed.
+//
+// allocated blocks may have a kind. blocks of different non-zero kinds are
+// never placed on the same page of granularity bytes, which is what
+// bufferImageGranularity requires of linear and non-linear resources.
+// padding is only added where such blocks would be neighbours.
+namespace mg
+{
+constexpr const u32 TLSF_SL_COUNT_LOG2 = 5;
+constexpr const u32 TLSF_SL_COUNT = 1u << TLSF_SL_COUNT_LOG2;
+constexpr const u32 TLSF_FL_COUNT = 64 - TLSF_SL_COUNT_LOG2 + 1;
+constexpr const u32 TLSF_INVALID_BLOCK = UINT32_MAX;
+
+typedef number_range<VkDeviceSize> tlsf_range;
+
+enum class tlsf_block_state : u8
+{
+    Unused,
+    Free,
+    Allocated
+};
+
+struct tlsf_block
+{
+    mg::tlsf_range range;
+    mg::tlsf_block_state state;
+    u8 kind; // of allocated blocks, 0 never conflicts
+
+    u32 prev_physical;
+    u32 next_physical;
+
+    // links inside the free list of the size class if state is Free,
+    // next_free links unused blocks if state is Unused.
+    u32 prev_free;
+    u32 next_free;
+};
+
+struct tlsf_allocator
+{
+    VkDeviceSize size;
+    VkDeviceSize granularity; // power of two
+    VkDeviceSize total_free_space;
+    u32 largest_free_block;
+
+    u64 fl_bitmap;
+    u32 sl_bitmap[TLSF_FL_COUNT];
+    u32 free_lists[TLSF_FL_COUNT][TLSF_SL_COUNT];
+
+    u32 first_unused_block;
+    array<mg::tlsf_block> blocks;
+};
+
+void init(mg::tlsf_allocator *alloc, VkDeviceSize size, VkDeviceSize granularity = 1);
+void free(mg::tlsf_allocator *alloc);
+
+// returns the index of the allocated block and writes the aligned offset
+// of the block to out_offset, or returns TLSF_INVALID_BLOCK if no free block
+// can fit size bytes with the given alignment.
+u32 allocate_block(mg::tlsf_allocator *alloc, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize *out_offset, u8 kind = 0);
+void free_block(mg::tlsf_allocator *alloc, u32 block);
+void free_all_blocks(mg::tlsf_allocator *alloc);
+
+// if this returns true, allocate_block with the same parameters succeeds.
+bool has_space_for(mg::tlsf_allocator *alloc, VkDeviceSize size, VkDeviceSize alignment, u8 kind = 0);
+mg::tlsf_range largest_free_range(mg::tlsf_allocator *alloc);
+}
@@ -0,0 +1,616 @@
+
+#include <assert.h>
+
+#include "shl/debug.hpp"
+#include "shl/error.hpp"
+
+#include "mg/vk_error.hpp"
+#include "mg/impl/context.hpp"
+#include "mg/impl/transfer_queue.hpp"
+
+VkCommandPool create_command_pool(mg::transfer_queue *q, VkDevice device, u32 family_index)
+{
+    VkCommandPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.queueFamilyIndex = family_index;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+
+    VkCommandPool ret;
+    VkResult res = vkCreateCommandPool(device, &poolInfo, nullptr, &ret);
+
+    if (res != VK_SUCCESS)
+        throw_vk_error(res, "%p failed to create command pool for queue family %u", q, family_index);
+
+    return ret;
+}
+
+VkSemaphore create_timeline_semaphore(mg::transfer_queue *q, VkDevice device)
+{
+    VkSemaphoreTypeCreateInfo typeInfo{};
+    typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+    typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+    typeInfo.initialValue = 0;
+
+    VkSemaphoreCreateInfo semaphoreInfo{};
+    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    semaphoreInfo.pNext = &typeInfo;
+
+    VkSemaphore ret;
+    VkResult res = vkCreateSemaphore(device, &semaphoreInfo, nullptr, &ret);
+
+    if (res != VK_SUCCESS)
+        throw_vk_error(res, "%p failed to create timeline semaphore", q);
+
+    return ret;
+}
+
+void mg::init(mg::transfer_queue *q, VkDevice device, VkQueue queue, u32 family_index, VkQueue graphics_queue, u32 graphics_family_index)
+{
+    assert(q != nullptr);
+    assert(device != nullptr);
+    assert(queue != nullptr);
+    assert(graphics_queue != nullptr);
+
+    q->queue = queue;
+    q->family_index = family_index;
+    q->graphics_queue = graphics_queue;
+    q->graphics_family_index = graphics_family_index;
+    q->value = 0;
+    q->completed = 0;
+    q->frame_wait_value = 0;
+    q->graphics_value = 0;
+    q->graphics_completed = 0;
+
+    ::init(&q->batches);
+    ::init(&q->spills);
+    ::init(&q->graphics_batches);
+    ::init(&q->buffer_returns);
+    ::init(&q->image_returns);
+    ::init(&q->buffer_return_acquires);
+    ::init(&q->image_return_acquires);
+    ::init(&q->buffer_transfer_acquires);
+    ::init(&q->image_transfer_acquires);
+    ::init(&q->buffer_releases);
+    ::init(&q->image_releases);
+    ::init(&q->buffer_acquires);
+    ::init(&q->image_acquires);
+
+    q->command_pool = ::create_command_pool(q, device, family_index);
+    q->graphics_command_pool = ::create_command_pool(q, device, graphics_family_index);
+    q->timeline = ::create_timeline_semaphore(q, device);
+    q->graphics_timeline = ::create_timeline_semaphore(q, device);
+}
+
+void mg::free(mg::transfer_queue *q, VkDevice device, mg::memory_manager *mgr)
+{
+    assert(q != nullptr);
+    assert(mgr != nullptr);
+
+    for_array(spill, &q->spills)
+        mg::destroy_sub_buffer(mgr, spill->sub_buffer);
+
+    ::free(&q->batches);
+    ::free(&q->spills);
+    ::free(&q->graphics_batches);
+    ::free(&q->buffer_returns);
+    ::free(&q->image_returns);
+    ::free(&q->buffer_return_acquires);
+    ::free(&q->image_return_acquires);
+    ::free(&q->buffer_transfer_acquires);
+    ::free(&q->image_transfer_acquires);
+    ::free(&q->buffer_releases);
+    ::free(&q->image_releases);
+    ::free(&q->buffer_acquires);
+    ::free(&q->image_acquires);
+
+    // frees the command buffers too
+    vkDestroyCommandPool(device, q->command_pool, nullptr);
+    vkDestroyCommandPool(device, q->graphics_command_pool, nullptr);
+    vkDestroySemaphore(device, q->timeline, nullptr);
+    vkDestroySemaphore(device, q->graphics_timeline, nullptr);
+
+    q->command_pool = nullptr;
+    q->graphics_command_pool = nullptr;
+    q->timeline = nullptr;
+    q->graphics_timeline = nullptr;
+}
+
+// reuses the command buffer of a finished batch in batches
+mg::transfer_batch *begin_command_buffer(mg::transfer_queue *q, VkDevice device, array<mg::transfer_batch> *batches, VkCommandPool pool)
+{
+    mg::transfer_batch *ret = nullptr;
+
+    for_array(batch, batches)
+        if (!batch->pending)
+        {
+            ret = batch;
+            break;
+        }
+
+    if (ret == nullptr)
+    {
+        ret = ::add_at_end(batches);
+        ret->value = 0;
+        ret->pending = false;
+
+        VkCommandBufferAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.commandPool = pool;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocInfo.commandBufferCount = 1;
+
+        VkResult res = vkAllocateCommandBuffers(device, &allocInfo, &ret->command_buffer);
+
+        if (res != VK_SUCCESS)
+            throw_vk_error(res, "%p failed to allocate transfer command buffer", q);
+
+        trace("transfer queue %p: new batch, %u total\n", q, batches->size);
+    }
+    else
+        vkResetCommandBuffer(ret->command_buffer, 0);
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+    VkResult res = vkBeginCommandBuffer(ret->command_buffer, &beginInfo);
+
+    if (res != VK_SUCCESS)
+        throw_vk_error(res, "%p could not begin transfer command buffer", q);
+
+    return ret;
+}
+
+mg::transfer_batch *mg::begin_batch(mg::transfer_queue *q, VkDevice device, mg::memory_manager *mgr)
+{
+    assert(q != nullptr);
+
+    mg::update_completed(q, device, mgr);
+
+    return ::begin_command_buffer(q, device, &q->batches, q->command_pool);
+}
+
+// releases the resources of buffer_returns and image_returns on the graphics
+// queue, the batch that acquires them waits for graphics_value.
+// resources released by earlier batches are acquired first, which has to
+// wait for those batches.
+void submit_returns(mg::transfer_queue *q, VkDevice device)
+{
+    mg::transfer_batch *batch = ::begin_command_buffer(q, device, &q->graphics_batches, q->graphics_command_pool);
+    bool acquires = q->buffer_return_acquires.size > 0 || q->image_return_acquires.size > 0;
+
+    if (acquires)
+    {
+        vkCmdPipelineBarrier(batch->command_buffer,
+                             VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                             VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                             0,
+                             0, nullptr,
+                             (u32)q->buffer_return_acquires.size, q->buffer_return_acquires.data,
+                             (u32)q->image_return_acquires.size, q->image_return_acquires.data);
+
+        ::clear(&q->buffer_return_acquires);
+        ::clear(&q->image_return_acquires);
+    }
+
+    vkCmdPipelineBarrier(batch->command_buffer,
+                         VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                         VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                         0,
+                         0, nullptr,
+                         (u32)q->buffer_returns.size, q->buffer_returns.data,
+                         (u32)q->image_returns.size, q->image_returns.data);
+
+    ::clear(&q->buffer_returns);
+    ::clear(&q->image_returns);
+
+    vkEndCommandBuffer(batch->command_buffer);
+
+    batch->value = mg::next_graphics_value(q);
+    batch->pending = true;
+
+    // the acquired resources were released by batches up to q->value
+    VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+
+    VkTimelineSemaphoreSubmitInfo timelineInfo{};
+    timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    timelineInfo.waitSemaphoreValueCount = acquires ? 1 : 0;
+    timelineInfo.pWaitSemaphoreValues = &q->value;
+    timelineInfo.signalSemaphoreValueCount = 1;
+    timelineInfo.pSignalSemaphoreValues = &batch->value;
+
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.pNext = &timelineInfo;
+    submitInfo.waitSemaphoreCount = acquires ? 1 : 0;
+    submitInfo.pWaitSemaphores = &q->timeline;
+    submitInfo.pWaitDstStageMask = &waitStage;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &batch->command_buffer;
+    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.pSignalSemaphores = &q->graphics_timeline;
+
+    VkResult res = vkQueueSubmit(q->graphics_queue, 1, &submitInfo, nullptr);
+
+    if (res != VK_SUCCESS)
+        throw_vk_error(res, "%p failed to submit ownership release command buffer", q);
+}
+
+u64 mg::submit_batch(mg::transfer_queue *q, VkDevice device, mg::transfer_batch *batch, bool wait_for_frames, bool read_by_frames)
+{
+    assert(q != nullptr);
+    assert(batch != nullptr);
+    assert(!batch->pending);
+    assert(q->buffer_transfer_acquires.size == 0 && q->image_transfer_acquires.size == 0);
+
+    bool returns = q->buffer_returns.size > 0 || q->image_returns.size > 0;
+    bool releases = q->buffer_releases.size > 0 || q->image_releases.size > 0;
+
+    if (returns)
+        ::submit_returns(q, device);
+
+    if (releases)
+    {
+        vkCmdPipelineBarrier(batch->command_buffer,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                             0,
+                             0, nullptr,
+                             (u32)q->buffer_releases.size, q->buffer_releases.data,
+                             (u32)q->image_releases.size, q->image_releases.data);
+
+        ::clear(&q->buffer_releases);
+        ::clear(&q->image_releases);
+    }
+
+    vkEndCommandBuffer(batch->command_buffer);
+
+    q->value += 1;
+    batch->value = q->value;
+    batch->pending = true;
+
+    if (read_by_frames || releases)
+        q->frame_wait_value = batch->value;
+
+    // frames that were submitted before may still read the destinations.
+    // the returns are submitted after them, so waiting for the returns
+    // waits for the frames too.
+    bool wait = returns || (wait_for_frames && q->graphics_completed < q->graphics_value);
+    VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+
+    VkTimelineSemaphoreSubmitInfo timelineInfo{};
+    timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    timelineInfo.waitSemaphoreValueCount = wait ? 1 : 0;
+    timelineInfo.pWaitSemaphoreValues = &q->graphics_value;
+    timelineInfo.signalSemaphoreValueCount = 1;
+    timelineInfo.pSignalSemaphoreValues = &batch->value;
+
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.pNext = &timelineInfo;
+    submitInfo.waitSemaphoreCount = wait ? 1 : 0;
+    submitInfo.pWaitSemaphores = &q->graphics_timeline;
+    submitInfo.pWaitDstStageMask = &waitStage;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &batch->command_buffer;
+    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.pSignalSemaphores = &q->timeline;
+
+    VkResult res = vkQueueSubmit(q->queue, 1, &submitInfo, nullptr);
+
+    if (res != VK_SUCCESS)
+        throw_vk_error(res, "%p failed to submit transfer command buffer", q);
+
+    return batch->value;
+}
+
+u64 mg::next_graphics_value(mg::transfer_queue *q)
+{
+    assert(q != nullptr);
+
+    q->graphics_value += 1;
+    return q->graphics_value;
+}
+
+u64 mg::update_graphics_completed(mg::transfer_queue *q, VkDevice device)
+{
+    assert(q != nullptr);
+
+    if (q->graphics_completed == q->graphics_value)
+        return q->graphics_completed;
+
+    u64 value;
+    VkResult res = vkGetSemaphoreCounterValue(device, q->graphics_timeline, &value);
+
+    if (res != VK_SUCCESS)
+        throw_vk_error(res, "%p could not get graphics timeline value", q);
+
+    q->graphics_completed = value;
+
+    for_array(batch, &q->graphics_batches)
+        if (batch->pending && batch->value <= value)
+            batch->pending = false;
+
+    return value;
+}
+
+void mg::wait_graphics(mg::transfer_queue *q, VkDevice device, u64 value)
+{
+    assert(q != nullptr);
+    assert(value <= q->graphics_value);
+
+    if (value <= q->graphics_completed)
+        return;
+
+    VkSemaphoreWaitInfo waitInfo{};
+    waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+    waitInfo.semaphoreCount = 1;
+    waitInfo.pSemaphores = &q->graphics_timeline;
+    waitInfo.pValues = &value;
+
+    VkResult res = vkWaitSemaphores(device, &waitInfo, UINT64_MAX);
+
+    if (res != VK_SUCCESS)
+        throw_vk_error(res, "%p failed to wait for graphics timeline value %u", q, value);
+
+    mg::update_graphics_completed(q, device);
+}
+
+u64 mg::update_completed(mg::transfer_queue *q, VkDevice device, mg::memory_manager *mgr)
+{
+    assert(q != nullptr);
+    assert(mgr != nullptr);
+
+    mg::update_graphics_completed(q, device);
+
+    if (q->completed == q->value)
+        return q->completed;
+
+    u64 value;
+    VkResult res = vkGetSemaphoreCounterValue(device, q->timeline, &value);
+
+    if (res != VK_SUCCESS)
+        throw_vk_error(res, "%p could not get transfer timeline value", q);
+
+    q->completed = value;
+
+    for_array(batch, &q->batches)
+        if (batch->pending && batch->value <= value)
+            batch->pending = false;
+
+    // in order of value
+    u64 count = 0;
+
+    while (count < q->spills.size && q->spills[count].value <= value)
+    {
+        mg::destroy_sub_buffer(mgr, q->spills[count].sub_buffer);
+        ++count;
+    }
+
+    if (count > 0)
+        ::remove_elements(&q->spills, 0, count);
+
+    return value;
+}
+
+void mg::wait(mg::transfer_queue *q, VkDevice device, mg::memory_manager *mgr, u64 value)
+{
+    assert(q != nullptr);
+    assert(value <= q->value);
+
+    if (value <= q->completed)
+        return;
+
+    VkSemaphoreWaitInfo waitInfo{};
+    waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+    waitInfo.semaphoreCount = 1;
+    waitInfo.pSemaphores = &q->timeline;
+    waitInfo.pValues = &value;
+
+    VkResult res = vkWaitSemaphores(device, &waitInfo, UINT64_MAX);
+
+    if (res != VK_SUCCESS)
+        throw_vk_error(res, "%p failed to wait for transfer timeline value %u", q, value);
+
+    mg::update_completed(q, device, mgr);
+}
+
+void mg::add_spill(mg::transfer_queue *q, u64 value, mg::vk_sub_buffer *sb)
+{
+    assert(q != nullptr);
+    assert(sb != nullptr);
+    assert(value > q->completed);
+    assert(q->spills.size == 0 || q->spills[q->spills.size - 1].value <= value);
+
+    ::add_at_end(&q->spills, mg::transfer_spill{value, sb});
+}
+
+bool mg::transfers_ownership(const mg::transfer_queue *q, VkSharingMode sharemode)
+{
+    assert(q != nullptr);
+
+    return q->family_index != q->graphics_family_index
+        && sharemode == VK_SHARING_MODE_EXCLUSIVE;
+}
+
+// moves the acquire of buffer queued by an earlier batch from acquires to
+// return_acquires, so it is recorded before the buffer is released again
+void take_pending_acquire(array<VkBufferMemoryBarrier> *acquires, array<VkBufferMemoryBarrier> *return_acquires, VkBuffer buffer)
+{
+    for_array(i, barrier, acquires)
+        if (barrier->buffer == buffer)
+        {
+            ::add_at_end(return_acquires, *barrier);
+            ::remove_elements(acquires, i, 1);
+            return;
+        }
+}
+
+void take_pending_acquire(array<VkImageMemoryBarrier> *acquires, array<VkImageMemoryBarrier> *return_acquires, VkImage image)
+{
+    for_array(i, barrier, acquires)
+        if (barrier->image == image)
+        {
+            ::add_at_end(return_acquires, *barrier);
+            ::remove_elements(acquires, i, 1);
+            return;
+        }
+}
+
+void mg::acquire_buffer(mg::transfer_queue *q, mg::vk_buffer *buf, VkDeviceSize offset, VkDeviceSize size)
+{
+    assert(q != nullptr);
+    assert(buf != nullptr);
+    assert(buf->buffer != nullptr);
+
+    // taking a buffer no queue used yet needs no ownership transfer
+    if (buf->queue_family == VK_QUEUE_FAMILY_IGNORED)
+        return;
+
+    assert(buf->queue_family == q->graphics_family_index);
+
+    ::take_pending_acquire(&q->buffer_acquires, &q->buffer_return_acquires, buf->buffer);
+
+    VkBufferMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+    barrier.dstAccessMask = 0;
+    barrier.srcQueueFamilyIndex = q->graphics_family_index;
+    barrier.dstQueueFamilyIndex = q->family_index;
+    barrier.buffer = buf->buffer;
+    barrier.offset = offset;
+    barrier.size = size;
+
+    ::add_at_end(&q->buffer_returns, barrier);
+
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+    ::add_at_end(&q->buffer_transfer_acquires, barrier);
+}
+
+void mg::acquire_image(mg::transfer_queue *q, mg::vk_image *img, VkImageSubresourceRange range)
+{
+    assert(q != nullptr);
+    assert(img != nullptr);
+    assert(img->image != nullptr);
+
+    if (img->queue_family == VK_QUEUE_FAMILY_IGNORED)
+        return;
+
+    assert(img->queue_family == q->graphics_family_index);
+
+    ::take_pending_acquire(&q->image_acquires, &q->image_return_acquires, img->image);
+
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+    barrier.dstAccessMask = 0;
+    barrier.oldLayout = img->layout;
+    barrier.newLayout = img->layout;
+    barrier.srcQueueFamilyIndex = q->graphics_family_index;
+    barrier.dstQueueFamilyIndex = q->family_index;
+    barrier.image = img->image;
+    barrier.subresourceRange = range;
+
+    ::add_at_end(&q->image_returns, barrier);
+
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+    ::add_at_end(&q->image_transfer_acquires, barrier);
+}
+
+void mg::record_transfer_acquires(mg::transfer_queue *q, VkCommandBuffer cmd)
+{
+    assert(q != nullptr);
+    assert(cmd != nullptr);
+
+    if (q->buffer_transfer_acquires.size == 0 && q->image_transfer_acquires.size == 0)
+        return;
+
+    vkCmdPipelineBarrier(cmd,
+                         VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         0,
+                         0, nullptr,
+                         (u32)q->buffer_transfer_acquires.size, q->buffer_transfer_acquires.data,
+                         (u32)q->image_transfer_acquires.size, q->image_transfer_acquires.data);
+
+    ::clear(&q->buffer_transfer_acquires);
+    ::clear(&q->image_transfer_acquires);
+}
+
+void mg::release_buffer(mg::transfer_queue *q, mg::vk_buffer *buf, VkDeviceSize offset, VkDeviceSize size)
+{
+    assert(q != nullptr);
+    assert(buf != nullptr);
+    assert(buf->buffer != nullptr);
+
+    buf->queue_family = q->graphics_family_index;
+
+    VkBufferMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = 0;
+    barrier.srcQueueFamilyIndex = q->family_index;
+    barrier.dstQueueFamilyIndex = q->graphics_family_index;
+    barrier.buffer = buf->buffer;
+    barrier.offset = offset;
+    barrier.size = size;
+
+    ::add_at_end(&q->buffer_releases, barrier);
+
+    // the acquire has to match the release except for access masks
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+
+    ::add_at_end(&q->buffer_acquires, barrier);
+}
+
+void mg::release_image(mg::transfer_queue *q, mg::vk_image *img, VkImageSubresourceRange range)
+{
+    assert(q != nullptr);
+    assert(img != nullptr);
+    assert(img->image != nullptr);
+
+    img->queue_family = q->graphics_family_index;
+
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = 0;
+    barrier.oldLayout = img->layout;
+    barrier.newLayout = img->layout;
+    barrier.srcQueueFamilyIndex = q->family_index;
+    barrier.dstQueueFamilyIndex = q->graphics_family_index;
+    barrier.image = img->image;
+    barrier.subresourceRange = range;
+
+    ::add_at_end(&q->image_releases, barrier);
+
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+
+    ::add_at_end(&q->image_acquires, barrier);
+}
+
+void mg::record_acquire_barriers(mg::transfer_queue *q, VkCommandBuffer cmd)
+{
+    assert(q != nullptr);
+    assert(cmd != nullptr);
+
+    if (q->buffer_acquires.size == 0 && q->image_acquires.size == 0)
+        return;
+
+    vkCmdPipelineBarrier(cmd,
+                         VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                         VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                         0,
+                         0, nullptr,
+                         (u32)q->buffer_acquires.size, q->buffer_acquires.data,
+                         (u32)q->image_acquires.size, q->image_acquires.data);
+
+    ::clear(&q->buffer_acquires);
+    ::clear(&q->image_acquires);
+}
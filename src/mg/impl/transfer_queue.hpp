@@ -0,0 +1,151 @@
+#pragma once
+
+#include <vulkan/vulkan_core.h>
+
+#include "shl/array.hpp"
+#include "shl/number_types.hpp"
+
+#include "mg/impl/memory_manager.hpp"
+#include "mg/impl/vk_buffer.hpp"
+
+// asynchronous uploads on their own queue.
+// every submitted batch of copies signals the next value of a timeline
+// semaphore, the CPU never waits for a batch unless it has to reuse its memory.
+// work that reads the uploaded data waits on the semaphore instead.
+//
+// frames signal a second timeline semaphore. batches that write resources
+// frames submitted before may still use wait for those frames, so copies
+// never overwrite what a frame still reads. batches that only write
+// resources no frame used yet don't wait.
+// frames only wait for the batches whose data they read, see frame_wait_value.
+//
+// if the transfer queue belongs to another queue family than the graphics
+// queue, exclusively owned resources are released after the copies and
+// have to be acquired on the graphics queue, see record_acquire_barriers.
+// before the copies, the graphics queue releases them to the transfer queue
+// in a small batch of its own if it owns them, see acquire_buffer.
+// resources track their owning family, resources no queue used yet are
+// taken by the transfer queue without an ownership transfer.
+namespace mg
+{
+struct transfer_batch
+{
+    VkCommandBuffer command_buffer;
+    u64 value; // signalled once the batch is done
+    bool pending;
+};
+
+// staging sub-buffer that is destroyed once value is reached
+struct transfer_spill
+{
+    u64 value;
+    mg::vk_sub_buffer *sub_buffer;
+};
+
+struct transfer_queue
+{
+    VkQueue queue;
+    u32 family_index;
+    VkQueue graphics_queue;
+    u32 graphics_family_index;
+
+    VkCommandPool command_pool;
+    VkSemaphore timeline;
+    u64 value;     // last submitted value
+    u64 completed; // last value known to be reached
+
+    // value the next frame waits for: the last batch with data frames may
+    // read right away or with releases the next frame acquires. not batches
+    // that only carry chunks of unfinished file uploads.
+    u64 frame_wait_value;
+
+    array<mg::transfer_batch> batches;
+    array<mg::transfer_spill> spills;
+
+    // signalled by every frame and every batch of graphics_batches
+    VkSemaphore graphics_timeline;
+    u64 graphics_value;
+    u64 graphics_completed;
+
+    // ownership releases from the graphics queue to the transfer queue
+    VkCommandPool graphics_command_pool;
+    array<mg::transfer_batch> graphics_batches;
+    array<VkBufferMemoryBarrier> buffer_returns;
+    array<VkImageMemoryBarrier> image_returns;
+
+    // acquires of resources released by earlier batches that no frame
+    // recorded yet, recorded on the graphics queue before the returns
+    array<VkBufferMemoryBarrier> buffer_return_acquires;
+    array<VkImageMemoryBarrier> image_return_acquires;
+
+    // acquire half of buffer_returns and image_returns, recorded on q
+    array<VkBufferMemoryBarrier> buffer_transfer_acquires;
+    array<VkImageMemoryBarrier> image_transfer_acquires;
+
+    // ownership transfers of the batch that is being recorded
+    array<VkBufferMemoryBarrier> buffer_releases;
+    array<VkImageMemoryBarrier> image_releases;
+
+    // ownership transfers of submitted batches, recorded on the graphics queue
+    array<VkBufferMemoryBarrier> buffer_acquires;
+    array<VkImageMemoryBarrier> image_acquires;
+};
+
+void init(mg::transfer_queue *q, VkDevice device, VkQueue queue, u32 family_index, VkQueue graphics_queue, u32 graphics_family_index);
+// the queue must be idle
+void free(mg::transfer_queue *q, VkDevice device, mg::memory_manager *mgr);
+
+// begins recording a batch, reusing the command buffer of a finished batch
+mg::transfer_batch *begin_batch(mg::transfer_queue *q, VkDevice device, mg::memory_manager *mgr);
+// ends recording, records the ownership releases and submits the batch.
+// ownership is returned to q on the graphics queue first if needed.
+// the batch waits for everything submitted to the graphics queue before it
+// if wait_for_frames is set or ownership is returned, otherwise it only
+// writes resources no frame used yet.
+// if read_by_frames is set or the batch releases resources, the next frame
+// waits for it.
+// returns the value the batch signals.
+u64 submit_batch(mg::transfer_queue *q, VkDevice device, mg::transfer_batch *batch, bool wait_for_frames, bool read_by_frames);
+
+// polls the semaphore and cleans up after finished batches, returns completed
+u64 update_completed(mg::transfer_queue *q, VkDevice device, mg::memory_manager *mgr);
+// value of the graphics timeline the next frame has to signal when it is
+// submitted on the graphics queue
+u64 next_graphics_value(mg::transfer_queue *q);
+
+// polls the graphics timeline, returns graphics_completed
+u64 update_graphics_completed(mg::transfer_queue *q, VkDevice device);
+// blocks until the graphics timeline reaches value
+void wait_graphics(mg::transfer_queue *q, VkDevice device, u64 value);
+
+// blocks until value is reached
+void wait(mg::transfer_queue *q, VkDevice device, mg::memory_manager *mgr, u64 value);
+
+// keeps sb alive until value is reached. value may belong to a submission
+// on another queue that signals the timeline semaphore, e.g. a frame.
+void add_spill(mg::transfer_queue *q, u64 value, mg::vk_sub_buffer *sb);
+
+// whether resources written on q have to change queue family before the
+// graphics queue can use them
+bool transfers_ownership(const mg::transfer_queue *q, VkSharingMode sharemode);
+// the resource is written by the current batch. if the graphics queue owns
+// it, records its ownership transfer from the graphics queue into cmd and
+// queues the matching release on the graphics queue, which is submitted
+// before the batch. if an earlier batch released it and no frame acquired
+// it yet, the graphics queue acquires it right before that release.
+// does nothing for resources no queue used yet.
+// record_transfer_acquires has to be called before the resource is written.
+void acquire_buffer(mg::transfer_queue *q, mg::vk_buffer *buf, VkDeviceSize offset, VkDeviceSize size);
+void acquire_image(mg::transfer_queue *q, mg::vk_image *img, VkImageSubresourceRange range);
+void record_transfer_acquires(mg::transfer_queue *q, VkCommandBuffer cmd);
+
+// queue the ownership transfer of a resource written by the current batch
+// to the graphics queue, which owns it afterwards
+void release_buffer(mg::transfer_queue *q, mg::vk_buffer *buf, VkDeviceSize offset, VkDeviceSize size);
+void release_image(mg::transfer_queue *q, mg::vk_image *img, VkImageSubresourceRange range);
+
+// records the acquire half of all released resources.
+// cmd must be recording on the graphics queue, outside of a render pass,
+// and be submitted after waiting on the timeline semaphore.
+void record_acquire_barriers(mg::transfer_queue *q, VkCommandBuffer cmd);
+}
@@ -0,0 +1,315 @@
+
+#include <assert.h>
+
+#include "shl/compare.hpp"
+#include "shl/debug.hpp"
+#include "shl/defer.hpp"
+#include "shl/error.hpp"
+
+#include "mg/vk_error.hpp"
+#include "mg/number_range.hpp"
+#include "mg/impl/context.hpp"
+#include "mg/impl/transient_allocator.hpp"
+
+void mg::init(mg::transient_allocator *alloc)
+{
+    assert(alloc != nullptr);
+
+    ::init(&alloc->resources);
+    alloc->memory = nullptr;
+    alloc->memory_block = mg::TLSF_INVALID_BLOCK;
+    alloc->size = 0;
+    alloc->unaliased_size = 0;
+}
+
+void mg::free(mg::transient_allocator *alloc, mg::memory_manager *mgr)
+{
+    assert(alloc != nullptr);
+    assert(mgr != nullptr);
+
+    for_array(res, &alloc->resources)
+    {
+        if (res->type == mg::memory_binding_type::Buffer)
+            mg::destroy_buffer(mgr, res->buffer);
+        else
+            mg::destroy_image(mgr, res->image);
+    }
+
+    ::free(&alloc->resources);
+
+    if (alloc->memory != nullptr)
+    {
+        mg::release_block(alloc->memory, alloc->memory_block);
+        mg::free_memory(&mgr->allocator, alloc->memory);
+    }
+
+    alloc->memory = nullptr;
+    alloc->memory_block = mg::TLSF_INVALID_BLOCK;
+    alloc->size = 0;
+    alloc->unaliased_size = 0;
+}
+
+mg::transient_resource *add_transient_resource(mg::transient_allocator *alloc, u32 first_pass, u32 last_pass)
+{
+    assert(alloc->memory == nullptr);
+    assert(first_pass <= last_pass);
+
+    mg::transient_resource *ret = ::add_at_end(&alloc->resources);
+    ret->buffer = nullptr;
+    ret->image = nullptr;
+    ret->first_pass = first_pass;
+    ret->last_pass = last_pass;
+    ret->offset = 0;
+    ret->aliased = false;
+
+    return ret;
+}
+
+mg::vk_buffer *mg::create_transient_buffer(mg::transient_allocator *alloc, mg::memory_manager *mgr, u32 first_pass, u32 last_pass, VkDeviceSize size, VkBufferUsageFlags usage, VkSharingMode sharemode)
+{
+    assert(alloc != nullptr);
+    assert(mgr != nullptr);
+
+    mg::vk_buffer *buf = mg::create_buffer(mgr, size, usage, sharemode);
+
+    mg::transient_resource *res = ::add_transient_resource(alloc, first_pass, last_pass);
+    res->type = mg::memory_binding_type::Buffer;
+    res->buffer = buf;
+    res->kind = mg::memory_resource_kind::Linear;
+    vkGetBufferMemoryRequirements(mgr->context->device, buf->buffer, &res->reqs);
+
+    return buf;
+}
+
+mg::vk_image *mg::create_transient_image(mg::transient_allocator *alloc, mg::memory_manager *mgr, u32 first_pass, u32 last_pass, VkImageCreateInfo *info)
+{
+    assert(alloc != nullptr);
+    assert(mgr != nullptr);
+
+    mg::vk_image *img = mg::create_image(mgr, info);
+
+    mg::transient_resource *res = ::add_transient_resource(alloc, first_pass, last_pass);
+    res->type = mg::memory_binding_type::Image;
+    res->image = img;
+    res->kind = mg::get_resource_kind(img);
+    vkGetImageMemoryRequirements(mgr->context->device, img->image, &res->reqs);
+
+    return img;
+}
+
+inline bool passes_overlap(const mg::transient_resource *a, const mg::transient_resource *b)
+{
+    return a->first_pass <= b->last_pass && b->first_pass <= a->last_pass;
+}
+
+inline bool memory_overlaps(const mg::transient_resource *a, const mg::transient_resource *b)
+{
+    return a->offset < b->offset + b->reqs.size && b->offset < a->offset + a->reqs.size;
+}
+
+// the memory res may not be placed in because of other, which is alive at
+// the same time. linear and non-linear resources may not share a page
+// of bufferImageGranularity.
+mg::bind_range occupied_range(const mg::transient_resource *res, const mg::transient_resource *other, VkDeviceSize granularity)
+{
+    mg::bind_range ret{other->offset, other->reqs.size};
+
+    if (granularity > 1 && res->kind != other->kind)
+    {
+        VkDeviceSize start = ret.offset & ~(granularity - 1);
+        ret.size = mg::align_next(ret.offset + ret.size, granularity) - start;
+        ret.offset = start;
+    }
+
+    return ret;
+}
+
+// lowest offset at which res does not overlap any of the placed resources
+// that are alive at the same time.
+VkDeviceSize place_transient_resource(mg::transient_allocator *alloc, mg::transient_resource *res, array<u32> *placed, VkDeviceSize granularity)
+{
+    array<mg::bind_range> occupied;
+    ::init(&occupied);
+    defer { ::free(&occupied); };
+
+    // sorted by offset
+    for_array(i, placed)
+    {
+        mg::transient_resource *other = alloc->resources.data + *i;
+
+        if (!::passes_overlap(res, other))
+            continue;
+
+        mg::bind_range range = ::occupied_range(res, other, granularity);
+        u64 at = 0;
+
+        while (at < occupied.size && occupied[at].offset < range.offset)
+            ++at;
+
+        *::insert_elements(&occupied, at, 1) = range;
+    }
+
+    VkDeviceSize offset = 0;
+
+    for_array(range, &occupied)
+    {
+        if (mg::align_next(offset, res->reqs.alignment) + res->reqs.size <= range->offset)
+            break;
+
+        offset = Max(offset, range->offset + range->size);
+    }
+
+    return mg::align_next(offset, res->reqs.alignment);
+}
+
+void mg::bind_transient_resources(mg::transient_allocator *alloc, mg::memory_manager *mgr)
+{
+    assert(alloc != nullptr);
+    assert(mgr != nullptr);
+    assert(alloc->memory == nullptr);
+
+    if (alloc->resources.size == 0)
+        return;
+
+    VkDevice dev = mgr->context->device;
+    VkDeviceSize granularity = Max(mgr->context->physical_device_properties.limits.bufferImageGranularity, (VkDeviceSize)1);
+    VkDeviceSize alignment = 1;
+    u32 type_bits = UINT32_MAX;
+
+    // largest first, smaller resources then fill the gaps
+    array<u32> order;
+    ::init(&order);
+    defer { ::free(&order); };
+
+    for_array(i, res, &alloc->resources)
+    {
+        u64 at = 0;
+
+        while (at < order.size && alloc->resources[order[at]].reqs.size >= res->reqs.size)
+            ++at;
+
+        *::insert_elements(&order, at, 1) = (u32)i;
+
+        alignment = Max(alignment, res->reqs.alignment);
+        type_bits &= res->reqs.memoryTypeBits;
+        alloc->unaliased_size += res->reqs.size;
+    }
+
+    array<u32> placed;
+    ::init(&placed);
+    defer { ::free(&placed); };
+
+    alloc->size = 0;
+
+    for_array(i, &order)
+    {
+        mg::transient_resource *res = alloc->resources.data + *i;
+        res->offset = ::place_transient_resource(alloc, res, &placed, granularity);
+        alloc->size = Max(alloc->size, res->offset + res->reqs.size);
+
+        ::add_at_end(&placed, *i);
+    }
+
+    for_array(i, a, &alloc->resources)
+        for_array(j, b, &alloc->resources)
+            if (i != j && ::memory_overlaps(a, b))
+            {
+                a->aliased = true;
+                break;
+            }
+
+    u32 index = mg::find_memory_type_index(&mgr->allocator, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, type_bits);
+
+    if (index == UINT32_MAX)
+        throw_error("%p no device local memory type for transient resources with memory requirements %u", alloc, type_bits);
+
+    trace("allocating transient memory: %u bytes instead of %u\n", alloc->size, alloc->unaliased_size);
+
+    // the whole memory is reserved so the memory manager never binds anything else to it
+    mg::vk_memory *mem = mg::allocate_memory_by_memory_type_index(&mgr->allocator, alloc->size, mg::memory_binding_type::Mixed, index);
+
+    VkDeviceSize offset;
+    alloc->memory = mem;
+    alloc->memory_block = mg::reserve_block(mem, alloc->size, alignment, &offset);
+    assert(alloc->memory_block != mg::TLSF_INVALID_BLOCK);
+    assert(offset == 0);
+
+    for_array(res, &alloc->resources)
+    {
+        VkResult r;
+
+        if (res->type == mg::memory_binding_type::Buffer)
+        {
+            r = vkBindBufferMemory(dev, res->buffer->buffer, mem->memory, res->offset);
+            res->buffer->memory = mem;
+            res->buffer->offset = res->offset;
+        }
+        else
+        {
+            r = vkBindImageMemory(dev, res->image->image, mem->memory, res->offset);
+            res->image->memory = mem;
+            res->image->offset = res->offset;
+        }
+
+        if (r != VK_SUCCESS)
+            throw_vk_error(r, "could not bind transient resource to vk_memory %p", mem);
+    }
+}
+
+void mg::record_alias_barriers(mg::transient_allocator *alloc, VkCommandBuffer cmd, u32 pass)
+{
+    assert(alloc != nullptr);
+    assert(cmd != nullptr);
+
+    array<VkImageMemoryBarrier> barriers;
+    ::init(&barriers);
+    defer { ::free(&barriers); };
+
+    bool any = false;
+
+    for_array(res, &alloc->resources)
+    {
+        if (res->first_pass != pass || !res->aliased)
+            continue;
+
+        any = true;
+
+        if (res->type != mg::memory_binding_type::Image
+         || res->image->layout == VK_IMAGE_LAYOUT_UNDEFINED)
+            continue;
+
+        mg::vk_image *img = res->image;
+        VkImageMemoryBarrier *barrier = ::add_at_end(&barriers);
+        *barrier = VkImageMemoryBarrier{};
+        barrier->sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier->srcAccessMask = 0;
+        barrier->dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+        barrier->oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        barrier->newLayout = img->layout;
+        barrier->srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier->dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier->image = img->image;
+        barrier->subresourceRange.aspectMask = mg::get_image_aspect(img->format);
+        barrier->subresourceRange.baseMipLevel = 0;
+        barrier->subresourceRange.levelCount = img->mipmap_levels;
+        barrier->subresourceRange.baseArrayLayer = 0;
+        barrier->subresourceRange.layerCount = img->array_layers;
+    }
+
+    if (!any)
+        return;
+
+    // everything that used the memory before has to be done with it
+    VkMemoryBarrier mem_barrier{};
+    mem_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    mem_barrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+    mem_barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+
+    vkCmdPipelineBarrier(cmd,
+                         VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                         VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                         0,
+                         1, &mem_barrier,
+                         0, nullptr,
+                         (u32)barriers.size, barriers.data);
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <vulkan/vulkan_core.h>
+
+#include "shl/array.hpp"
+#include "shl/number_types.hpp"
+
+#include "mg/impl/memory_manager.hpp"
+#include "mg/impl/vk_buffer.hpp"
+#include "mg/impl/vk_image.hpp"
+#include "mg/impl/vk_memory.hpp"
+
+// aliased memory for resources that only live for part of a frame,
+// e.g. intermediate render targets of post processing chains.
+// every resource declares the passes it is used in, [first_pass, last_pass].
+// resources whose passes don't overlap are placed at the same offsets of
+// a single device local block, so the block only has to be as large as
+// the resources that are alive at the same time.
+//
+// resources are created first, then bind_transient_resources places and binds
+// all of them at once. record_alias_barriers has to be called at the start
+// of every pass to make sure a resource that reuses memory does not race
+// with the resources that used it before.
+//
+// the same memory is reused every frame, so use one transient allocator
+// per frame in flight.
+namespace mg
+{
+struct transient_resource
+{
+    mg::memory_binding_type type;
+    mg::vk_buffer *buffer;
+    mg::vk_image *image;
+
+    u32 first_pass;
+    u32 last_pass;
+
+    VkMemoryRequirements reqs;
+    mg::memory_resource_kind kind;
+    VkDeviceSize offset; // inside memory
+
+    // shares memory with another resource, its contents don't survive
+    // from one frame to the next.
+    bool aliased;
+};
+
+struct transient_allocator
+{
+    array<mg::transient_resource> resources;
+
+    mg::vk_memory *memory;
+    u32 memory_block; // the whole memory, so nothing else is bound to it
+
+    // size of memory, and what the resources would need without aliasing
+    VkDeviceSize size;
+    VkDeviceSize unaliased_size;
+};
+
+void init(mg::transient_allocator *alloc);
+// destroys all resources and frees the memory
+void free(mg::transient_allocator *alloc, mg::memory_manager *mgr);
+
+// creates a resource without binding it, see bind_transient_resources
+mg::vk_buffer *create_transient_buffer(mg::transient_allocator *alloc, mg::memory_manager *mgr, u32 first_pass, u32 last_pass, VkDeviceSize size, VkBufferUsageFlags usage, VkSharingMode sharemode = VK_SHARING_MODE_EXCLUSIVE);
+mg::vk_image *create_transient_image(mg::transient_allocator *alloc, mg::memory_manager *mgr, u32 first_pass, u32 last_pass, VkImageCreateInfo *info);
+
+// places all resources, allocates device local memory for them and binds them.
+// no resources can be created after this.
+void bind_transient_resources(mg::transient_allocator *alloc, mg::memory_manager *mgr);
+
+// makes the resources that are first used in pass and that reuse memory
+// safe to use. aliased images with a layout other than undefined are
+// transitioned from undefined to vk_image::layout, their contents are lost.
+// cmd must be recording and outside of a render pass.
+void record_alias_barriers(mg::transient_allocator *alloc, VkCommandBuffer cmd, u32 pass);
+}
@@ -0,0 +1,228 @@
+
+#include <assert.h>
+#include <string.h>
+
+#include "mg/impl/upload_cache.hpp"
+
+#define XXH_PRIME64_1 11400714785074694791ull
+#define XXH_PRIME64_2 14029467366897019727ull
+#define XXH_PRIME64_3 1609587929392839161ull
+#define XXH_PRIME64_4 9650029242287828579ull
+#define XXH_PRIME64_5 2870177450012600261ull
+
+inline u64 rotl64(u64 x, u32 r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+inline u64 read64(const u8 *p)
+{
+    u64 ret;
+    memcpy(&ret, p, sizeof(u64));
+    return ret;
+}
+
+inline u32 read32(const u8 *p)
+{
+    u32 ret;
+    memcpy(&ret, p, sizeof(u32));
+    return ret;
+}
+
+inline u64 xxh64_round(u64 acc, u64 input)
+{
+    acc += input * XXH_PRIME64_2;
+    acc = ::rotl64(acc, 31);
+    return acc * XXH_PRIME64_1;
+}
+
+inline u64 xxh64_merge_round(u64 acc, u64 val)
+{
+    acc ^= ::xxh64_round(0, val);
+    return acc * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+u64 mg::hash_upload_data(const void *data, u64 size, u64 seed)
+{
+    assert(data != nullptr || size == 0);
+
+    const u8 *p = (const u8*)data;
+    const u8 *end = p + size;
+    u64 h;
+
+    if (size >= 32)
+    {
+        u64 v1 = seed + XXH_PRIME64_1 + XXH_PRIME64_2;
+        u64 v2 = seed + XXH_PRIME64_2;
+        u64 v3 = seed;
+        u64 v4 = seed - XXH_PRIME64_1;
+
+        const u8 *limit = end - 32;
+
+        do
+        {
+            v1 = ::xxh64_round(v1, ::read64(p));
+            v2 = ::xxh64_round(v2, ::read64(p + 8));
+            v3 = ::xxh64_round(v3, ::read64(p + 16));
+            v4 = ::xxh64_round(v4, ::read64(p + 24));
+            p += 32;
+        }
+        while (p <= limit);
+
+        h = ::rotl64(v1, 1) + ::rotl64(v2, 7) + ::rotl64(v3, 12) + ::rotl64(v4, 18);
+        h = ::xxh64_merge_round(h, v1);
+        h = ::xxh64_merge_round(h, v2);
+        h = ::xxh64_merge_round(h, v3);
+        h = ::xxh64_merge_round(h, v4);
+    }
+    else
+        h = seed + XXH_PRIME64_5;
+
+    h += size;
+
+    while (p + 8 <= end)
+    {
+        h ^= ::xxh64_round(0, ::read64(p));
+        h = ::rotl64(h, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+        p += 8;
+    }
+
+    if (p + 4 <= end)
+    {
+        h ^= (u64)::read32(p) * XXH_PRIME64_1;
+        h = ::rotl64(h, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+        p += 4;
+    }
+
+    while (p < end)
+    {
+        h ^= (u64)(*p) * XXH_PRIME64_5;
+        h = ::rotl64(h, 11) * XXH_PRIME64_1;
+        ++p;
+    }
+
+    h ^= h >> 33;
+    h *= XXH_PRIME64_2;
+    h ^= h >> 29;
+    h *= XXH_PRIME64_3;
+    h ^= h >> 32;
+
+    return h;
+}
+
+void mg::init(mg::upload_cache *cache)
+{
+    assert(cache != nullptr);
+
+    ::init(&cache->entries);
+    cache->hits = 0;
+    cache->misses = 0;
+}
+
+void mg::free(mg::upload_cache *cache)
+{
+    assert(cache != nullptr);
+
+    ::free(&cache->entries);
+}
+
+// index of the first entry of destination, or where it would be
+u64 lower_bound_entry(mg::upload_cache *cache, const void *destination)
+{
+    u64 lo = 0;
+    u64 hi = cache->entries.size;
+
+    while (lo < hi)
+    {
+        u64 mid = lo + (hi - lo) / 2;
+
+        if (cache->entries[mid].destination < destination)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+inline bool same_region(const mg::upload_cache_region *a, const mg::upload_cache_region *b)
+{
+    return a->offset.x == b->offset.x
+        && a->offset.y == b->offset.y
+        && a->offset.z == b->offset.z
+        && a->width == b->width
+        && a->height == b->height
+        && a->aspects == b->aspects
+        && a->mipmap_level == b->mipmap_level
+        && a->layer_start == b->layer_start
+        && a->layer_count == b->layer_count;
+}
+
+// uploads write everything from their offset to the end of the subresource,
+// so the same mipmap level and layers always overlap
+inline bool regions_overlap(const mg::upload_cache_region *a, const mg::upload_cache_region *b)
+{
+    return a->mipmap_level == b->mipmap_level
+        && a->layer_start < b->layer_start + b->layer_count
+        && b->layer_start < a->layer_start + a->layer_count;
+}
+
+bool mg::check_upload(mg::upload_cache *cache, const void *destination, const mg::upload_cache_region *region, const void *data, u64 size)
+{
+    assert(cache != nullptr);
+    assert(destination != nullptr);
+    assert(region != nullptr);
+
+    u64 hash = mg::hash_upload_data(data, size);
+    u64 first = ::lower_bound_entry(cache, destination);
+    u64 i = first;
+
+    while (i < cache->entries.size && cache->entries[i].destination == destination)
+    {
+        mg::upload_cache_entry *e = cache->entries.data + i;
+
+        if (::same_region(&e->region, region) && e->size == size && e->hash == hash)
+        {
+            cache->hits += 1;
+            return true;
+        }
+
+        if (::regions_overlap(&e->region, region))
+        {
+            ::remove_elements(&cache->entries, i, 1);
+            continue;
+        }
+
+        ++i;
+    }
+
+    mg::upload_cache_entry *e = ::insert_elements(&cache->entries, first, 1);
+    e->destination = destination;
+    e->region = *region;
+    e->size = size;
+    e->hash = hash;
+
+    cache->misses += 1;
+    return false;
+}
+
+void mg::forget_uploads(mg::upload_cache *cache, const void *destination)
+{
+    assert(cache != nullptr);
+
+    u64 first = ::lower_bound_entry(cache, destination);
+    u64 last = first;
+
+    while (last < cache->entries.size && cache->entries[last].destination == destination)
+        ++last;
+
+    if (last > first)
+        ::remove_elements(&cache->entries, first, last - first);
+}
+
+void mg::clear(mg::upload_cache *cache)
+{
+    assert(cache != nullptr);
+
+    ::clear(&cache->entries);
+}
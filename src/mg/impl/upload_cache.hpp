@@ -0,0 +1,62 @@
+#pragma once
+
+#include <vulkan/vulkan_core.h>
+
+#include "shl/array.hpp"
+#include "shl/number_types.hpp"
+
+// remembers a 64 bit hash of the last data uploaded to every destination,
+// so uploads of unchanged data can be skipped before anything is staged.
+// meant for content that is mostly static but submitted again every frame,
+// e.g. UI vertices and textures.
+//
+// the cache only knows about queued uploads. destinations that are written
+// some other way (write_buffer, shaders, transfers) must be forgotten,
+// otherwise the next upload of the old data is skipped. the memory manager
+// forgets sub-buffers and images when they are destroyed.
+namespace mg
+{
+// what part of the destination an upload writes.
+// buffer uploads use the defaults, uploads to the same mipmap level and
+// layers of an image overlap.
+struct upload_cache_region
+{
+    VkOffset3D offset;
+    u32 width;
+    u32 height;
+    VkImageAspectFlags aspects;
+    u32 mipmap_level;
+    u32 layer_start;
+    u32 layer_count;
+};
+
+struct upload_cache_entry
+{
+    const void *destination;
+    mg::upload_cache_region region;
+    u64 size;
+    u64 hash;
+};
+
+struct upload_cache
+{
+    // sorted by destination
+    array<mg::upload_cache_entry> entries;
+
+    u64 hits;   // uploads that were skipped
+    u64 misses; // uploads that were queued
+};
+
+void init(mg::upload_cache *cache);
+void free(mg::upload_cache *cache);
+
+// XXH64
+u64 hash_upload_data(const void *data, u64 size, u64 seed = 0);
+
+// true if data is what was last uploaded to region of destination.
+// otherwise remembers data as the content of region and forgets
+// everything else that overlaps it.
+bool check_upload(mg::upload_cache *cache, const void *destination, const mg::upload_cache_region *region, const void *data, u64 size);
+void forget_uploads(mg::upload_cache *cache, const void *destination);
+void clear(mg::upload_cache *cache);
+}
@@ -2,6 +2,7 @@
 #include <assert.h>
 
 #include "shl/debug.hpp"
+#include "shl/memory.hpp"
 #include "shl/number_types.hpp"
 
 #include "mg/vk_error.hpp"
@@ -19,46 +20,77 @@ insertion_t find_free_space(mg::vk_buffer *buf, VkDeviceSize size, VkDeviceSize
     assert(buf != nullptr);
     insertion_t ret;
     
-    VkDeviceSize prev_end = 0;
-    VkDeviceSize diff_size = 0;
+    mg::sub_buffer_range gap{0, 0};
+    u64 count = buf->sub_buffer_offsets.size;
+    const VkDeviceSize *offsets = buf->sub_buffer_offsets.data;
+    const VkDeviceSize *sizes = buf->sub_buffer_sizes.data;
+    u64 i = 0;
     
-    for_list(i, sb, &buf->sub_buffers)
+    for (; i < count; ++i)
     {
-        diff_size = sb->range.offset - prev_end;
+        gap.size = offsets[i] - gap.offset;
         
-        if (diff_size >= size)
+        if (mg::has_space_for(&gap, size, alignment))
             break;
         
-        prev_end = mg::align_next(end(&sb->range), alignment);
+        gap.offset = offsets[i] + sizes[i];
     }
     
     ret.valid = true;
     
-    if (i >= buf->sub_buffers.size)
+    if (i >= count)
     {
-        diff_size = buf->size - prev_end;
+        gap.size = buf->size - gap.offset;
         
-        if (diff_size < size)
+        if (!mg::has_space_for(&gap, size, alignment))
             ret.valid = false;
     }
     
     ret.index = i;
-    ret.offset = prev_end;
+    ret.offset = mg::align_next(gap.offset, alignment);
     
     return ret;
 }
 
+// index of the first sub-buffer at or after offset
+u64 lower_bound_sub_buffer(mg::vk_buffer *buf, VkDeviceSize offset)
+{
+    u64 lo = 0;
+    u64 hi = buf->sub_buffer_offsets.size;
+
+    while (lo < hi)
+    {
+        u64 mid = lo + (hi - lo) / 2;
+
+        if (buf->sub_buffer_offsets[mid] < offset)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+// in Linear mode the gaps only have to be searched again when a sub-buffer
+// is placed in the largest gap, destroying a sub-buffer keeps it up to date.
 void update_largest_contiguous_free_space(mg::vk_buffer *buf)
 {
-    // TODO: fix calculation
     assert(buf != nullptr);
+
+    if (buf->mode == mg::sub_buffer_allocation_mode::Buddy)
+    {
+        buf->largest_contiguous_free_space = mg::largest_free_range(&buf->buddy);
+        buf->total_free_space = buf->buddy.total_free_space;
+        return;
+    }
+
     buf->largest_contiguous_free_space.size = 0;
     VkDeviceSize prev_end = 0;
     VkDeviceSize diff_size = 0;
     
-    for_list(sb, &buf->sub_buffers)
+    for (u64 i = 0; i < buf->sub_buffer_offsets.size; ++i)
     {
-        diff_size = sb->range.offset - prev_end;
+        diff_size = buf->sub_buffer_offsets[i] - prev_end;
         
         if (diff_size > buf->largest_contiguous_free_space.size)
         {
@@ -66,7 +98,7 @@ void update_largest_contiguous_free_space(mg::vk_buffer *buf)
             buf->largest_contiguous_free_space.size = diff_size;
         }
             
-        prev_end = end(&sb->range);
+        prev_end = buf->sub_buffer_offsets[i] + buf->sub_buffer_sizes[i];
     }
     
     if (prev_end < buf->size)
@@ -81,34 +113,103 @@ void update_largest_contiguous_free_space(mg::vk_buffer *buf)
     }
 }
 
-void mg::init(mg::vk_buffer *buf, VkBuffer buffer, VkDeviceSize size, VkDeviceSize offset, VkBufferUsageFlags usage, VkSharingMode sharemode)
+void mg::init(mg::vk_buffer *buf, VkBuffer buffer, VkDeviceSize size, VkDeviceSize offset, VkBufferUsageFlags usage, VkSharingMode sharemode, mg::sub_buffer_allocation_mode mode)
 {
     assert(buf != nullptr);
 
     buf->buffer = buffer;
     buf->memory = nullptr;
+    buf->memory_block = mg::TLSF_INVALID_BLOCK;
     buf->offset = offset;
     buf->size = size;
     buf->usage = usage;
     buf->sharemode = sharemode;
+    buf->queue_family = VK_QUEUE_FAMILY_IGNORED;
+    buf->mode = mode;
+    buf->pool = mg::buffer_pool::None;
     buf->largest_contiguous_free_space.offset = 0;
     buf->largest_contiguous_free_space.size = size;
     buf->total_free_space = size;
+    buf->handle = mg::INVALID_SLAB_HANDLE;
+    buf->index = UINT32_MAX;
+    buf->bucket = UINT32_MAX;
+    buf->bucket_bin = UINT32_MAX;
+    buf->bucket_index = UINT32_MAX;
 
+    ::init(&buf->sub_buffer_offsets);
+    ::init(&buf->sub_buffer_sizes);
     ::init(&buf->sub_buffers);
+    ::init(&buf->buddy_sub_buffers);
+
+    if (mode == mg::sub_buffer_allocation_mode::Buddy)
+    {
+        mg::init(&buf->buddy, size);
+        ::update_largest_contiguous_free_space(buf);
+    }
 }
 
 void mg::free(mg::vk_buffer *buf)
 {
     assert(buf != nullptr);
 
+    mg::destroy_all_sub_buffers(buf);
+
+    ::free(&buf->sub_buffer_offsets);
+    ::free(&buf->sub_buffer_sizes);
     ::free(&buf->sub_buffers);
+    ::free(&buf->buddy_sub_buffers);
+
+    if (buf->mode == mg::sub_buffer_allocation_mode::Buddy)
+        mg::free(&buf->buddy);
+}
+
+mg::vk_sub_buffer *create_buddy_sub_buffer(mg::vk_buffer *buf, VkDeviceSize size, VkDeviceSize alignment)
+{
+    VkDeviceSize offset;
+
+    if (!mg::allocate_block(&buf->buddy, size, alignment, &offset))
+        throw_error("no free block large enough in vk_buffer %p to fit %u bytes with alignment %u", buf, size, alignment);
+
+    trace("creating new buddy sub-buffer for buffer %p at offset %u with size %u", buf->buffer, offset, size);
+
+    mg::vk_sub_buffer *sb = ::allocate_memory<mg::vk_sub_buffer>();
+    sb->buffer = buf;
+    sb->range.offset = offset;
+    sb->range.size = size;
+    sb->index = (u32)buf->buddy_sub_buffers.size;
+    sb->handle = mg::INVALID_SLAB_HANDLE;
+    sb->graphics_value = UINT64_MAX;
+    sb->transfer_value = 0;
+    ::add_at_end(&buf->buddy_sub_buffers, sb);
+
+    ::update_largest_contiguous_free_space(buf);
+    return sb;
+}
+
+void destroy_buddy_sub_buffer(mg::vk_buffer *buf, mg::vk_sub_buffer *sb)
+{
+    assert(sb->index < buf->buddy_sub_buffers.size);
+    assert(buf->buddy_sub_buffers[sb->index] == sb);
+
+    mg::free_block(&buf->buddy, sb->range.offset, sb->range.size);
+
+    // swap with the last sub-buffer to remove in O(1)
+    mg::vk_sub_buffer *last = buf->buddy_sub_buffers[buf->buddy_sub_buffers.size - 1];
+    last->index = sb->index;
+    buf->buddy_sub_buffers[sb->index] = last;
+    buf->buddy_sub_buffers.size -= 1;
+
+    ::free_memory(sb);
+    ::update_largest_contiguous_free_space(buf);
 }
 
 mg::vk_sub_buffer *mg::create_sub_buffer(mg::vk_buffer *buf, VkDeviceSize size, VkDeviceSize alignment)
 {
     assert(buf != nullptr);
     assert(mg::has_space_for(buf, size, alignment));
+
+    if (buf->mode == mg::sub_buffer_allocation_mode::Buddy)
+        return ::create_buddy_sub_buffer(buf, size, alignment);
     
     insertion_t i = ::find_free_space(buf, size, alignment);
     
@@ -116,59 +217,118 @@ mg::vk_sub_buffer *mg::create_sub_buffer(mg::vk_buffer *buf, VkDeviceSize size,
         throw_error("no free space large enough in vk_buffer %p to fit %u bytes with alignment %u", buf, size, alignment);
     
     trace("creating new sub-buffer for buffer %p at offset %u with size %u", buf->buffer, i.offset, size);
+
+    VkDeviceSize gap_offset = 0;
+
+    if (i.index > 0)
+        gap_offset = buf->sub_buffer_offsets[i.index - 1] + buf->sub_buffer_sizes[i.index - 1];
     
-    auto node = ::insert_elements(&buf->sub_buffers, i.index, 1);
-    vk_sub_buffer *sb = &node->value;
+    mg::vk_sub_buffer *sb = ::allocate_memory<mg::vk_sub_buffer>();
+    *::insert_elements(&buf->sub_buffer_offsets, i.index, 1) = i.offset;
+    *::insert_elements(&buf->sub_buffer_sizes, i.index, 1) = size;
+    *::insert_elements(&buf->sub_buffers, i.index, 1) = sb;
+
     sb->buffer = buf;
     sb->range.offset = i.offset;
     sb->range.size = size;
+    sb->index = 0;
+    sb->handle = mg::INVALID_SLAB_HANDLE;
+    sb->graphics_value = UINT64_MAX;
+    sb->transfer_value = 0;
     
     buf->total_free_space -= size;
-    ::update_largest_contiguous_free_space(buf);
+
+    if (gap_offset == buf->largest_contiguous_free_space.offset)
+        ::update_largest_contiguous_free_space(buf);
+
     return sb;
 }
 
 void mg::destroy_sub_buffer(mg::vk_sub_buffer *sb)
 {
     assert(sb != nullptr);
-    mg::destroy_sub_buffer(sb->buffer, sb->range.offset);
+
+    if (sb->buffer->mode == mg::sub_buffer_allocation_mode::Buddy)
+        ::destroy_buddy_sub_buffer(sb->buffer, sb);
+    else
+        mg::destroy_sub_buffer(sb->buffer, sb->range.offset);
 }
 
 void mg::destroy_sub_buffer(mg::vk_buffer *buf, VkDeviceSize offset)
 {
     assert(buf != nullptr);
 
-    u64 index = -1;
+    if (buf->mode == mg::sub_buffer_allocation_mode::Buddy)
+    {
+        for_array(sb, &buf->buddy_sub_buffers)
+            if ((*sb)->range.offset == offset)
+            {
+                ::destroy_buddy_sub_buffer(buf, *sb);
+                break;
+            }
 
-    for_list(i, tmp, &buf->sub_buffers)
-        if (tmp->range.offset == offset)
-        {
-            index = i;
-            break;
-        }
-        else if (tmp->range.offset > offset)
-            break;
-        
-    if (index >= buf->sub_buffers.size)
+        return;
+    }
+
+    u64 index = ::lower_bound_sub_buffer(buf, offset);
+
+    if (index >= buf->sub_buffer_offsets.size
+     || buf->sub_buffer_offsets[index] != offset)
         return;
     
-    buf->total_free_space += tmp->range.size;
+    // the gap the sub-buffer leaves merges with the gaps around it
+    mg::sub_buffer_range gap{0, 0};
+
+    if (index > 0)
+        gap.offset = buf->sub_buffer_offsets[index - 1] + buf->sub_buffer_sizes[index - 1];
+
+    if (index + 1 < buf->sub_buffer_offsets.size)
+        gap.size = buf->sub_buffer_offsets[index + 1] - gap.offset;
+    else
+        gap.size = buf->size - gap.offset;
+
+    if (gap.size > buf->largest_contiguous_free_space.size)
+        buf->largest_contiguous_free_space = gap;
+    
+    buf->total_free_space += buf->sub_buffer_sizes[index];
+    ::free_memory(buf->sub_buffers[index]);
+    ::remove_elements(&buf->sub_buffer_offsets, index, 1);
+    ::remove_elements(&buf->sub_buffer_sizes, index, 1);
     ::remove_elements(&buf->sub_buffers, index, 1);
-    ::update_largest_contiguous_free_space(buf);
 }
 
 void mg::destroy_all_sub_buffers(mg::vk_buffer *buf)
 {
     assert(buf != nullptr);
 
+    if (buf->mode == mg::sub_buffer_allocation_mode::Buddy)
+    {
+        for_array(sb, &buf->buddy_sub_buffers)
+            ::free_memory(*sb);
+
+        ::clear(&buf->buddy_sub_buffers);
+        mg::free_all_blocks(&buf->buddy);
+        ::update_largest_contiguous_free_space(buf);
+        return;
+    }
+
     buf->largest_contiguous_free_space.offset = 0;
     buf->largest_contiguous_free_space.size = buf->size;
     buf->total_free_space = buf->size;
+
+    for_array(sb, &buf->sub_buffers)
+        ::free_memory(*sb);
+
+    ::clear(&buf->sub_buffer_offsets);
+    ::clear(&buf->sub_buffer_sizes);
     ::clear(&buf->sub_buffers);
 }
 
 bool mg::has_space_for(mg::vk_buffer *buf, VkDeviceSize size, VkDeviceSize alignment)
 {
+    if (buf->mode == mg::sub_buffer_allocation_mode::Buddy)
+        return mg::has_space_for(&buf->buddy, size, alignment);
+
     return mg::has_space_for(&buf->largest_contiguous_free_space, size, alignment);
 }
 
@@ -176,3 +336,16 @@ VkDeviceSize mg::total_memory_offset(const mg::vk_sub_buffer *sub)
 {
     return sub->range.offset + sub->buffer->offset;
 }
+
+void *mg::get_mapped_pointer(const mg::vk_sub_buffer *sub)
+{
+    assert(sub != nullptr);
+    assert(sub->buffer != nullptr);
+
+    const mg::vk_memory *mem = sub->buffer->memory;
+
+    if (mem == nullptr || mem->mapped == nullptr)
+        return nullptr;
+
+    return (u8*)mem->mapped + mg::total_memory_offset(sub);
+}
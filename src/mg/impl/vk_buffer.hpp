@@ -1,9 +1,11 @@
 
 #pragma once
 
-#include "shl/linked_list.hpp"
+#include "shl/array.hpp"
 
 #include "mg/number_range.hpp"
+#include "mg/impl/buddy_allocator.hpp"
+#include "mg/impl/slab.hpp"
 #include "mg/impl/vk_memory.hpp"
 
 namespace mg
@@ -16,33 +18,100 @@ struct vk_sub_buffer
 {
     mg::vk_buffer *buffer; // parent
     mg::sub_buffer_range range;
+
+    u32 index; // internal, only used in Buddy mode
+
+    // slot inside memory_manager::sub_buffer_slab for sub-buffers obtained
+    // from the memory manager, INVALID_SLAB_HANDLE otherwise.
+    mg::slab_handle handle;
+
+    // internal, used by the uploads of the context.
+    // frames after graphics_value may read the data, UINT64_MAX if it was
+    // never written. transfer_value is reached once the last upload queued
+    // to the sub-buffer is done.
+    u64 graphics_value;
+    u64 transfer_value;
+};
+
+typedef array<vk_sub_buffer*> sub_buffer_list;
+
+// how sub-buffers are placed inside a buffer.
+// Linear: first fit, sub-buffers are tightly packed. creating sub-buffers
+//         is linear in the number of sub-buffers, destroying them is a
+//         binary search plus moving the ranges after them. the largest
+//         gap is only searched again when a sub-buffer is placed in it.
+// Buddy:  sub-buffers are placed in power of two blocks, creating and
+//         destroying sub-buffers is logarithmic in the size of the buffer,
+//         at the cost of rounding up sub-buffer sizes.
+enum class sub_buffer_allocation_mode : u8
+{
+    Linear,
+    Buddy
 };
 
-typedef linked_list<vk_sub_buffer> sub_buffer_list;
+// the pool of the memory manager a buffer belongs to, see get_new_sub_buffer.
+// buffers not created for a pool are None and never receive sub-buffers
+// from the memory manager.
+enum class buffer_pool : u8
+{
+    None,
+    Small,
+    Medium,
+    Large,
+    Dedicated // a single sub-buffer that fills the buffer
+};
 
 struct vk_buffer
 {
     VkBuffer buffer;
     mg::vk_memory *memory;
+    u32 memory_block; // block inside memory->bindings
     
     VkDeviceSize offset; // pretty much always 0
     VkDeviceSize size;
     VkBufferUsageFlags usage;
     VkSharingMode sharemode;
+
+    // queue family that owns the buffer if it is exclusive, see transfer_queue.
+    // VK_QUEUE_FAMILY_IGNORED until the buffer is first written by an upload
+    // or moved by the defragmenter, the graphics family after that.
+    u32 queue_family;
     
+    mg::sub_buffer_allocation_mode mode;
+    mg::buffer_pool pool;
     mg::sub_buffer_range largest_contiguous_free_space;
     VkDeviceSize total_free_space;
+
+    // Linear mode, sorted by offset.
+    // offsets and sizes are kept apart from the sub-buffers so that
+    // searching for free space only reads two contiguous arrays.
+    array<VkDeviceSize> sub_buffer_offsets;
+    array<VkDeviceSize> sub_buffer_sizes;
     mg::sub_buffer_list sub_buffers;
+
+    // Buddy mode
+    mg::buddy_allocator buddy;
+    array<mg::vk_sub_buffer*> buddy_sub_buffers;
+
+    // internal, used by the memory manager
+    mg::slab_handle handle; // inside memory_manager::buffer_slab
+    u32 index;        // inside memory_manager::buffers
+    u32 bucket;       // inside memory_manager::buckets, UINT32_MAX if in none
+    u32 bucket_bin;   // inside buffer_bucket::bins
+    u32 bucket_index; // inside the bin
 };
 
-void init(mg::vk_buffer *buf, VkBuffer buffer = nullptr, VkDeviceSize size = 0, VkDeviceSize offset = 0, VkBufferUsageFlags usage = 0, VkSharingMode share = VK_SHARING_MODE_EXCLUSIVE);
+void init(mg::vk_buffer *buf, VkBuffer buffer = nullptr, VkDeviceSize size = 0, VkDeviceSize offset = 0, VkBufferUsageFlags usage = 0, VkSharingMode share = VK_SHARING_MODE_EXCLUSIVE, mg::sub_buffer_allocation_mode mode = mg::sub_buffer_allocation_mode::Linear);
 void free(mg::vk_buffer *buf);
 
 // theres no GPU allocation going on here
 mg::vk_sub_buffer *create_sub_buffer(mg::vk_buffer *buf, VkDeviceSize sz, VkDeviceSize alignment = 1);
 
 void destroy_sub_buffer(vk_sub_buffer *sb);
-void destroy_sub_buffer(mg::vk_buffer *buf, VkDeviceSize offset); // offset must match exactly
+// offset must match exactly. prefer destroying by pointer,
+// in Buddy mode this has to search the sub-buffers.
+// in Linear mode both are a binary search.
+void destroy_sub_buffer(mg::vk_buffer *buf, VkDeviceSize offset);
 void destroy_all_sub_buffers(mg::vk_buffer *buf);
 
 bool has_space_for(mg::vk_buffer *buf, VkDeviceSize size, VkDeviceSize alignment = 1);
@@ -50,4 +119,8 @@ bool has_space_for(mg::vk_buffer *buf, VkDeviceSize size, VkDeviceSize alignment
 // gets the total offset inside bound memory
 // basically returns sub->offset + sub->buffer->offset
 VkDeviceSize total_memory_offset(const vk_sub_buffer *sub);
+
+// pointer to the start of the sub-buffer in mapped memory.
+// returns nullptr if the buffer is not bound to mapped memory.
+void *get_mapped_pointer(const vk_sub_buffer *sub);
 }
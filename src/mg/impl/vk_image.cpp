@@ -20,6 +20,11 @@ void mg::init(mg::vk_image *vimg, VkImage img, VkExtent3D extent, VkImageCreateF
     
     vimg->image = img;
     vimg->memory = nullptr;
+    vimg->memory_block = mg::TLSF_INVALID_BLOCK;
+    vimg->offset = 0;
+    vimg->queue_family = VK_QUEUE_FAMILY_IGNORED;
+    vimg->handle = mg::INVALID_SLAB_HANDLE;
+    vimg->index = UINT32_MAX;
 }
 
 void mg::init(mg::vk_image *vimg, VkImage img, VkImageCreateInfo *info)
@@ -40,6 +45,33 @@ void mg::init(mg::vk_image *vimg, VkImage img, VkImageCreateInfo *info)
     
     vimg->image = img;
     vimg->memory = nullptr;
+    vimg->memory_block = mg::TLSF_INVALID_BLOCK;
+    vimg->offset = 0;
+    vimg->queue_family = VK_QUEUE_FAMILY_IGNORED;
+    vimg->handle = mg::INVALID_SLAB_HANDLE;
+    vimg->index = UINT32_MAX;
+}
+
+VkImageAspectFlags mg::get_image_aspect(VkFormat format)
+{
+    switch (format)
+    {
+    case VK_FORMAT_D16_UNORM:
+    case VK_FORMAT_X8_D24_UNORM_PACK32:
+    case VK_FORMAT_D32_SFLOAT:
+        return VK_IMAGE_ASPECT_DEPTH_BIT;
+
+    case VK_FORMAT_S8_UINT:
+        return VK_IMAGE_ASPECT_STENCIL_BIT;
+
+    case VK_FORMAT_D16_UNORM_S8_UINT:
+    case VK_FORMAT_D24_UNORM_S8_UINT:
+    case VK_FORMAT_D32_SFLOAT_S8_UINT:
+        return VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
+
+    default:
+        return VK_IMAGE_ASPECT_COLOR_BIT;
+    }
 }
 
 void mg::free(mg::vk_image *vimg)
@@ -4,6 +4,7 @@
 #include <vulkan/vulkan_core.h>
 
 #include "shl/number_types.hpp"
+#include "mg/impl/slab.hpp"
 #include "mg/impl/vk_memory.hpp"
 
 namespace mg
@@ -12,6 +13,7 @@ struct vk_image
 {
     VkImage image;
     vk_memory *memory;
+    u32 memory_block; // block inside memory->bindings
     
     VkDeviceSize          offset;
     
@@ -26,9 +28,19 @@ struct vk_image
     VkImageUsageFlags     usage;
     VkSharingMode         sharemode;
     VkImageLayout         layout;
+
+    // queue family that owns the image if it is exclusive, see vk_buffer
+    u32                   queue_family;
+
+    // internal, used by the memory manager
+    mg::slab_handle handle; // inside memory_manager::image_slab
+    u32 index;              // inside memory_manager::images
 };
 
 void init(mg::vk_image *vimg, VkImage img, VkExtent3D extent, VkImageCreateFlags flags = 0, VkImageType image_type = VK_IMAGE_TYPE_2D, VkFormat format = VK_FORMAT_R8G8B8A8_UINT, u32 mipmap_levels = 1, u32 array_layers = 1, VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT, VkImageTiling tiling = VK_IMAGE_TILING_OPTIMAL, VkImageUsageFlags usage = 0, VkSharingMode sharemode = VK_SHARING_MODE_EXCLUSIVE, VkImageLayout initial_layout = VK_IMAGE_LAYOUT_UNDEFINED);
 void init(mg::vk_image *vimg, VkImage img, VkImageCreateInfo *info);
 void free(mg::vk_image *vimg);
+
+// aspects of the whole image, e.g. for barriers and copies
+VkImageAspectFlags get_image_aspect(VkFormat format);
 }
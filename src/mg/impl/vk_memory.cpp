@@ -9,79 +9,13 @@
 #include "mg/impl/vk_image.hpp"
 #include "mg/impl/vk_memory.hpp"
     
-struct insertion_t
+void update_free_space(mg::vk_memory *mem)
 {
-    bool valid;
-    u64 index;
-    VkDeviceSize offset;
-};
-
-insertion_t find_free_space(mg::vk_memory *mem, VkDeviceSize size, VkDeviceSize alignment)
-{
-    insertion_t ret;
-    ret.valid = true;
-    ret.index = 0;
-    ret.offset = 0;
-    
-    VkDeviceSize prev_end = 0;
-    VkDeviceSize diff_size = 0;
-    
-    for_list(i, binding, &mem->bindings)
-    {
-        diff_size = binding->range.offset - prev_end;
-        
-        if (diff_size >= size)
-            break;
-        
-        prev_end = mg::align_next(end(&binding->range), alignment);
-    }
-    
-    if (i >= mem->bindings.size)
-    {
-        diff_size = mem->size - prev_end;
-        
-        if (diff_size < size)
-            ret.valid = false;
-    }
-    
-    ret.index = i;
-    ret.offset = prev_end;
-    
-    return ret;
+    mem->total_free_space = mem->bindings.total_free_space;
+    mem->largest_contiguous_free_space = mg::largest_free_range(&mem->bindings);
 }
 
-void update_largest_contiguous_free_space(mg::vk_memory *mem)
-{
-    mem->largest_contiguous_free_space.size = 0;
-    VkDeviceSize prev_end = 0;
-    VkDeviceSize diff_size = 0;
-    
-    for_list(binding, &mem->bindings)
-    {
-        diff_size = binding->range.offset - prev_end;
-        
-        if (diff_size > mem->largest_contiguous_free_space.size)
-        {
-            mem->largest_contiguous_free_space.offset = prev_end;
-            mem->largest_contiguous_free_space.size = diff_size;
-        }
-            
-        prev_end = end(&binding->range);
-    }
-    
-    if (prev_end < mem->size)
-    {
-        diff_size = mem->size - prev_end;
-        
-        if (diff_size > mem->largest_contiguous_free_space.size)
-        {
-            mem->largest_contiguous_free_space.offset = prev_end;
-            mem->largest_contiguous_free_space.size = diff_size;
-        }
-    }
-}
-
-void mg::init(mg::vk_memory *mem, VkDeviceMemory memory, VkDeviceSize size, VkMemoryPropertyFlags type, mg::memory_binding_type binding_type, u32 type_index)
+void mg::init(mg::vk_memory *mem, VkDeviceMemory memory, VkDeviceSize size, VkMemoryPropertyFlags type, mg::memory_binding_type binding_type, u32 type_index, VkDeviceSize granularity)
 {
     assert(mem != nullptr);
 
@@ -90,10 +24,30 @@ void mg::init(mg::vk_memory *mem, VkDeviceMemory memory, VkDeviceSize size, VkMe
     mem->type = type;
     mem->type_index = type_index;
     mem->binding_type = binding_type;
+    mem->dedicated = false;
     mem->largest_contiguous_free_space.offset = 0;
     mem->largest_contiguous_free_space.size = size;
     mem->total_free_space = size;
-    ::init(&mem->bindings);
+    mem->mapped = nullptr;
+    mem->empty_since_frame = mg::MEMORY_NOT_EMPTY;
+    mg::init(&mem->bindings, size, granularity);
+}
+
+bool mg::can_bind(const mg::vk_memory *mem, mg::memory_binding_type type)
+{
+    assert(mem != nullptr);
+
+    return mem->binding_type == type || mem->binding_type == mg::memory_binding_type::Mixed;
+}
+
+mg::memory_resource_kind mg::get_resource_kind(const mg::vk_image *img)
+{
+    assert(img != nullptr);
+
+    if (img->tiling == VK_IMAGE_TILING_LINEAR)
+        return mg::memory_resource_kind::Linear;
+
+    return mg::memory_resource_kind::NonLinear;
 }
 
 void mg::bind_buffer_to_memory(mg::vk_memory *mem, VkDevice dev, mg::vk_buffer *buf)
@@ -102,33 +56,34 @@ void mg::bind_buffer_to_memory(mg::vk_memory *mem, VkDevice dev, mg::vk_buffer *
     assert(buf != nullptr);
     assert(buf->memory == nullptr);
     assert(buf->size <= mem->total_free_space); // does not guarantee buffer fits
-    assert(mem->binding_type == mg::memory_binding_type::Buffer);
+    assert(mg::can_bind(mem, mg::memory_binding_type::Buffer));
     
     VkMemoryRequirements reqs;
     vkGetBufferMemoryRequirements(dev, buf->buffer, &reqs);
     
-    assert(mg::has_space_for(mem, reqs.size, reqs.alignment));
+    const mg::memory_resource_kind kind = mg::memory_resource_kind::Linear;
+    assert(mg::has_space_for(mem, reqs.size, reqs.alignment, kind));
     
-    insertion_t i = ::find_free_space(mem, reqs.size, reqs.alignment);
+    VkDeviceSize offset;
+    u32 block = mg::allocate_block(&mem->bindings, reqs.size, reqs.alignment, &offset, (u8)kind);
     
-    if (!i.valid)
+    if (block == mg::TLSF_INVALID_BLOCK)
         throw_error("no free space large enough in vk_memory %p to fit vk_buffer %p with size %u and alignment %u", mem, buf, reqs.size, reqs.alignment);
     
-    trace("binding buffer %p to memory %p (index %u) at offset %u with size %u\n", buf, mem->memory, mem->type_index, i.offset, reqs.size);
-    vkBindBufferMemory(dev, buf->buffer, mem->memory, i.offset);
+    trace("binding buffer %p to memory %p (index %u) at offset %u with size %u\n", buf, mem->memory, mem->type_index, offset, reqs.size);
+    VkResult res = vkBindBufferMemory(dev, buf->buffer, mem->memory, offset);
+
+    if (res != VK_SUCCESS)
+    {
+        mg::free_block(&mem->bindings, block);
+        throw_vk_error(res, "could not bind vk_buffer %p to vk_memory %p", buf, mem);
+    }
     
     buf->memory = mem;
-    buf->offset = i.offset;
-    
-    auto node = ::insert_elements(&mem->bindings, i.index, 1);
+    buf->memory_block = block;
+    buf->offset = offset;
 
-    vk_memory_binding *binding = &node->value;
-    binding->range.offset = i.offset;
-    binding->range.size = reqs.size;
-    binding->data.buffer = buf;
-
-    mem->total_free_space -= reqs.size;
-    ::update_largest_contiguous_free_space(mem);
+    ::update_free_space(mem);
 }
 
 void mg::unbind_buffer_from_memory(mg::vk_memory *mem, mg::vk_buffer *buf)
@@ -136,22 +91,17 @@ void mg::unbind_buffer_from_memory(mg::vk_memory *mem, mg::vk_buffer *buf)
     assert(mem != nullptr);
     assert(buf != nullptr);
     assert(buf->memory == mem);
-    assert(mem->binding_type == memory_binding_type::Buffer);
+    assert(mg::can_bind(mem, mg::memory_binding_type::Buffer));
     
-    for_list(i, binding, &mem->bindings)
-        if (binding->data.buffer->buffer == buf->buffer)
-            break;
-        
-    if (i >= mem->bindings.size)
+    if (buf->memory_block == mg::TLSF_INVALID_BLOCK)
         return;
     
-    trace("unbinding buffer %p from memory %p (index %u) at offset %u with size %u\n", buf, mem->memory, mem->type_index, it->range.offset, it->range.size);
+    trace("unbinding buffer %p from memory %p (index %u) at offset %u\n", buf, mem->memory, mem->type_index, buf->offset);
 
-    mem->total_free_space += binding->range.size;
-    ::remove_elements(&mem->bindings, i, 1);
-    ::update_largest_contiguous_free_space(mem);
+    mg::release_block(mem, buf->memory_block);
     
     buf->memory = nullptr;
+    buf->memory_block = mg::TLSF_INVALID_BLOCK;
     buf->offset = 0;
 }
 
@@ -160,33 +110,34 @@ void mg::bind_image_to_memory(mg::vk_memory *mem, VkDevice dev, mg::vk_image *im
     assert(mem != nullptr);
     assert(img != nullptr);
     assert(img->memory == nullptr);
-    assert(mem->binding_type == mg::memory_binding_type::Image);
+    assert(mg::can_bind(mem, mg::memory_binding_type::Image));
     
     VkMemoryRequirements reqs;
     vkGetImageMemoryRequirements(dev, img->image, &reqs);
     
-    assert(mg::has_space_for(mem, reqs.size, reqs.alignment));
+    const mg::memory_resource_kind kind = mg::get_resource_kind(img);
+    assert(mg::has_space_for(mem, reqs.size, reqs.alignment, kind));
     
-    insertion_t i = ::find_free_space(mem, reqs.size, reqs.alignment);
+    VkDeviceSize offset;
+    u32 block = mg::allocate_block(&mem->bindings, reqs.size, reqs.alignment, &offset, (u8)kind);
     
-    if (!i.valid)
+    if (block == mg::TLSF_INVALID_BLOCK)
         throw_error("no free space large enough in vk_memory %p to fit vk_image %p with size %u and alignment %u", mem, img, reqs.size, reqs.alignment);
     
-    trace("binding image %p to memory %p (index %u) at offset %u with size %u\n", img, mem->memory, mem->type_index, i.offset, reqs.size);
-    vkBindImageMemory(dev, img->image, mem->memory, i.offset);
+    trace("binding image %p to memory %p (index %u) at offset %u with size %u\n", img, mem->memory, mem->type_index, offset, reqs.size);
+    VkResult res = vkBindImageMemory(dev, img->image, mem->memory, offset);
+
+    if (res != VK_SUCCESS)
+    {
+        mg::free_block(&mem->bindings, block);
+        throw_vk_error(res, "could not bind vk_image %p to vk_memory %p", img, mem);
+    }
     
     img->memory = mem;
-    img->offset = i.offset;
-    
-    auto node = ::insert_elements(&mem->bindings, i.index, 1);
-
-    vk_memory_binding *binding = &node->value;
-    binding->range.offset = i.offset;
-    binding->range.size = reqs.size;
-    binding->data.image = img;
+    img->memory_block = block;
+    img->offset = offset;
 
-    mem->total_free_space -= reqs.size;
-    ::update_largest_contiguous_free_space(mem);
+    ::update_free_space(mem);
 }
 
 void mg::unbind_image_from_memory(mg::vk_memory *mem, mg::vk_image *img)
@@ -194,34 +145,81 @@ void mg::unbind_image_from_memory(mg::vk_memory *mem, mg::vk_image *img)
     assert(mem != nullptr);
     assert(img != nullptr);
     assert(img->memory == mem);
-    assert(mem->binding_type == memory_binding_type::Image);
+    assert(mg::can_bind(mem, mg::memory_binding_type::Image));
     
-    for_list(i, binding, &mem->bindings)
-        if (binding->data.image->image == img->image)
-            break;
-        
-    if (i >= mem->bindings.size)
+    if (img->memory_block == mg::TLSF_INVALID_BLOCK)
         return;
     
-    trace("unbinding image %p from memory %p (index %u) at offset %u with size %u\n", img, mem->memory, mem->type_index, it->range.offset, it->range.size);
+    trace("unbinding image %p from memory %p (index %u) at offset %u\n", img, mem->memory, mem->type_index, img->offset);
 
-    mem->total_free_space += binding->range.size;
-    ::remove_elements(&mem->bindings, i, 1);
-    ::update_largest_contiguous_free_space(mem);
+    mg::release_block(mem, img->memory_block);
     
     img->memory = nullptr;
+    img->memory_block = mg::TLSF_INVALID_BLOCK;
     img->offset = 0;
 }
 
-bool mg::has_space_for(mg::vk_memory *mem, VkDeviceSize size, VkDeviceSize alignment)
+bool mg::has_space_for(mg::vk_memory *mem, VkDeviceSize size, VkDeviceSize alignment, mg::memory_resource_kind kind)
+{
+    assert(mem != nullptr);
+    return mg::has_space_for(&mem->bindings, size, alignment, (u8)kind);
+}
+
+u32 mg::reserve_block(mg::vk_memory *mem, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize *out_offset)
+{
+    assert(mem != nullptr);
+    assert(out_offset != nullptr);
+
+    u32 block = mg::allocate_block(&mem->bindings, size, alignment, out_offset);
+
+    if (block != mg::TLSF_INVALID_BLOCK)
+        ::update_free_space(mem);
+
+    return block;
+}
+
+void mg::release_block(mg::vk_memory *mem, u32 block)
 {
     assert(mem != nullptr);
-    return mg::has_space_for(&mem->largest_contiguous_free_space, size, alignment);
+    assert(block != mg::TLSF_INVALID_BLOCK);
+
+    mg::free_block(&mem->bindings, block);
+    ::update_free_space(mem);
+}
+
+void *mg::map_memory(mg::vk_memory *mem, VkDevice dev)
+{
+    assert(mem != nullptr);
+    assert((mem->type & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) == VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+
+    if (mem->mapped != nullptr)
+        return mem->mapped;
+
+    VkResult res = vkMapMemory(dev, mem->memory, 0, VK_WHOLE_SIZE, 0, &mem->mapped);
+
+    if (res != VK_SUCCESS)
+    {
+        mem->mapped = nullptr;
+        throw_vk_error(res, "could not map vk_memory %p", mem);
+    }
+
+    return mem->mapped;
+}
+
+void mg::unmap_memory(mg::vk_memory *mem, VkDevice dev)
+{
+    assert(mem != nullptr);
+
+    if (mem->mapped == nullptr)
+        return;
+
+    vkUnmapMemory(dev, mem->memory);
+    mem->mapped = nullptr;
 }
 
 void mg::free(mg::vk_memory *mem)
 {
     assert(mem != nullptr);
 
-    ::free(&mem->bindings);
+    mg::free(&mem->bindings);
 }
@@ -2,10 +2,11 @@
 
 #include <vulkan/vulkan_core.h>
 
-#include "shl/linked_list.hpp"
 #include "shl/number_types.hpp"
 
 #include "mg/number_range.hpp"
+#include "mg/impl/slab.hpp"
+#include "mg/impl/tlsf_allocator.hpp"
 
 namespace mg
 {
@@ -15,23 +16,23 @@ struct vk_image;
 enum class memory_binding_type : u8
 {
     Buffer,
-    Image
+    Image,
+    Mixed // buffers and images
 };
 
-typedef number_range<VkDeviceSize> bind_range;
-
-struct vk_memory_binding
+// how a bound resource is laid out, see bufferImageGranularity.
+// buffers and linear images are Linear, optimal images are NonLinear.
+// used as the kind of blocks in vk_memory::bindings.
+enum class memory_resource_kind : u8
 {
-    mg::bind_range range;
-
-    union _data
-    {
-        mg::vk_buffer *buffer;
-        mg::vk_image *image;
-    } data;
+    None,
+    Linear,
+    NonLinear
 };
 
-typedef linked_list<mg::vk_memory_binding> binding_list;
+typedef number_range<VkDeviceSize> bind_range;
+
+constexpr const u64 MEMORY_NOT_EMPTY = UINT64_MAX;
 
 struct vk_memory
 {
@@ -40,15 +41,38 @@ struct vk_memory
     VkMemoryPropertyFlags type;
     u32 type_index;
     mg::memory_binding_type binding_type;
+
+    // allocated for a single buffer or image, see allocate_dedicated_memory.
+    // other resources are never bound to dedicated memory and it is freed
+    // together with its resource.
+    bool dedicated;
     
     mg::bind_range largest_contiguous_free_space;
     VkDeviceSize total_free_space;
 
+    // start of the whole memory if it is mapped.
+    // host visible memory is mapped when it is allocated.
+    void *mapped;
+
     // internal things
-    mg::binding_list bindings;
+    // slot inside memory_allocator::memory_slab, see get_memory
+    mg::slab_handle handle;
+
+    // frame in which the memory was first seen empty, see release_empty_memory
+    u64 empty_since_frame;
+
+    // bound buffers and images keep the index of their block
+    // in this allocator, see vk_buffer::memory_block.
+    mg::tlsf_allocator bindings;
 };
 
-void init(mg::vk_memory *mem, VkDeviceMemory memory = nullptr, VkDeviceSize size = 0, VkMemoryPropertyFlags type = 0, mg::memory_binding_type binding_type = mg::memory_binding_type::Buffer, u32 type_index = 0);
+// granularity is bufferImageGranularity, linear and non-linear resources
+// bound to the memory are kept on separate pages of that size.
+void init(mg::vk_memory *mem, VkDeviceMemory memory = nullptr, VkDeviceSize size = 0, VkMemoryPropertyFlags type = 0, mg::memory_binding_type binding_type = mg::memory_binding_type::Buffer, u32 type_index = 0, VkDeviceSize granularity = 1);
+
+// true if resources of the given type may be bound to the memory
+bool can_bind(const mg::vk_memory *mem, mg::memory_binding_type type);
+mg::memory_resource_kind get_resource_kind(const mg::vk_image *img);
 
 void bind_buffer_to_memory(mg::vk_memory *mem, VkDevice dev, mg::vk_buffer *buf);
 void unbind_buffer_from_memory(mg::vk_memory *mem, mg::vk_buffer *buf);
@@ -56,7 +80,21 @@ void unbind_buffer_from_memory(mg::vk_memory *mem, mg::vk_buffer *buf);
 void bind_image_to_memory(mg::vk_memory *mem, VkDevice dev, mg::vk_image *buf);
 void unbind_image_from_memory(mg::vk_memory *mem, mg::vk_image *buf);
 
-bool has_space_for(mg::vk_memory *mem, VkDeviceSize size, VkDeviceSize alignment);
+bool has_space_for(mg::vk_memory *mem, VkDeviceSize size, VkDeviceSize alignment, mg::memory_resource_kind kind = mg::memory_resource_kind::None);
+
+// allocates a block of bindings without binding a resource to it, e.g. to
+// manage the range elsewhere. returns TLSF_INVALID_BLOCK if it does not fit.
+u32 reserve_block(mg::vk_memory *mem, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize *out_offset);
+
+// frees a block of bindings without touching the resource that was bound to it,
+// e.g. when the resource was already destroyed.
+void release_block(mg::vk_memory *mem, u32 block);
+
+// maps the whole memory once and keeps it mapped until unmap_memory or
+// until the memory is freed. memory must be host visible.
+// does nothing if the memory is already mapped.
+void *map_memory(mg::vk_memory *mem, VkDevice dev);
+void unmap_memory(mg::vk_memory *mem, VkDevice dev);
 
 void free(mg::vk_memory *mem);
 }
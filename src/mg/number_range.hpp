@@ -1,7 +1,5 @@
 #pragma once
 
-#include <math.h>
-
 namespace mg
 {
 template<typename T>
@@ -17,7 +15,7 @@ T align_next(T x, T alignment)
     if (x % alignment == 0)
         return x;
     
-    return ceil(x / alignment) * alignment;
+    return ((x / alignment) + 1) * alignment;
 }
     
 template<typename T>
@@ -43,6 +41,10 @@ bool has_space_for(const number_range<T> *range, T size, T alignment)
 {
     auto aligned = align_next(range->offset, alignment);
     auto offset_diff = aligned - range->offset;
+
+    if (offset_diff > range->size)
+        return false;
+
     auto size_diff = range->size - offset_diff;
     return size_diff >= size;
 }
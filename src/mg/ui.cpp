@@ -69,7 +69,7 @@ void ui::init(mg::window *window)
     init_info.DescriptorPool = imguiPool;
     init_info.MinImageCount = 3;
     init_info.ImageCount = 3;
-    init_info.MSAASamples = VK_SAMPLE_COUNT_1_BIT;
+    init_info.MSAASamples = ctx->samples;
 
     ImGui_ImplVulkan_Init(&init_info, ctx->render_pass);
 }